@@ -18,6 +18,8 @@
 #ifndef QBDI_CALLBACK_H_
 #define QBDI_CALLBACK_H_
 
+#include <stddef.h>
+
 #include "QBDI/Bitmask.h"
 #include "QBDI/InstAnalysis.h"
 #include "QBDI/Platform.h"
@@ -281,6 +283,66 @@ typedef struct {
   MemoryAccessFlags flags; /*!< Memory access flags */
 } MemoryAccess;
 
+/*! Number of entries of an inline trace buffer
+ */
+#define QBDI_INLINE_TRACE_SIZE 65536
+
+/*! Value recorded in an inline trace buffer
+ */
+typedef enum {
+  _QBDI_EI(INLINE_TRACE_ADDRESS) = 0,     /*!< No value (0) */
+  _QBDI_EI(INLINE_TRACE_REGISTER) = 1,    /*!< Value of a general purpose
+                                           * register before the instruction
+                                           */
+  _QBDI_EI(INLINE_TRACE_MEMORY_READ) = 2, /*!< Value read by the instruction
+                                           * (0 for the access larger than a
+                                           * rword)
+                                           */
+} InlineTraceType;
+
+/*! Ring buffer written by the inline trace instrumentation.
+ *
+ * Each instrumented instruction writes its address and a value at the position
+ * ``index`` then increments ``index`` modulo QBDI_INLINE_TRACE_SIZE.
+ */
+typedef struct {
+  rword index; /*!< Position of the next entry */
+  rword addresses[QBDI_INLINE_TRACE_SIZE]; /*!< Address of the instructions */
+  rword values[QBDI_INLINE_TRACE_SIZE];    /*!< Recorded values */
+} InlineTraceBuffer;
+
+/*! Size in bytes of an edge coverage map (the default map size of AFL)
+ */
+#define QBDI_EDGE_MAP_SIZE 65536
+
+/*! Number of records buffered by a batch callback before they are lost
+ */
+#define QBDI_BATCH_SIZE 65536
+
+/*! Record written by the batch callback instrumentation
+ */
+typedef struct {
+  rword address;       /*!< Address of the instruction */
+  rword value;         /*!< Value of the selected register before the
+                        *   instruction
+                        */
+  rword accessAddress; /*!< Address read by the instruction (0 if the
+                        *   instruction doesn't read the memory)
+                        */
+} BatchRecord;
+
+/*! Batch callback function type.
+ *
+ * @param[in] vm         VM instance of the callback.
+ * @param[in] records    The records written since the last call, in the
+ *                       execution order. Only valid during the callback.
+ * @param[in] nbRecords  The number of records.
+ * @param[in] data       User defined data which can be defined when
+ *                       registering the callback.
+ */
+typedef void (*BatchCallback)(VMInstanceRef vm, const BatchRecord *records,
+                              size_t nbRecords, void *data);
+
 #ifdef __cplusplus
 struct InstrRuleDataCBK {
   InstPosition position; /*!< Relative position of the event callback (PREINST /
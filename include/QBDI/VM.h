@@ -596,6 +596,115 @@ public:
   uint32_t addMemRangeCB(rword start, rword end, MemoryAccessType type,
                          InstCbLambda &&cbk);
 
+  /*! Add an inline counter incremented before each instruction in a specific
+   * address range. The counter is incremented by the translated code without
+   * returning to the host, and without modifying the flags or the stack of
+   * the guest. The translated code needs two registers which aren't used by
+   * the instruction: an instruction which uses more registers isn't counted
+   * and a warning is logged.
+   *
+   * @param[in] start    Start of the address range.
+   * @param[in] end      End of the address range.
+   * @param[in] counter  The counter to increment.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addInlineCounter(rword start, rword end, rword *counter);
+
+  /*! Add an inline coverage map for the instructions in a specific address
+   * range. Before each instruction, the translated code sets to 1 the byte of
+   * the map at the index hash(address) % size, without returning to the host.
+   * As for addInlineCounter, an instruction which doesn't leave a register
+   * free for the translated code isn't covered and a warning is logged.
+   *
+   * @param[in] start    Start of the address range.
+   * @param[in] end      End of the address range.
+   * @param[in] bitmap   The coverage map.
+   * @param[in] size     The size of the coverage map in bytes.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addInlineCoverage(rword start, rword end, uint8_t *bitmap,
+                             rword size);
+
+  /*! Add an inline trace of the instructions in a specific address range.
+   * Before each instruction, the translated code writes the address of the
+   * instruction and a value in the ring buffer, without returning to the
+   * host.
+   *
+   * @param[in] start    Start of the address range.
+   * @param[in] end      End of the address range.
+   * @param[in] buffer   The ring buffer.
+   * @param[in] type     The recorded value. With
+   *                     QBDI::INLINE_TRACE_MEMORY_READ, only the instructions
+   *                     which read the memory are traced.
+   * @param[in] reg      The index of the general purpose register recorded
+   *                     with QBDI::INLINE_TRACE_REGISTER.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addInlineTrace(rword start, rword end, InlineTraceBuffer *buffer,
+                          InlineTraceType type = INLINE_TRACE_ADDRESS,
+                          unsigned reg = 0);
+
+  /*! Add an AFL style edge coverage of the basic blocks in a specific address
+   * range. At the beginning of each basic block, the translated code
+   * increments the counter of the edge from the previous basic block in the
+   * coverage map, without returning to the host. The edges entering the middle
+   * of a basic block already in the cache aren't recorded.
+   *
+   * @param[in] start    Start of the address range.
+   * @param[in] end      End of the address range.
+   * @param[in] bitmap   The coverage map of QBDI_EDGE_MAP_SIZE bytes (can be
+   *                     a shared memory). On X86, the counters are set to 1
+   *                     instead of being incremented.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addEdgeCoverage(rword start, rword end, uint8_t *bitmap);
+
+  /*! Reset the previous basic block of an edge coverage, before the execution
+   * of a new input. The cache and the coverage map aren't cleared.
+   *
+   * @param[in] id   The id of the edge coverage.
+   *
+   * @return True if the edge coverage has been reset.
+   */
+  bool resetEdgeCoverage(uint32_t id);
+
+  /*! Register a batch callback on the instructions of a specific address
+   * range. Before each instruction, the translated code writes a BatchRecord
+   * in a buffer without returning to the host. The records are delivered to
+   * the callback in execution order when the buffer is half full and at the
+   * end of the run. The records not delivered when the instrumentation is
+   * deleted are lost.
+   *
+   * The buffer is a ring of QBDI_BATCH_SIZE records checked by the VM between
+   * two sequences. The linked sequences (OPT_ENABLE_BLOCK_CHAINING) don't
+   * return to the VM, and a loop of linked sequences would overwrite the
+   * records before their delivery. A check in the translated code would cost
+   * a comparison which preserves the flags before each instruction, so the
+   * sequences aren't linked while a batch callback is registered: each
+   * sequence returns to the VM, as without OPT_ENABLE_BLOCK_CHAINING, but
+   * the records are still written without a break to the host.
+   *
+   * @param[in] start    Start of the address range.
+   * @param[in] end      End of the address range.
+   * @param[in] reg      The index of the general purpose register recorded in
+   *                     BatchRecord.value.
+   * @param[in] cbk      A function pointer to the callback.
+   * @param[in] data     User defined data passed to the callback.
+   *
+   * @return The id of the registered instrumentation (or
+   * VMError::INVALID_EVENTID in case of failure).
+   */
+  uint32_t addBatchCB(rword start, rword end, unsigned reg, BatchCallback cbk,
+                      void *data);
+
   /*! Register a callback event for a specific VM event.
    *
    * @param[in] mask  A mask of VM event type which will trigger the callback.
@@ -626,6 +735,34 @@ public:
    */
   bool deleteInstrumentation(uint32_t id);
 
+  /*! Enable or disable an instrumentation. With the option
+   *  OPT_ENABLE_CALLBACK_SLOTS, the callbacks of the instrumentation are
+   *  skipped by a single jump in the translated code and the cache isn't
+   *  cleared. Otherwise, the code instrumented by the callback is translated
+   *  again.
+   *
+   * @param[in] id       The id of the instrumentation.
+   * @param[in] enabled  Whether the instrumentation is enabled.
+   *
+   * @return True if the state of the instrumentation has been set (the
+   *         callbacks of addMemRangeCB aren't supported).
+   */
+  bool setCallbackEnabled(uint32_t id, bool enabled);
+
+  /*! Change the data pointer given to the callbacks of an instrumentation.
+   *  With the option OPT_ENABLE_CALLBACK_SLOTS, the data is changed in the
+   *  translated code and the cache isn't cleared. Otherwise, the code
+   *  instrumented by the callback is translated again.
+   *
+   * @param[in] id    The id of the instrumentation.
+   * @param[in] data  The new data pointer.
+   *
+   * @return True if the data has been changed (the instrumentations
+   *         registered with a lambda and the callbacks of addMemRangeCB aren't
+   *         supported).
+   */
+  bool setInstrumentationData(uint32_t id, void *data);
+
   /*! Remove all the registered instrumentations.
    *
    */
@@ -696,6 +833,52 @@ public:
    */
   bool precacheBasicBlock(rword pc);
 
+  /*! Queue basic blocks to be translated by a background thread, for
+   *  instance the known functions of a module. The translated basic blocks
+   *  are written in the cache when the execution reaches one of them. The
+   *  method can be called in a callback of the VM.
+   *
+   *  The callbacks of addInstrRule and addInstrRuleRange are called by the
+   *  background thread for the queued basic blocks, and mustn't use the VM.
+   *
+   * @param[in] pcs  Start addresses of basic blocks
+   */
+  void precacheAsync(const std::vector<rword> &pcs);
+
+  /*! Wait for the basic blocks queued by precacheAsync and write them in the
+   *  cache. This method mustn't be called if the VM already runs.
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t waitPrecache();
+
+  /*! Pre-cache the basic blocks of a range that are reachable from its start
+   *  address through direct jumps and calls. The targets of the indirect
+   *  jumps and calls aren't followed.
+   *  This method mustn't be called if the VM already runs.
+   *
+   * @param[in]  start     Start address of the range
+   * @param[in]  end       End address of the range (excluded)
+   * @param[out] codeSize  If not null, set to the number of bytes of
+   *                       original code translated
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheRange(rword start, rword end, size_t *codeSize = nullptr);
+
+  /*! Pre-cache the basic blocks of a function and of its callees that are
+   *  reachable through direct jumps and calls in the instrumented ranges.
+   *  The targets of the indirect jumps and calls aren't followed.
+   *  This method mustn't be called if the VM already runs.
+   *
+   * @param[in]  addr      Start address of the function
+   * @param[out] codeSize  If not null, set to the number of bytes of
+   *                       original code translated
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheFunction(rword addr, size_t *codeSize = nullptr);
+
   /*! Clear a specific address range from the translation cache.
    *
    * @param[in] start Start of the address range to clear from the cache.
@@ -707,6 +890,69 @@ public:
   /*! Clear the entire translation cache.
    */
   void clearAllCache();
+
+  /*! Set the maximal size of the translation cache. When a new ExecBlock
+   *  exceeds it, the regions of the cache which were executed least recently
+   *  are evicted, until a quarter of the budget is free. The other regions
+   *  are kept. The cache is unlimited by default.
+   *
+   * @param[in] budget  The size in bytes of the code and the data of the
+   *                    translated basic blocks (0 to disable the limit).
+   */
+  void setCacheBudget(rword budget);
+
+  /*! Write the translation cache in a file. The file can be loaded by another
+   *  process with loadTranslationCache to avoid the translation of the cached
+   *  basic blocks.
+   *
+   *  The cache is only supported on X86_64 and cannot be used with an
+   *  instrumentation rule added with addInstrRule or addInstrRuleRange.
+   *
+   * @param[in] path   The path of the file.
+   *
+   * @return True if the file has been written.
+   */
+  bool saveTranslationCache(const std::string &path) const;
+
+  /*! Load a translation cache written by saveTranslationCache. The file is
+   *  only used if the VM has the same options and the same instrumentation.
+   *  The callbacks and their data are identified by their module and offset,
+   *  a data outside of the modules must have the same address. The cached
+   *  basic blocks of a module are only loaded if the module has the same
+   *  build ID, and are relocated at the current address of the module. The
+   *  coverage instrumentation (addInlineCoverage, addEdgeCoverage) depends on
+   *  the addresses and requires the module to be loaded at the same address.
+   *  This method mustn't be called if the VM already runs.
+   *
+   * @param[in] path   The path of the file.
+   *
+   * @return True if the file matches the configuration of the VM.
+   */
+  bool loadTranslationCache(const std::string &path);
+
+  /*! Share the translation cache of another VM, to use one VM per thread
+   *  without translating the same code in each of them. At the end of a run,
+   *  the VM publishes the regions of its cache that changed. On a cache miss,
+   *  it loads the region published for this address instead of translating
+   *  the code. A region is only loaded by the VMs with the same options and
+   *  the same instrumentation (the callbacks and their data must have the
+   *  same addresses). Each VM executes its own copy of the loaded code.
+   *
+   *  clearCache invalidates the range in the shared cache, and the other VMs
+   *  clear it in their own cache before their next run. clearAllCache only
+   *  clears the cache of this VM.
+   *
+   *  The copies of the VM use the same shared cache. The shared cache is only
+   *  supported on X86_64 and cannot be used with an instrumentation rule
+   *  added with addInstrRule or addInstrRuleRange. This method mustn't be
+   *  called if one of the VMs runs.
+   *
+   * @param[in] other  The VM which owns the shared cache. It is created if
+   *                   the VM doesn't have one.
+   *
+   * @return True if the cache is shared.
+   */
+  bool shareCache(VM &other);
 };
 
 } // namespace QBDI
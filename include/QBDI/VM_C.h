@@ -348,6 +348,116 @@ QBDI_EXPORT uint32_t qbdi_addMemRangeCB(VMInstanceRef instance, rword start,
                                         rword end, MemoryAccessType type,
                                         InstCallback cbk, void *data);
 
+/*! Add an inline counter incremented before each instruction in a specific
+ * address range. The counter is incremented by the translated code without
+ * returning to the host, and without modifying the flags or the stack of the
+ * guest. An instruction which doesn't leave two registers free for the
+ * translated code isn't counted and a warning is logged.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] counter   The counter to increment.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addInlineCounter(VMInstanceRef instance, rword start,
+                                           rword end, rword *counter);
+
+/*! Add an inline coverage map for the instructions in a specific address
+ * range. Before each instruction, the translated code sets to 1 the byte of
+ * the map at the index hash(address) % size, without returning to the host.
+ * An instruction which doesn't leave a register free for the translated code
+ * isn't covered and a warning is logged.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] bitmap    The coverage map.
+ * @param[in] size      The size of the coverage map in bytes.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addInlineCoverage(VMInstanceRef instance,
+                                            rword start, rword end,
+                                            uint8_t *bitmap, rword size);
+
+/*! Add an inline trace of the instructions in a specific address range.
+ * Before each instruction, the translated code writes the address of the
+ * instruction and a value in the ring buffer, without returning to the host.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] buffer    The ring buffer.
+ * @param[in] type      The recorded value. With QBDI_INLINE_TRACE_MEMORY_READ,
+ *                      only the instructions which read the memory are traced.
+ * @param[in] reg       The index of the general purpose register recorded
+ *                      with QBDI_INLINE_TRACE_REGISTER.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addInlineTrace(VMInstanceRef instance, rword start,
+                                         rword end, InlineTraceBuffer *buffer,
+                                         InlineTraceType type, unsigned reg);
+
+/*! Add an AFL style edge coverage of the basic blocks in a specific address
+ * range. At the beginning of each basic block, the translated code increments
+ * the counter of the edge from the previous basic block in the coverage map,
+ * without returning to the host. The edges entering the middle of a basic
+ * block already in the cache aren't recorded.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] bitmap    The coverage map of QBDI_EDGE_MAP_SIZE bytes (can be a
+ *                      shared memory). On X86, the counters are set to 1
+ *                      instead of being incremented.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addEdgeCoverage(VMInstanceRef instance, rword start,
+                                          rword end, uint8_t *bitmap);
+
+/*! Reset the previous basic block of an edge coverage, before the execution of
+ * a new input. The cache and the coverage map aren't cleared.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] id        The id of the edge coverage.
+ *
+ * @return True if the edge coverage has been reset.
+ */
+QBDI_EXPORT bool qbdi_resetEdgeCoverage(VMInstanceRef instance, uint32_t id);
+
+/*! Register a batch callback on the instructions of a specific address range.
+ * Before each instruction, the translated code writes a BatchRecord in a
+ * buffer without returning to the host. The records are delivered to the
+ * callback in execution order when the buffer is half full and at the end of
+ * the run. The records not delivered when the instrumentation is deleted are
+ * lost. The buffer is a ring of QBDI_BATCH_SIZE records checked by the VM
+ * between two sequences, so the sequences aren't linked
+ * (QBDI_OPT_ENABLE_BLOCK_CHAINING) while a batch callback is registered: a
+ * loop of linked sequences would overwrite the records before their delivery.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] start     Start of the address range.
+ * @param[in] end       End of the address range.
+ * @param[in] reg       The index of the general purpose register recorded in
+ *                      BatchRecord.value.
+ * @param[in] cbk       A function pointer to the callback.
+ * @param[in] data      User defined data passed to the callback.
+ *
+ * @return The id of the registered instrumentation (or QBDI_INVALID_EVENTID
+ * in case of failure).
+ */
+QBDI_EXPORT uint32_t qbdi_addBatchCB(VMInstanceRef instance, rword start,
+                                     rword end, unsigned reg,
+                                     BatchCallback cbk, void *data);
+
 /*! Register a callback event if the instruction matches the mnemonic.
  *
  * @param[in] instance   VM instance.
@@ -440,6 +550,30 @@ QBDI_EXPORT uint32_t qbdi_addVMEventCB(VMInstanceRef instance, VMEvent mask,
 QBDI_EXPORT bool qbdi_deleteInstrumentation(VMInstanceRef instance,
                                             uint32_t id);
 
+/*! Enable or disable an instrumentation. With the option
+ *  OPT_ENABLE_CALLBACK_SLOTS, the cache isn't cleared.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] id        The id of the instrumentation.
+ * @param[in] enabled   Whether the instrumentation is enabled.
+ *
+ * @return True if the state of the instrumentation has been set.
+ */
+QBDI_EXPORT bool qbdi_setCallbackEnabled(VMInstanceRef instance, uint32_t id,
+                                         bool enabled);
+
+/*! Change the data pointer given to the callbacks of an instrumentation. With
+ *  the option OPT_ENABLE_CALLBACK_SLOTS, the cache isn't cleared.
+ *
+ * @param[in] instance  VM instance.
+ * @param[in] id        The id of the instrumentation.
+ * @param[in] data      The new data pointer.
+ *
+ * @return True if the data has been changed.
+ */
+QBDI_EXPORT bool qbdi_setInstrumentationData(VMInstanceRef instance,
+                                             uint32_t id, void *data);
+
 /*! Remove all the registered instrumentations.
  *
  * @param[in] instance  VM instance.
@@ -525,6 +659,55 @@ QBDI_EXPORT MemoryAccess *qbdi_getBBMemoryAccess(VMInstanceRef instance,
  */
 QBDI_EXPORT bool qbdi_precacheBasicBlock(VMInstanceRef instance, rword pc);
 
+/*! Queue basic blocks to be translated by a background thread. The translated
+ *  basic blocks are written in the cache when the execution reaches one of
+ *  them. This method can be called in a callback of the VM.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  pcs          Start addresses of basic blocks
+ *  @param[in]  size         Number of addresses in pcs
+ */
+QBDI_EXPORT void qbdi_precacheAsync(VMInstanceRef instance, const rword *pcs,
+                                    size_t size);
+
+/*! Wait for the basic blocks queued by qbdi_precacheAsync and write them in
+ *  the cache. This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_waitPrecache(VMInstanceRef instance);
+
+/*! Pre-cache the basic blocks of a range that are reachable from its start
+ *  address through direct jumps and calls.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  start        Start address of the range
+ *  @param[in]  end          End address of the range (excluded)
+ *  @param[out] codeSize     If not NULL, set to the number of bytes of original
+ *                           code translated
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheRange(VMInstanceRef instance, rword start,
+                                      rword end, size_t *codeSize);
+
+/*! Pre-cache the basic blocks of a function and of its callees that are
+ *  reachable through direct jumps and calls in the instrumented ranges.
+ *  This method mustn't be called when the VM runs.
+ *
+ *  @param[in]  instance     VM instance.
+ *  @param[in]  addr         Start address of the function
+ *  @param[out] codeSize     If not NULL, set to the number of bytes of original
+ *                           code translated
+ *
+ * @return The number of basic blocks inserted in the cache.
+ */
+QBDI_EXPORT size_t qbdi_precacheFunction(VMInstanceRef instance, rword addr,
+                                         size_t *codeSize);
+
 /*! Clear a specific address range from the translation cache.
  *
  * @param[in] instance     VM instance.
@@ -541,6 +724,47 @@ QBDI_EXPORT void qbdi_clearCache(VMInstanceRef instance, rword start,
  */
 QBDI_EXPORT void qbdi_clearAllCache(VMInstanceRef instance);
 
+/*! Set the maximal size of the translation cache. The regions of the cache
+ *  which were executed least recently are evicted when it's exceeded.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] budget       The size in bytes of the code and the data of the
+ *                         translated basic blocks (0 to disable the limit).
+ */
+QBDI_EXPORT void qbdi_setCacheBudget(VMInstanceRef instance, rword budget);
+
+/*! Write the translation cache in a file.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] path         The path of the file.
+ *
+ * @return True if the file has been written.
+ */
+QBDI_EXPORT bool qbdi_saveTranslationCache(VMInstanceRef instance,
+                                           const char *path);
+
+/*! Load a translation cache written by qbdi_saveTranslationCache. The file is
+ * only used if the VM has the same options and the same instrumentation.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] path         The path of the file.
+ *
+ * @return True if the file matches the configuration of the VM.
+ */
+QBDI_EXPORT bool qbdi_loadTranslationCache(VMInstanceRef instance,
+                                           const char *path);
+
+/*! Share the translation cache of another VM. The VMs load the regions of
+ * the cache translated by the others with the same options and the same
+ * instrumentation.
+ *
+ * @param[in] instance     VM instance.
+ * @param[in] other        The VM which owns the shared cache.
+ *
+ * @return True if the cache is shared.
+ */
+QBDI_EXPORT bool qbdi_shareCache(VMInstanceRef instance, VMInstanceRef other);
+
 #ifdef __cplusplus
 } // "C"
 } // QBDI::
@@ -30,15 +30,51 @@ namespace QBDI {
 typedef enum {
   _QBDI_EI(NO_OPT) = 0, /*!< Default value */
   // general options between 0 and 23
-  _QBDI_EI(OPT_DISABLE_FPR) = 1 << 0,          /*!< Disable all operation on FPU
-                                                * (SSE, AVX, SIMD). May break
-                                                * the execution if the target
-                                                * use the FPU
-                                                */
-  _QBDI_EI(OPT_DISABLE_OPTIONAL_FPR) = 1 << 1, /*!< Disable context switch
-                                                * optimisation when the target
-                                                * execblock doesn't used FPR
-                                                */
+  _QBDI_EI(OPT_DISABLE_FPR) = 1 << 0,           /*!< Disable all operation on
+                                                 * FPU (SSE, AVX, SIMD). May
+                                                 * break the execution if the
+                                                 * target use the FPU
+                                                 */
+  _QBDI_EI(OPT_DISABLE_OPTIONAL_FPR) = 1 << 1,  /*!< Disable context switch
+                                                 * optimisation when the target
+                                                 * execblock doesn't used FPR
+                                                 */
+  _QBDI_EI(OPT_ENABLE_BLOCK_CHAINING) = 1 << 2, /*!< Link the sequences of an
+                                                 * ExecBlock together when they
+                                                 * exit to a constant address.
+                                                 * Indirect exits use an inline
+                                                 * cache of their last targets.
+                                                 * VMEvent on sequences and
+                                                 * basic blocks disable the
+                                                 * links.
+                                                 */
+  _QBDI_EI(OPT_ENABLE_SHADOW_STACK) = 1 << 3,   /*!< Maintain a shadow return
+                                                 * stack to link the returns
+                                                 * to the instruction
+                                                 * following their call. Needs
+                                                 * OPT_ENABLE_BLOCK_CHAINING.
+                                                 */
+  _QBDI_EI(OPT_ENABLE_TRACES) = 1 << 4,         /*!< Count the executions of
+                                                 * the sequences and write the
+                                                 * hot paths as traces with
+                                                 * side exits. VMEvent on
+                                                 * sequences and basic blocks
+                                                 * disable the traces.
+                                                 */
+  _QBDI_EI(OPT_ENABLE_CALLBACK_SLOTS) = 1 << 5, /*!< The callbacks read their
+                                                 * function and data in the
+                                                 * data block. They can be
+                                                 * enabled, disabled or receive
+                                                 * a new data without
+                                                 * clearing the cache.
+                                                 */
+  _QBDI_EI(OPT_INLINE_VM_EVENTS) = 1 << 6,      /*!< Signal the VMEvent on
+                                                 * sequences and basic blocks
+                                                 * from callback sites at the
+                                                 * boundaries of the translated
+                                                 * basic blocks. The sequences
+                                                 * can be linked and traced.
+                                                 */
   // architecture specific option between 24 and 31
   _QBDI_EI(OPT_ATT_SYNTAX) = 1 << 24,   /*!< Used the AT&T syntax for
                                          * instruction disassembly
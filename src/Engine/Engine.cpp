@@ -17,31 +17,44 @@
  */
 #include <algorithm>
 #include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
 #include <string.h>
 
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCInstrInfo.h"
 
 #include "Engine/Engine.h"
 #include "Engine/LLVMCPU.h"
+#include "Engine/PrecacheWorker.h"
 
 #include "ExecBlock/Context.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/ExecBlockManager.h"
+#include "ExecBlock/SharedCache.h"
 #include "ExecBroker/ExecBroker.h"
+#include "Patch/InstInfo.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/InstrRule.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchRule.h"
 #include "Patch/PatchRules.h"
+#include "Utility/AddressMap.h"
 #include "Utility/LogSys.h"
+#include "Utility/Module.h"
+#include "Utility/Serialize.h"
+#include "Utility/System.h"
 
 #include "QBDI/Bitmask.h"
 #include "QBDI/Config.h"
 #include "QBDI/Errors.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "QBDI/Version.h"
 
 #include "spdlog/fmt/bin_to_hex.h"
 
@@ -50,11 +63,66 @@
 
 namespace QBDI {
 
+// VM events that must be signaled between two sequences. The sequences cannot
+// be linked when one of these events is used.
+static const VMEvent SEQUENCE_EVENT_MASK =
+    VMEvent::SEQUENCE_ENTRY | VMEvent::SEQUENCE_EXIT |
+    VMEvent::BASIC_BLOCK_ENTRY | VMEvent::BASIC_BLOCK_EXIT;
+
+// Groups of VM events for which Engine::runLoop is instantiated. A loop only
+// contains the branches of the events of its groups.
+static constexpr uint32_t RUN_SEQUENCE_EVENTS =
+    static_cast<uint32_t>(VMEvent::SEQUENCE_ENTRY) |
+    static_cast<uint32_t>(VMEvent::SEQUENCE_EXIT) |
+    static_cast<uint32_t>(VMEvent::BASIC_BLOCK_ENTRY) |
+    static_cast<uint32_t>(VMEvent::BASIC_BLOCK_EXIT);
+static constexpr uint32_t RUN_NEW_EVENTS =
+    static_cast<uint32_t>(VMEvent::BASIC_BLOCK_NEW);
+static constexpr uint32_t RUN_TRANSFER_EVENTS =
+    static_cast<uint32_t>(VMEvent::EXEC_TRANSFER_CALL) |
+    static_cast<uint32_t>(VMEvent::EXEC_TRANSFER_RETURN);
+
+static inline uint32_t getRunEvents(VMEvent mask, Options options) {
+  uint32_t events = 0;
+  // The callback sites in the sequences signal these events
+  if ((mask & RUN_SEQUENCE_EVENTS) and
+      (options & Options::OPT_INLINE_VM_EVENTS) == 0) {
+    events |= RUN_SEQUENCE_EVENTS;
+  }
+  if (mask & RUN_NEW_EVENTS) {
+    events |= RUN_NEW_EVENTS;
+  }
+  if (mask & RUN_TRANSFER_EVENTS) {
+    events |= RUN_TRANSFER_EVENTS;
+  }
+  return events;
+}
+
+// State of Engine::run kept when the dispatch loop changes
+struct Engine::RunState {
+  rword currentPC;
+  rword stop;
+  bool hasRan;
+  rword basicBlockBeginAddr;
+  rword basicBlockEndAddr;
+  // Last sequence executed, used to fill the inline caches of indirect exits
+  ExecBlock *prevExecBlock;
+  uint16_t prevSeqID;
+};
+
+// Number of executions from the VM after which a sequence is the head of a
+// trace (OPT_ENABLE_TRACES)
+static const uint32_t TRACE_THRESHOLD = 50;
+
+// Maximal number of sequences recorded in a trace
+static const size_t TRACE_MAX_SEQUENCES = 16;
+
 Engine::Engine(const std::string &_cpu, const std::vector<std::string> &_mattrs,
                Options opts, VMInstanceRef vminstance)
     : vminstance(vminstance), instrRulesCounter(0), vmCallbacksCounter(0),
       curCPUMode(CPUMode::DEFAULT), options(opts), eventMask(VMEvent::NO_EVENT),
-      running(false) {
+      running(false), traceSeqEnd(0), inlineBasicBlockBegin(0),
+      sharedGeneration(0), linkedStop(0) {
 
   llvmCPUs = std::make_unique<LLVMCPUs>(_cpu, _mattrs, opts);
   blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, vminstance);
@@ -67,14 +135,24 @@ Engine::Engine(const std::string &_cpu, const std::vector<std::string> &_mattrs,
   fprState = std::make_unique<FPRState>();
   curGPRState = gprState.get();
   curFPRState = fprState.get();
+  curContext = nullptr;
 
   initGPRState();
   initFPRState();
 
   curExecBlock = nullptr;
+  selectRunLoop();
+
+  seqEntryRule = InstrRuleSequenceEvent::unique(
+      sequenceEntryCB, this, PREINST, std::numeric_limits<int>::max());
+  seqExitRule = InstrRuleSequenceEvent::unique(
+      sequenceExitCB, this, POSTINST, std::numeric_limits<int>::min());
 }
 
-Engine::~Engine() = default;
+Engine::~Engine() {
+  // stop the worker before the rules that it uses are destroyed
+  precacheWorker.reset();
+}
 
 Engine::Engine(const Engine &other)
     : vminstance(nullptr), instrRules(),
@@ -82,11 +160,15 @@ Engine::Engine(const Engine &other)
       vmCallbacks(other.vmCallbacks),
       vmCallbacksCounter(other.vmCallbacksCounter),
       curCPUMode(CPUMode::DEFAULT), options(other.options),
-      eventMask(other.eventMask), running(false) {
+      eventMask(other.eventMask), running(false),
+      currentRunLoop(other.currentRunLoop), traceSeqEnd(0),
+      inlineBasicBlockBegin(0), sharedCache(other.sharedCache),
+      sharedGeneration(other.sharedGeneration), linkedStop(0) {
 
   llvmCPUs = std::make_unique<LLVMCPUs>(
       other.llvmCPUs->getCPU(), other.llvmCPUs->getMattrs(), other.options);
   blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, nullptr);
+  blockManager->setCacheBudget(other.blockManager->getCacheBudget());
   execBroker = blockManager->getExecBroker();
   // copy instrumentation range
   execBroker->setInstrumentedRange(other.execBroker->getInstrumentedRange());
@@ -98,19 +180,29 @@ Engine::Engine(const Engine &other)
   for (const auto &r : other.instrRules) {
     instrRules.emplace_back(r.first, r.second->clone());
   }
+  batchRules = other.batchRules;
 
   gprState = std::make_unique<GPRState>();
   fprState = std::make_unique<FPRState>();
   curGPRState = gprState.get();
   curFPRState = fprState.get();
+  curContext = nullptr;
   setGPRState(other.getGPRState());
   setFPRState(other.getFPRState());
 
   curExecBlock = nullptr;
+
+  seqEntryRule = InstrRuleSequenceEvent::unique(
+      sequenceEntryCB, this, PREINST, std::numeric_limits<int>::max());
+  seqExitRule = InstrRuleSequenceEvent::unique(
+      sequenceExitCB, this, POSTINST, std::numeric_limits<int>::min());
 }
 
 Engine &Engine::operator=(const Engine &other) {
   QBDI_REQUIRE_ACTION(not running && "Cannot assign a running Engine", abort());
+  // the pending background translations are dropped
+  precacheWorker.reset();
+  precacheCPUs.reset();
   this->clearAllCache();
 
   if (not llvmCPUs->isSameCPU(*other.llvmCPUs)) {
@@ -122,6 +214,7 @@ Engine &Engine::operator=(const Engine &other) {
     blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, nullptr);
     execBroker = blockManager->getExecBroker();
   }
+  blockManager->setCacheBudget(other.blockManager->getCacheBudget());
 
   this->setOptions(other.options);
 
@@ -130,10 +223,14 @@ Engine &Engine::operator=(const Engine &other) {
   for (const auto &r : other.instrRules) {
     instrRules.emplace_back(r.first, r.second->clone());
   }
+  batchRules = other.batchRules;
   vmCallbacks = other.vmCallbacks;
   instrRulesCounter = other.instrRulesCounter;
   vmCallbacksCounter = other.vmCallbacksCounter;
   eventMask = other.eventMask;
+  selectRunLoop();
+  sharedCache = other.sharedCache;
+  sharedGeneration = other.sharedGeneration;
 
   // copy instrumentation range
   execBroker->setInstrumentedRange(other.execBroker->getInstrumentedRange());
@@ -150,8 +247,12 @@ void Engine::setOptions(Options options) {
                       abort());
   if (options != this->options) {
     QBDI_DEBUG("Change Options from {:x} to {:x}", this->options, options);
+    PrecacheWorker::Pause pause(precacheWorker.get());
     clearAllCache();
     llvmCPUs->setOptions(options);
+    if (precacheCPUs != nullptr) {
+      precacheCPUs->setOptions(options);
+    }
 
     Options needRecreate =
         Options::OPT_DISABLE_FPR | Options::OPT_DISABLE_OPTIONAL_FPR;
@@ -164,19 +265,24 @@ void Engine::setOptions(Options options) {
       const RangeSet<rword> instrumentationRange =
           execBroker->getInstrumentedRange();
 
+      rword cacheBudget = blockManager->getCacheBudget();
+
       patchRules = getDefaultPatchRules(options);
       blockManager = std::make_unique<ExecBlockManager>(*llvmCPUs, vminstance);
+      blockManager->setCacheBudget(cacheBudget);
       execBroker = blockManager->getExecBroker();
 
       execBroker->setInstrumentedRange(instrumentationRange);
     }
     this->options = options;
+    selectRunLoop();
   }
 }
 
 void Engine::changeVMInstanceRef(VMInstanceRef vminstance) {
   QBDI_REQUIRE_ACTION(
       not running && "Cannot changeVMInstanceRef on a running Engine", abort());
+  PrecacheWorker::Pause pause(precacheWorker.get());
   this->vminstance = vminstance;
 
   blockManager->changeVMInstanceRef(vminstance);
@@ -202,7 +308,33 @@ void Engine::initFPRState() {
 
 GPRState *Engine::getGPRState() const { return curGPRState; }
 
-FPRState *Engine::getFPRState() const { return curFPRState; }
+FPRState *Engine::getFPRState() const {
+  syncFPRState();
+  return curFPRState;
+}
+
+void Engine::switchContext(ExecBlock *execBlock) {
+  // Set context if necessary. The ExecBlocks of a region share the same
+  // context, the state is only copied when the region changes.
+  Context *context = execBlock->getContext();
+  if (&(context->gprState) != curGPRState ||
+      &(context->fprState) != curFPRState) {
+    syncFPRState();
+    context->gprState = *curGPRState;
+    setContextFPR(context, curFPRState);
+  }
+  curGPRState = &(context->gprState);
+  curFPRState = &(context->fprState);
+  curContext = context;
+}
+
+void Engine::syncFPRState() const {
+  // The last context switch may have saved the FPR in the XSAVE area of the
+  // context
+  if (curContext != nullptr) {
+    loadContextFPR(curContext);
+  }
+}
 
 void Engine::setGPRState(const GPRState *gprState) {
   QBDI_REQUIRE_ACTION(gprState, return );
@@ -211,7 +343,11 @@ void Engine::setGPRState(const GPRState *gprState) {
 
 void Engine::setFPRState(const FPRState *fprState) {
   QBDI_REQUIRE_ACTION(fprState, return );
-  *(this->curFPRState) = *fprState;
+  if (curContext != nullptr) {
+    setContextFPR(curContext, fprState);
+  } else {
+    *(this->curFPRState) = *fprState;
+  }
 }
 
 bool Engine::isPreInst() const {
@@ -226,40 +362,73 @@ bool Engine::isPreInst() const {
 }
 
 void Engine::addInstrumentedRange(rword start, rword end) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   execBroker->addInstrumentedRange(Range<rword>(start, end));
 }
 
 bool Engine::addInstrumentedModule(const std::string &name) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   return execBroker->addInstrumentedModule(name);
 }
 
 bool Engine::addInstrumentedModuleFromAddr(rword addr) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   return execBroker->addInstrumentedModuleFromAddr(addr);
 }
 
 bool Engine::instrumentAllExecutableMaps() {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   return execBroker->instrumentAllExecutableMaps();
 }
 
 void Engine::removeInstrumentedRange(rword start, rword end) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  // linked sequences may target the removed range
+  blockManager->unlinkSequences();
+  RangeSet<rword> previous = execBroker->getInstrumentedRange();
   execBroker->removeInstrumentedRange(Range<rword>(start, end));
+  clearRemovedRanges(previous);
 }
 
 bool Engine::removeInstrumentedModule(const std::string &name) {
-  return execBroker->removeInstrumentedModule(name);
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  blockManager->unlinkSequences();
+  RangeSet<rword> previous = execBroker->getInstrumentedRange();
+  bool removed = execBroker->removeInstrumentedModule(name);
+  clearRemovedRanges(previous);
+  return removed;
 }
 
 bool Engine::removeInstrumentedModuleFromAddr(rword addr) {
-  return execBroker->removeInstrumentedModuleFromAddr(addr);
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  blockManager->unlinkSequences();
+  RangeSet<rword> previous = execBroker->getInstrumentedRange();
+  bool removed = execBroker->removeInstrumentedModuleFromAddr(addr);
+  clearRemovedRanges(previous);
+  return removed;
 }
 
 void Engine::removeAllInstrumentedRanges() {
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  blockManager->unlinkSequences();
+  RangeSet<rword> previous = execBroker->getInstrumentedRange();
   execBroker->removeAllInstrumentedRanges();
+  clearRemovedRanges(previous);
 }
 
-std::vector<Patch> Engine::patch(rword start) {
+void Engine::clearRemovedRanges(const RangeSet<rword> &previous) {
+  // The fast dispatch loop executes the cached sequences without checking the
+  // instrumented ranges. The code of the removed ranges must leave the cache
+  // to be executed through the execBroker.
+  RangeSet<rword> removed = previous;
+  removed.remove(execBroker->getInstrumentedRange());
+  if (not removed.getRanges().empty()) {
+    clearCache(removed);
+  }
+}
+
+std::vector<Patch> Engine::patch(rword start, const LLVMCPU &llvmcpu) const {
   std::vector<Patch> basicBlock;
-  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
   const llvm::ArrayRef<uint8_t> code((uint8_t *)start, (size_t)-1);
   bool basicBlockEnd = false;
   rword i = 0;
@@ -331,18 +500,21 @@ std::vector<Patch> Engine::patch(rword start) {
       basicBlockEnd = true;
     }
   }
+  basicBlock.front().basicBlockStart = true;
 
   return basicBlock;
 }
 
-void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd) {
-  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
+void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd,
+                        const LLVMCPU &llvmcpu) const {
   QBDI_DEBUG(
       "Instrumenting sequence [0x{:x}, 0x{:x}] in basic block [0x{:x}, 0x{:x}]",
       basicBlock.front().metadata.address,
       basicBlock[patchEnd - 1].metadata.address,
       basicBlock.front().metadata.address, basicBlock.back().metadata.address);
 
+  bool inlineEvents = useInlineEvents();
+
   for (size_t i = 0; i < patchEnd; i++) {
     Patch &patch = basicBlock[i];
     QBDI_DEBUG_BLOCK({
@@ -354,23 +526,266 @@ void Engine::instrument(std::vector<Patch> &basicBlock, size_t patchEnd) {
     // Instrument
     for (const auto &item : instrRules) {
       const InstrRule *rule = item.second.get();
+      // A disabled rule is only applied when its callback slots can be
+      // enabled later without instrumenting the code again
+      if (not rule->isEnabled() and not useCallbackSlot(rule)) {
+        continue;
+      }
       if (rule->tryInstrument(patch, llvmcpu)) {
         QBDI_DEBUG("Instrumentation rule {:x} applied", item.first);
+        patch.instrRules.push_back(item.first);
       }
     }
+    // The events are signaled before the first instruction of the basic block
+    // and after its last one
+    if (inlineEvents and i == 0) {
+      seqEntryRule->tryInstrument(patch, llvmcpu);
+    }
+    if (inlineEvents and i == basicBlock.size() - 1) {
+      seqExitRule->tryInstrument(patch, llvmcpu);
+    }
     patch.finalizeInstsPatch();
   }
 }
 
 void Engine::handleNewBasicBlock(rword pc) {
+  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
   // disassemble and patch new basic block
-  Patch::Vec basicBlock = patch(pc);
+  writeNewBasicBlock(patch(pc, llvmcpu), llvmcpu);
+}
+
+void Engine::recordInstrumentation(const std::vector<Patch> &basicBlock,
+                                   size_t patchEnd) {
+  // The consecutive instructions instrumented by a rule are added as one
+  // range
+  std::map<uint32_t, Range<rword>> current;
+  for (size_t i = 0; i < patchEnd; i++) {
+    const InstMetadata &metadata = basicBlock[i].metadata;
+    for (uint32_t id : basicBlock[i].instrRules) {
+      auto it = current.find(id);
+      if (it == current.end()) {
+        current.emplace(id,
+                        Range<rword>(metadata.address, metadata.endAddress()));
+      } else if (it->second.end() == metadata.address) {
+        it->second.setEnd(metadata.endAddress());
+      } else {
+        instrumentedRanges[id].add(it->second);
+        it->second = Range<rword>(metadata.address, metadata.endAddress());
+      }
+    }
+  }
+  for (const auto &item : current) {
+    instrumentedRanges[item.first].add(item.second);
+  }
+}
+
+void Engine::flushCommit() {
+  RangeSet<rword> flushed = blockManager->flushCommit();
+  if (flushed.getRanges().empty()) {
+    return;
+  }
+  for (auto it = instrumentedRanges.begin(); it != instrumentedRanges.end();) {
+    it->second.remove(flushed);
+    if (it->second.getRanges().empty()) {
+      it = instrumentedRanges.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::vector<RangeSet<rword>> Engine::getRuleRanges() const {
+  std::vector<RangeSet<rword>> ruleRanges;
+  for (const auto &r : instrRules) {
+    auto it = instrumentedRanges.find(r.first);
+    ruleRanges.push_back(it != instrumentedRanges.end() ? it->second
+                                                        : RangeSet<rword>());
+  }
+  return ruleRanges;
+}
+
+void Engine::setRuleRanges(const std::vector<RangeSet<rword>> &ruleRanges) {
+  for (size_t i = 0; i < instrRules.size() and i < ruleRanges.size(); i++) {
+    if (not ruleRanges[i].getRanges().empty()) {
+      instrumentedRanges[instrRules[i].first] = ruleRanges[i];
+    }
+  }
+}
+
+size_t Engine::writeNewBasicBlock(std::vector<Patch> &&basicBlock,
+                                  const LLVMCPU &llvmcpu) {
   // Reserve cache and get uncached instruction
   size_t patchEnd = blockManager->preWriteBasicBlock(basicBlock);
+  if (patchEnd == 0) {
+    return 0;
+  }
+  size_t codeSize = 0;
+  for (size_t i = 0; i < patchEnd; i++) {
+    codeSize += basicBlock[i].metadata.instSize;
+  }
   // instrument uncached instruction
-  instrument(basicBlock, patchEnd);
+  instrument(basicBlock, patchEnd, llvmcpu);
+  recordInstrumentation(basicBlock, patchEnd);
   // Write in the cache
   blockManager->writeBasicBlock(std::move(basicBlock), patchEnd);
+  return codeSize;
+}
+
+// Append the addresses where the execution may continue after a basic block
+// and which are known without executing it.
+static void getStaticSuccessors(const std::vector<Patch> &basicBlock,
+                                const LLVMCPU &llvmcpu,
+                                std::vector<rword> &successors) {
+  const InstMetadata &lastInst = basicBlock.back().metadata;
+  // The basic block ends before an invalid instruction
+  if (not lastInst.modifyPC) {
+    return;
+  }
+  const llvm::MCInstrDesc &desc =
+      llvmcpu.getMCII().get(lastInst.inst.getOpcode());
+  rword target;
+  if (getStaticTarget(lastInst.inst, lastInst.address, lastInst.instSize,
+                      target)) {
+    successors.push_back(target);
+    // The callee is expected to return after the call
+    if (desc.isCall()) {
+      successors.push_back(lastInst.endAddress());
+    }
+  } else if (getConditionalTarget(lastInst.inst, lastInst.address,
+                                  lastInst.instSize, target)) {
+    successors.push_back(target);
+    successors.push_back(lastInst.endAddress());
+  } else if (desc.isCall()) {
+    successors.push_back(lastInst.endAddress());
+  }
+}
+
+size_t Engine::precacheFrom(rword start, const Range<rword> &bounds,
+                            size_t *codeSize) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot precache on a running Engine",
+                      abort());
+  if (blockManager->isFlushPending()) {
+    // Commit the flush
+    flushCommit();
+  }
+  commitPrecache();
+
+  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
+  size_t nbBlocks = 0;
+  size_t totalSize = 0;
+  AddressMap<bool> visited;
+  std::vector<rword> worklist = {start};
+
+  running = true;
+  while (not worklist.empty()) {
+    rword pc = worklist.back();
+    worklist.pop_back();
+    if (not bounds.contains(pc) or not execBroker->isInstrumented(pc) or
+        visited.count(pc) != 0) {
+      continue;
+    }
+    visited[pc] = true;
+    // The basic blocks already in the cache are patched again to find their
+    // successors, but aren't written.
+    Patch::Vec basicBlock = patch(pc, llvmcpu);
+    getStaticSuccessors(basicBlock, llvmcpu, worklist);
+    size_t size = writeNewBasicBlock(std::move(basicBlock), llvmcpu);
+    if (size != 0) {
+      nbBlocks++;
+      totalSize += size;
+    }
+  }
+  running = false;
+
+  QBDI_DEBUG("Precache {} basic block(s) ({} bytes) from 0x{:x}", nbBlocks,
+             totalSize, start);
+  if (codeSize != nullptr) {
+    *codeSize = totalSize;
+  }
+  return nbBlocks;
+}
+
+size_t Engine::precacheRange(rword start, rword end, size_t *codeSize) {
+  return precacheFrom(start, Range<rword>(start, end), codeSize);
+}
+
+size_t Engine::precacheFunction(rword addr, size_t *codeSize) {
+  return precacheFrom(addr, Range<rword>(0, static_cast<rword>(-1)),
+                      codeSize);
+}
+
+size_t Engine::commitPrecache() {
+  if (precacheWorker == nullptr) {
+    return 0;
+  }
+  size_t written = 0;
+  for (Patch::Vec &basicBlock : precacheWorker->takeResults()) {
+    rword address = basicBlock.front().metadata.address;
+    // The instrumented ranges and the cache may have changed since the
+    // address was queued.
+    if (not execBroker->isInstrumented(address) or
+        blockManager->getExecBlock(address) != nullptr) {
+      continue;
+    }
+    // The worker has instrumented the whole basic block, the instructions
+    // already in the cache are dropped.
+    size_t patchEnd = blockManager->preWriteBasicBlock(basicBlock);
+    if (patchEnd == 0) {
+      continue;
+    }
+    QBDI_DEBUG("Commit precached basic block at address 0x{:x}", address);
+    recordInstrumentation(basicBlock, patchEnd);
+    blockManager->writeBasicBlock(std::move(basicBlock), patchEnd);
+    written++;
+  }
+  return written;
+}
+
+bool Engine::writeTrace() {
+  const LLVMCPU &llvmcpu = llvmCPUs->getCPU(curCPUMode);
+  Patch::Vec trace;
+  size_t nbBlocks = 0;
+
+  for (rword pc : tracePath) {
+    // The path must follow the exit of the previous basic block. The
+    // sequences linked together don't return to the VM and aren't recorded.
+    if (not trace.empty()) {
+      const InstMetadata &lastInst = trace.back().metadata;
+      rword target;
+      bool follow;
+      if (not lastInst.modifyPC) {
+        follow = (pc == lastInst.endAddress());
+      } else if (getStaticTarget(lastInst.inst, lastInst.address,
+                                 lastInst.instSize, target)) {
+        follow = (pc == target);
+      } else if (getConditionalTarget(lastInst.inst, lastInst.address,
+                                      lastInst.instSize, target)) {
+        follow = (pc == target or pc == lastInst.endAddress());
+      } else {
+        follow = true;
+      }
+      if (not follow) {
+        QBDI_DEBUG("Trace 0x{:x} truncated before 0x{:x}", tracePath.front(),
+                   pc);
+        break;
+      }
+    }
+    if (not execBroker->isInstrumented(pc)) {
+      break;
+    }
+    Patch::Vec basicBlock = patch(pc, llvmcpu);
+    instrument(basicBlock, basicBlock.size(), llvmcpu);
+    std::move(basicBlock.begin(), basicBlock.end(), std::back_inserter(trace));
+    nbBlocks++;
+  }
+  // A trace of one basic block is the same as its sequence
+  if (nbBlocks < 2) {
+    return false;
+  }
+  QBDI_DEBUG("Write trace 0x{:x} of {} basic blocks", tracePath.front(),
+             nbBlocks);
+  recordInstrumentation(trace, trace.size());
+  return blockManager->writeTrace(std::move(trace));
 }
 
 bool Engine::precacheBasicBlock(rword pc) {
@@ -378,8 +793,9 @@ bool Engine::precacheBasicBlock(rword pc) {
       not running && "Cannot precacheBasicBlock on a running Engine", abort());
   if (blockManager->isFlushPending()) {
     // Commit the flush
-    blockManager->flushCommit();
+    flushCommit();
   }
+  commitPrecache();
   if (blockManager->getExecBlock(pc) != nullptr) {
     // already in cache
     return false;
@@ -390,45 +806,214 @@ bool Engine::precacheBasicBlock(rword pc) {
   return true;
 }
 
+void Engine::precacheAsync(const std::vector<rword> &pcs) {
+  std::vector<rword> addresses;
+  for (rword pc : pcs) {
+    if (execBroker->isInstrumented(pc) and
+        blockManager->getExecBlock(pc) == nullptr) {
+      addresses.push_back(pc);
+    }
+  }
+  if (addresses.empty()) {
+    return;
+  }
+  if (precacheWorker == nullptr) {
+    // The worker uses its own LLVM objects, which aren't thread-safe
+    precacheCPUs = std::make_unique<LLVMCPUs>(
+        llvmCPUs->getCPU(), llvmCPUs->getMattrs(), options);
+    precacheWorker =
+        std::make_unique<PrecacheWorker>([this](rword pc, CPUMode mode) {
+          const LLVMCPU &llvmcpu = precacheCPUs->getCPU(mode);
+          Patch::Vec basicBlock = patch(pc, llvmcpu);
+          instrument(basicBlock, basicBlock.size(), llvmcpu);
+          return basicBlock;
+        });
+  }
+  QBDI_DEBUG("Queue {} basic block(s) to precache", addresses.size());
+  precacheWorker->push(addresses, curCPUMode);
+}
+
+size_t Engine::waitPrecache() {
+  QBDI_REQUIRE_ACTION(not running && "Cannot waitPrecache on a running Engine",
+                      abort());
+  if (precacheWorker == nullptr) {
+    return 0;
+  }
+  precacheWorker->wait();
+  if (blockManager->isFlushPending()) {
+    // Commit the flush
+    flushCommit();
+  }
+  return commitPrecache();
+}
+
 bool Engine::run(rword start, rword stop) {
   QBDI_REQUIRE_ACTION(not running && "Cannot run an already running Engine",
                       abort());
 
-  rword currentPC = start;
-  bool hasRan = false;
+  RunState state{start, stop, false, 0, 0, nullptr, 0};
   curGPRState = gprState.get();
   curFPRState = fprState.get();
+  curContext = nullptr;
+  inlineBasicBlockBegin = 0;
 
-  rword basicBlockBeginAddr = 0;
-  rword basicBlockEndAddr = 0;
+  tracePath.clear();
+
+  // Clear the code modified since the last run of this engine
+  if (sharedCache != nullptr) {
+    applySharedInvalidations();
+  }
 
   // Start address is out of range
   if (!execBroker->isInstrumented(start)) {
     return false;
   }
 
+  // The links, the inline caches and the return slots written by the
+  // previous runs may jump to the sequence of the new stop address without
+  // returning to the VM
+  if (stop != linkedStop) {
+    if ((options & Options::OPT_ENABLE_BLOCK_CHAINING) and
+        blockManager->getSeqLoc(stop) != nullptr) {
+      blockManager->unlinkSequences();
+    }
+    linkedStop = stop;
+  }
+
   running = true;
 
+  while (not(this->*currentRunLoop)(state)) {
+    QBDI_DEBUG("VM events changed at 0x{:x}, switch the dispatch loop",
+               state.currentPC);
+  }
+
+  // Deliver the remaining records of the batch callbacks
+  flushBatchRecords(true);
+
+  if (sharedCache != nullptr) {
+    publishSharedRegions();
+  }
+
+  // Copy final context
+  syncFPRState();
+  *gprState = *curGPRState;
+  *fprState = *curFPRState;
+  curGPRState = gprState.get();
+  curFPRState = fprState.get();
+  curContext = nullptr;
+  curExecBlock = nullptr;
+  running = false;
+
+  return state.hasRan;
+}
+
+template <uint32_t Events>
+bool Engine::runLoop(RunState &state) {
+  constexpr bool sequenceEvents = (Events & RUN_SEQUENCE_EVENTS) != 0;
+  constexpr bool newEvents = (Events & RUN_NEW_EVENTS) != 0;
+  constexpr bool transferEvents = (Events & RUN_TRANSFER_EVENTS) != 0;
+
+  rword &currentPC = state.currentPC;
+  const rword stop = state.stop;
+  bool &hasRan = state.hasRan;
+  rword &basicBlockBeginAddr = state.basicBlockBeginAddr;
+  rword &basicBlockEndAddr = state.basicBlockEndAddr;
+  ExecBlock *&prevExecBlock = state.prevExecBlock;
+  uint16_t &prevSeqID = state.prevSeqID;
+
   // Execute basic block per basic block
   do {
+    // A callback has registered new VM events, the run continues with the
+    // instantiation that signals them
+    if (getRunEvents(eventMask, options) != Events) {
+      return false;
+    }
     VMAction action = CONTINUE;
 
+    if constexpr (Events == 0) {
+      // Fast dispatch loop. Without VMEvent callbacks, the sequences already
+      // in the cache are executed with only the work needed to find the next
+      // one. The complete loop below handles the cache misses, the
+      // transfers, the flushes and the traces.
+      bool fastDispatch = false;
+      while (getRunEvents(eventMask, options) == 0 and
+             (options & Options::OPT_ENABLE_TRACES) == 0 and
+             not blockManager->isFlushPending()) {
+        SeqLoc currentSequence;
+        ExecBlock *execBlock =
+            blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+        // The sequences of the removed ranges are cleared from the cache
+        // (clearRemovedRanges), a cached sequence is in the instrumented range
+        if (execBlock == nullptr) {
+          break;
+        }
+        // The sequence of the stop address is only executed as the start of
+        // the run, and must not be linked. The sequences aren't linked while
+        // the batch records must be flushed after each sequence: the
+        // translated code doesn't check if the BatchBuffer is full, and a
+        // loop of linked sequences would overwrite the pending records.
+        if ((options & Options::OPT_ENABLE_BLOCK_CHAINING) and
+            currentPC != stop and batchRules.empty()) {
+          execBlock->linkSequence(currentSequence.seqID);
+          if (execBlock == prevExecBlock) {
+            execBlock->linkIndirect(prevSeqID, currentSequence.seqID);
+          } else if (options & Options::OPT_ENABLE_SHADOW_STACK) {
+            execBlock->popReturnStack(currentPC);
+          }
+        }
+        curExecBlock = execBlock;
+        switchContext(execBlock);
+        fastDispatch = true;
+        hasRan = true;
+        action = execBlock->execute();
+        flushBatchRecords(false);
+        if (action != CONTINUE) {
+          prevExecBlock = nullptr;
+          break;
+        }
+        prevExecBlock = execBlock;
+        prevSeqID = execBlock->getCurrentSeqID();
+        currentPC = QBDI_GPR_GET(curGPRState, REG_PC);
+        if (currentPC == stop) {
+          break;
+        }
+      }
+      if (fastDispatch) {
+        // The events are signaled from the next sequence
+        basicBlockBeginAddr = 0;
+        basicBlockEndAddr = 0;
+        currentPC = QBDI_GPR_GET(curGPRState, REG_PC);
+        if (action == STOP or currentPC == stop) {
+          QBDI_DEBUG("Fast dispatch loop ended at 0x{:x}", currentPC);
+          break;
+        }
+        action = CONTINUE;
+      }
+    }
+
     // If this PC is not instrumented try to transfer execution
     if (execBroker->isInstrumented(currentPC) == false &&
         execBroker->canTransferExecution(curGPRState)) {
 
+      syncFPRState();
       curExecBlock = nullptr;
+      prevExecBlock = nullptr;
       basicBlockBeginAddr = 0;
       basicBlockEndAddr = 0;
+      tracePath.clear();
 
       QBDI_DEBUG("Executing 0x{:x} through execBroker", currentPC);
-      action = signalEvent(EXEC_TRANSFER_CALL, currentPC, nullptr, 0,
-                           curGPRState, curFPRState);
+      if constexpr (transferEvents) {
+        action = signalEvent(EXEC_TRANSFER_CALL, currentPC, nullptr, 0,
+                             curGPRState, curFPRState);
+      }
       // transfer execution
       if (action == CONTINUE) {
         execBroker->transferExecution(currentPC, curGPRState, curFPRState);
-        action = signalEvent(EXEC_TRANSFER_RETURN, currentPC, nullptr, 0,
-                             curGPRState, curFPRState);
+        if constexpr (transferEvents) {
+          action = signalEvent(EXEC_TRANSFER_RETURN, currentPC, nullptr, 0,
+                               curGPRState, curFPRState);
+        }
       }
     }
     // Else execute through DBI
@@ -439,18 +1024,33 @@ bool Engine::run(rword start, rword stop) {
       // Is cache flush pending?
       if (blockManager->isFlushPending()) {
         // Backup fprState and gprState
+        syncFPRState();
         *gprState = *curGPRState;
         *fprState = *curFPRState;
         curGPRState = gprState.get();
         curFPRState = fprState.get();
+        curContext = nullptr;
         // Commit the flush
-        blockManager->flushCommit();
+        flushCommit();
+        prevExecBlock = nullptr;
+        tracePath.clear();
       }
 
       // Test if we have it in cache
       SeqLoc currentSequence;
       curExecBlock =
           blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+      // The basic block may have been translated by the precache worker
+      if (curExecBlock == nullptr and commitPrecache() != 0) {
+        curExecBlock =
+            blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+      }
+      // or by another engine of the shared cache
+      if (curExecBlock == nullptr and sharedCache != nullptr and
+          loadSharedRegion(currentPC)) {
+        curExecBlock =
+            blockManager->getProgrammedExecBlock(currentPC, &currentSequence);
+      }
       if (curExecBlock == nullptr) {
         QBDI_DEBUG(
             "Cache miss for 0x{:x}, patching & instrumenting new basic block",
@@ -464,36 +1064,95 @@ bool Engine::run(rword start, rword stop) {
         QBDI_REQUIRE_ACTION(curExecBlock != nullptr, abort());
       }
 
-      if (basicBlockEndAddr == 0) {
-        event |= BASIC_BLOCK_ENTRY;
-        basicBlockEndAddr = currentSequence.bbEnd;
-        basicBlockBeginAddr = currentPC;
+      // Record the sequences executed from a hot sequence until the execution
+      // comes back to it, and write them as a trace
+      if ((options & Options::OPT_ENABLE_TRACES) and not sequenceEvents) {
+        uint32_t count = curExecBlock->countSequence(currentSequence.seqID);
+        if (not tracePath.empty() and currentPC != traceSeqEnd) {
+          // The path ends on its head, on the head of another trace or when
+          // it's too long
+          if (currentPC == tracePath.front() or count == 0 or
+              tracePath.size() >= TRACE_MAX_SEQUENCES) {
+            if (writeTrace()) {
+              curExecBlock = blockManager->getProgrammedExecBlock(
+                  currentPC, &currentSequence);
+              QBDI_REQUIRE_ACTION(curExecBlock != nullptr, abort());
+            }
+            tracePath.clear();
+          } else {
+            tracePath.push_back(currentPC);
+          }
+        } else if (tracePath.empty() and count >= TRACE_THRESHOLD) {
+          QBDI_DEBUG("Record a trace from hot sequence 0x{:x}", currentPC);
+          // A sequence is the head of one recording only
+          curExecBlock->disableCounter(currentSequence.seqID);
+          tracePath.push_back(currentPC);
+        }
+        if (currentSequence.seqEnd != currentSequence.bbEnd) {
+          traceSeqEnd = currentSequence.seqEnd;
+        } else {
+          traceSeqEnd = 0;
+        }
       }
 
-      // Set context if necessary
-      if (&(curExecBlock->getContext()->gprState) != curGPRState ||
-          &(curExecBlock->getContext()->fprState) != curFPRState) {
-        curExecBlock->getContext()->gprState = *curGPRState;
-        curExecBlock->getContext()->fprState = *curFPRState;
+      // Link the sequences that exit to the current one
+      if ((options & Options::OPT_ENABLE_BLOCK_CHAINING) and
+          not sequenceEvents and currentPC != stop and batchRules.empty()) {
+        curExecBlock->linkSequence(currentSequence.seqID);
+        if (curExecBlock == prevExecBlock) {
+          curExecBlock->linkIndirect(prevSeqID, currentSequence.seqID);
+        }
       }
-      curGPRState = &(curExecBlock->getContext()->gprState);
-      curFPRState = &(curExecBlock->getContext()->fprState);
+      // A call of this ExecBlock may have returned through another ExecBlock
+      // or the execBroker
+      if ((options & Options::OPT_ENABLE_BLOCK_CHAINING) and
+          (options & Options::OPT_ENABLE_SHADOW_STACK) and
+          curExecBlock != prevExecBlock) {
+        curExecBlock->popReturnStack(currentPC);
+      }
+      prevExecBlock = nullptr;
 
-      action = signalEvent(event, currentPC, &currentSequence,
-                           basicBlockBeginAddr, curGPRState, curFPRState);
+      if constexpr (Events != 0) {
+        if (basicBlockEndAddr == 0) {
+          event |= BASIC_BLOCK_ENTRY;
+          basicBlockEndAddr = currentSequence.bbEnd;
+          basicBlockBeginAddr = currentPC;
+        }
+      }
+
+      switchContext(curExecBlock);
+
+      if constexpr (sequenceEvents) {
+        action = signalEvent(event, currentPC, &currentSequence,
+                             basicBlockBeginAddr, curGPRState, curFPRState);
+      } else if constexpr (newEvents) {
+        if (event & BASIC_BLOCK_NEW) {
+          // The other events are signaled by the callback sites
+          if (options & Options::OPT_INLINE_VM_EVENTS) {
+            event = BASIC_BLOCK_NEW;
+          }
+          action = signalEvent(event, currentPC, &currentSequence,
+                               basicBlockBeginAddr, curGPRState, curFPRState);
+        }
+      }
 
       if (action == CONTINUE) {
         hasRan = true;
         action = curExecBlock->execute();
+        flushBatchRecords(false);
         // Signal events if normal exit
         if (action == CONTINUE) {
+          prevExecBlock = curExecBlock;
+          prevSeqID = curExecBlock->getCurrentSeqID();
           if (basicBlockEndAddr == currentSequence.seqEnd) {
-            action = signalEvent(SEQUENCE_EXIT | BASIC_BLOCK_EXIT, currentPC,
-                                 &currentSequence, basicBlockBeginAddr,
-                                 curGPRState, curFPRState);
+            if constexpr (sequenceEvents) {
+              action = signalEvent(SEQUENCE_EXIT | BASIC_BLOCK_EXIT, currentPC,
+                                   &currentSequence, basicBlockBeginAddr,
+                                   curGPRState, curFPRState);
+            }
             basicBlockBeginAddr = 0;
             basicBlockEndAddr = 0;
-          } else {
+          } else if constexpr (sequenceEvents) {
             action = signalEvent(SEQUENCE_EXIT, currentPC, &currentSequence,
                                  basicBlockBeginAddr, curGPRState, curFPRState);
           }
@@ -505,31 +1164,64 @@ bool Engine::run(rword start, rword stop) {
       break;
     }
     if (action != CONTINUE) {
+      prevExecBlock = nullptr;
       basicBlockBeginAddr = 0;
       basicBlockEndAddr = 0;
+      tracePath.clear();
     }
     // Get next block PC
     currentPC = QBDI_GPR_GET(curGPRState, REG_PC);
     QBDI_DEBUG("Next address to execute is 0x{:x}", currentPC);
   } while (currentPC != stop);
 
-  // Copy final context
-  *gprState = *curGPRState;
-  *fprState = *curFPRState;
-  curGPRState = gprState.get();
-  curFPRState = fprState.get();
-  curExecBlock = nullptr;
-  running = false;
+  return true;
+}
 
-  return hasRan;
+void Engine::selectRunLoop() {
+  switch (getRunEvents(eventMask, options)) {
+    case 0:
+      currentRunLoop = &Engine::runLoop<0>;
+      break;
+    case RUN_SEQUENCE_EVENTS:
+      currentRunLoop = &Engine::runLoop<RUN_SEQUENCE_EVENTS>;
+      break;
+    case RUN_NEW_EVENTS:
+      currentRunLoop = &Engine::runLoop<RUN_NEW_EVENTS>;
+      break;
+    case RUN_TRANSFER_EVENTS:
+      currentRunLoop = &Engine::runLoop<RUN_TRANSFER_EVENTS>;
+      break;
+    case RUN_SEQUENCE_EVENTS | RUN_NEW_EVENTS:
+      currentRunLoop =
+          &Engine::runLoop<RUN_SEQUENCE_EVENTS | RUN_NEW_EVENTS>;
+      break;
+    case RUN_SEQUENCE_EVENTS | RUN_TRANSFER_EVENTS:
+      currentRunLoop =
+          &Engine::runLoop<RUN_SEQUENCE_EVENTS | RUN_TRANSFER_EVENTS>;
+      break;
+    case RUN_NEW_EVENTS | RUN_TRANSFER_EVENTS:
+      currentRunLoop = &Engine::runLoop<RUN_NEW_EVENTS | RUN_TRANSFER_EVENTS>;
+      break;
+    default:
+      currentRunLoop = &Engine::runLoop<RUN_SEQUENCE_EVENTS | RUN_NEW_EVENTS |
+                                        RUN_TRANSFER_EVENTS>;
+      break;
+  }
 }
 
 uint32_t Engine::addInstrRule(std::unique_ptr<InstrRule> &&rule) {
   uint32_t id = instrRulesCounter++;
   QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
 
+  PrecacheWorker::Pause pause(precacheWorker.get());
   this->clearCache(rule->affectedRange());
 
+  if (rule->hasBatchRecords()) {
+    // A linked loop would fill the buffer without returning to the engine
+    blockManager->unlinkSequences();
+    batchRules.push_back(id);
+  }
+
   auto v = std::make_pair(id, std::move(rule));
 
   // insert rule in instrRules and keep the priority order
@@ -557,11 +1249,40 @@ InstrRule *Engine::getInstrRule(uint32_t id) {
   }
 }
 
+void Engine::flushBatchRecords(bool force) {
+  // The callbacks may add or delete rules, the ids are accessed by index and
+  // the rules are searched again.
+  for (size_t i = 0; i < batchRules.size(); i++) {
+    InstrRule *rule = getInstrRule(batchRules[i]);
+    if (rule != nullptr) {
+      rule->flushRecords(force);
+    }
+  }
+}
+
 uint32_t Engine::addVMEventCB(VMEvent mask, VMCallback cbk, void *data) {
   uint32_t id = vmCallbacksCounter++;
   QBDI_REQUIRE_ACTION(id < EVENTID_VM_MASK, return VMError::INVALID_EVENTID);
+  // The worker reads the eventMask to add the callback sites of the VMEvent.
+  // It translates with the new mask once the pause ends.
+  PrecacheWorker::Pause pause(precacheWorker.get());
   vmCallbacks.emplace_back(id, CallbackRegistration{mask, cbk, data});
+  if ((eventMask & SEQUENCE_EVENT_MASK) == 0 and
+      (mask & SEQUENCE_EVENT_MASK) != 0) {
+    if (options & Options::OPT_INLINE_VM_EVENTS) {
+      // the cached sequences don't have the callback sites
+      eventMask |= mask;
+      clearAllCache();
+    } else if (options & Options::OPT_ENABLE_TRACES) {
+      // the traces contain several basic blocks
+      clearAllCache();
+    } else {
+      // the sequences must return to the VM to signal the event
+      blockManager->unlinkSequences();
+    }
+  }
   eventMask |= mask;
+  selectRunLoop();
   return id | EVENTID_VM_MASK;
 }
 
@@ -595,6 +1316,7 @@ VMAction Engine::signalEvent(VMEvent event, rword currentPC,
     vmState.sequenceEnd = seqLoc->seqEnd;
   }
 
+  syncFPRState();
   VMAction action = CONTINUE;
   for (const auto &item : vmCallbacks) {
     const QBDI::CallbackRegistration &r = item.second;
@@ -609,6 +1331,68 @@ VMAction Engine::signalEvent(VMEvent event, rword currentPC,
   return action;
 }
 
+bool Engine::useInlineEvents() const {
+  return (options & Options::OPT_INLINE_VM_EVENTS) and
+         (eventMask & SEQUENCE_EVENT_MASK);
+}
+
+// The VMAction of the VMEvent callbacks are applied to the sequence, not to
+// the instruction of the callback site
+static inline VMAction siteAction(VMAction action) {
+  if (action == SKIP_INST or action == SKIP_PATCH) {
+    return CONTINUE;
+  }
+  return action;
+}
+
+VMAction Engine::sequenceEntryCB(VMInstanceRef vm, GPRState *gprState,
+                                 FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  const ExecBlock *execBlock = engine->curExecBlock;
+  QBDI_REQUIRE_ACTION(execBlock != nullptr, return CONTINUE);
+
+  rword address = execBlock->getInstAddress(execBlock->getCurrentInstID());
+  SeqLoc seqLoc;
+  const SeqLoc *cached = engine->blockManager->getSeqLoc(address);
+  if (cached != nullptr) {
+    seqLoc = *cached;
+  } else {
+    uint16_t seqID = execBlock->getCurrentSeqID();
+    rword end =
+        execBlock->getInstMetadata(execBlock->getSeqEnd(seqID)).endAddress();
+    seqLoc = SeqLoc{0, seqID, end, address, end};
+  }
+  engine->inlineBasicBlockBegin = address;
+
+  return siteAction(
+      engine->signalEvent(SEQUENCE_ENTRY | BASIC_BLOCK_ENTRY, address,
+                          &seqLoc, address, gprState, fprState));
+}
+
+VMAction Engine::sequenceExitCB(VMInstanceRef vm, GPRState *gprState,
+                                FPRState *fprState, void *data) {
+  Engine *engine = static_cast<Engine *>(data);
+  const ExecBlock *execBlock = engine->curExecBlock;
+  QBDI_REQUIRE_ACTION(execBlock != nullptr, return CONTINUE);
+
+  uint16_t instID = execBlock->getCurrentInstID();
+  uint16_t seqID = execBlock->getCurrentSeqID();
+  rword address = execBlock->getInstAddress(instID);
+  rword end = execBlock->getInstMetadata(instID).endAddress();
+  // The basic block may have been entered in the middle, without its entry
+  // site
+  rword begin = engine->inlineBasicBlockBegin;
+  if (begin == 0 or begin > address) {
+    begin = execBlock->getInstAddress(execBlock->getSeqStart(seqID));
+  }
+  engine->inlineBasicBlockBegin = 0;
+  SeqLoc seqLoc{0, seqID, end, begin, end};
+
+  return siteAction(
+      engine->signalEvent(SEQUENCE_EXIT | BASIC_BLOCK_EXIT, begin, &seqLoc,
+                          begin, gprState, fprState));
+}
+
 const InstAnalysis *Engine::getInstAnalysis(rword address,
                                             AnalysisType type) const {
   const ExecBlock *block = blockManager->getExecBlock(address);
@@ -626,15 +1410,37 @@ bool Engine::deleteInstrumentation(uint32_t id) {
     id &= ~EVENTID_VM_MASK;
     for (size_t i = 0; i < vmCallbacks.size(); i++) {
       if (vmCallbacks[i].first == id) {
+        // The worker reads the eventMask to add the callback sites of the
+        // VMEvent.
+        PrecacheWorker::Pause pause(precacheWorker.get());
+        bool inlineEvents = useInlineEvents();
         vmCallbacks.erase(vmCallbacks.begin() + i);
+        eventMask = VMEvent::NO_EVENT;
+        for (const auto &item : vmCallbacks) {
+          eventMask |= item.second.mask;
+        }
+        if (inlineEvents and not useInlineEvents()) {
+          // remove the callback sites of the VMEvent
+          clearAllCache();
+        }
+        selectRunLoop();
         return true;
       }
     }
   } else {
+    PrecacheWorker::Pause pause(precacheWorker.get());
     for (size_t i = 0; i < instrRules.size(); i++) {
       if (instrRules[i].first == id) {
-        this->clearCache(instrRules[i].second->affectedRange());
+        // Only the instructions instrumented by the rule are cleared
+        auto it = instrumentedRanges.find(id);
+        if (it != instrumentedRanges.end()) {
+          this->clearCache(it->second);
+          instrumentedRanges.erase(it);
+        }
         instrRules.erase(instrRules.begin() + i);
+        batchRules.erase(
+            std::remove(batchRules.begin(), batchRules.end(), id),
+            batchRules.end());
         return true;
       }
     }
@@ -643,30 +1449,253 @@ bool Engine::deleteInstrumentation(uint32_t id) {
 }
 
 void Engine::deleteAllInstrumentations() {
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  // remove the callback sites of the VMEvent
+  if (useInlineEvents()) {
+    clearAllCache();
+  }
   // clear cache
-  for (const auto &r : instrRules) {
-    this->clearCache(r.second->affectedRange());
+  for (const auto &r : instrumentedRanges) {
+    this->clearCache(r.second);
   }
+  instrumentedRanges.clear();
   instrRules.clear();
+  batchRules.clear();
   vmCallbacks.clear();
   instrRulesCounter = 0;
   vmCallbacksCounter = 0;
   eventMask = VMEvent::NO_EVENT;
+  selectRunLoop();
+}
+
+bool Engine::useCallbackSlot(const InstrRule *rule) const {
+  return (options & Options::OPT_ENABLE_CALLBACK_SLOTS) and
+         rule->hasCallbackSlot();
+}
+
+bool Engine::setCallbackEnabled(uint32_t id, bool enabled) {
+  InstrRule *rule = getInstrRule(id);
+  if (rule == nullptr) {
+    return false;
+  }
+  if (rule->isEnabled() == enabled) {
+    return true;
+  }
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  rule->setEnabled(enabled);
+  if (useCallbackSlot(rule)) {
+    blockManager->setCallbackEnabled(id, enabled);
+  } else if (enabled) {
+    this->clearCache(rule->affectedRange());
+  } else {
+    auto it = instrumentedRanges.find(id);
+    if (it != instrumentedRanges.end()) {
+      this->clearCache(it->second);
+      instrumentedRanges.erase(it);
+    }
+  }
+  return true;
+}
+
+bool Engine::setInstrumentationData(uint32_t id, void *data) {
+  InstrRule *rule = getInstrRule(id);
+  if (rule == nullptr) {
+    return false;
+  }
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  if (not rule->changeDataPtr(data)) {
+    return false;
+  }
+  if (useCallbackSlot(rule)) {
+    blockManager->setCallbackData(id, reinterpret_cast<rword>(data));
+  } else {
+    this->clearCache(rule->affectedRange());
+  }
+  return true;
+}
+
+void Engine::setCacheBudget(rword budget) {
+  blockManager->setCacheBudget(budget);
+}
+
+void Engine::clearAllCache() {
+  PrecacheWorker::Pause pause(precacheWorker.get());
+  blockManager->clearCache(not running);
+  instrumentedRanges.clear();
+}
+
+// Magic number of a translation cache file
+static const char TRANSLATION_CACHE_MAGIC[8] = {'Q', 'B', 'D', 'I',
+                                                'T', 'C', '0', '5'};
+
+bool Engine::getTranslationCacheKey(uint64_t &key, AddressTable *table) const {
+  const bool persistent = table != nullptr;
+  Fingerprint fp(table);
+  if (persistent) {
+    fp.add(static_cast<uint32_t>(QBDI_VERSION));
+  }
+  fp.add(options);
+  // the callback sites of the VMEvent contain the address of the engine
+  if (useInlineEvents()) {
+    return false;
+  }
+  if (persistent) {
+    // the prologue and the epilogue depend on the features of the CPU
+    fp.add(getHostCPUName());
+    for (const std::string &feature : getHostCPUFeatures()) {
+      fp.add(feature);
+    }
+  } else {
+    // the engines of a process run on the same CPU, but may decode the
+    // instructions with other features
+    fp.add(llvmCPUs->getCPU());
+    for (const std::string &mattr : llvmCPUs->getMattrs()) {
+      fp.add(mattr);
+    }
+  }
+  for (const auto &r : instrRules) {
+    if (not r.second->fingerprint(fp)) {
+      return false;
+    }
+    fp.add(r.second->isEnabled());
+  }
+  key = fp.get();
+  return true;
+}
+
+bool Engine::saveTranslationCache(const std::string &path) const {
+  // On X86, the instrumented code uses the absolute address of the data block
+  if constexpr (not is_x86_64) {
+    QBDI_WARN("The translation cache isn't supported on this architecture");
+    return false;
+  }
+  uint64_t key;
+  AddressTable table;
+  if (not getTranslationCacheKey(key, &table)) {
+    QBDI_WARN("The translation cache cannot be used with an InstrRuleCallback");
+    return false;
+  }
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  if (not os) {
+    QBDI_WARN("Cannot open the translation cache {}", path);
+    return false;
+  }
+  os.write(TRANSLATION_CACHE_MAGIC, sizeof(TRANSLATION_CACHE_MAGIC));
+  writeValue(os, key);
+  blockManager->saveTranslationCache(os, table, getRuleRanges());
+  return os.good();
 }
 
-void Engine::clearAllCache() { blockManager->clearCache(not running); }
+bool Engine::loadTranslationCache(const std::string &path) {
+  QBDI_REQUIRE_ACTION(
+      not running && "Cannot loadTranslationCache on a running Engine",
+      abort());
+  if constexpr (not is_x86_64) {
+    QBDI_WARN("The translation cache isn't supported on this architecture");
+    return false;
+  }
+  uint64_t key, savedKey;
+  AddressTable table;
+  if (not getTranslationCacheKey(key, &table)) {
+    QBDI_WARN("The translation cache cannot be used with an InstrRuleCallback");
+    return false;
+  }
+  std::ifstream is(path, std::ios::binary);
+  char magic[sizeof(TRANSLATION_CACHE_MAGIC)];
+  if (not is.read(magic, sizeof(magic)) or
+      memcmp(magic, TRANSLATION_CACHE_MAGIC, sizeof(magic)) != 0 or
+      not readValue(is, savedKey)) {
+    QBDI_WARN("Invalid translation cache {}", path);
+    return false;
+  }
+  if (key != savedKey) {
+    QBDI_DEBUG("The translation cache {} was saved with another configuration",
+               path);
+    return false;
+  }
+  if (blockManager->isFlushPending()) {
+    flushCommit();
+  }
+  std::vector<RangeSet<rword>> ruleRanges = getRuleRanges();
+  size_t loaded = blockManager->loadTranslationCache(
+      is, table, execBroker->getInstrumentedRange(), ruleRanges);
+  setRuleRanges(ruleRanges);
+  QBDI_DEBUG("Load {} regions from the translation cache {}", loaded, path);
+  return true;
+}
 
 void Engine::clearCache(rword start, rword end) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   blockManager->clearCache(Range<rword>(start, end));
+  if (sharedCache != nullptr) {
+    RangeSet<rword> ranges;
+    ranges.add(Range<rword>(start, end));
+    sharedCache->invalidate(ranges);
+  }
   if (not running && blockManager->isFlushPending()) {
-    blockManager->flushCommit();
+    flushCommit();
+  }
+}
+
+bool Engine::shareCache(Engine &other) {
+  QBDI_REQUIRE_ACTION(not running && "Cannot shareCache on a running Engine",
+                      abort());
+  // On X86, the instrumented code uses the absolute address of the data block
+  if constexpr (not is_x86_64) {
+    QBDI_WARN("The shared cache isn't supported on this architecture");
+    return false;
+  }
+  if (other.sharedCache == nullptr) {
+    other.sharedCache = std::make_shared<SharedCache>();
+    other.sharedGeneration = other.sharedCache->getGeneration();
+  }
+  sharedCache = other.sharedCache;
+  sharedGeneration = sharedCache->getGeneration();
+  return true;
+}
+
+bool Engine::loadSharedRegion(rword address) {
+  uint64_t key;
+  if (not getTranslationCacheKey(key, nullptr)) {
+    return false;
+  }
+  std::vector<RangeSet<rword>> ruleRanges = getRuleRanges();
+  if (not blockManager->loadSharedRegion(*sharedCache, key, address,
+                                         execBroker->getInstrumentedRange(),
+                                         ruleRanges)) {
+    return false;
+  }
+  setRuleRanges(ruleRanges);
+  return true;
+}
+
+void Engine::publishSharedRegions() {
+  uint64_t key;
+  if (not getTranslationCacheKey(key, nullptr)) {
+    return;
+  }
+  size_t published =
+      blockManager->publishRegions(*sharedCache, key, getRuleRanges());
+  if (published != 0) {
+    QBDI_DEBUG("Publish {} regions in the shared cache", published);
+  }
+}
+
+void Engine::applySharedInvalidations() {
+  RangeSet<rword> ranges;
+  sharedGeneration = sharedCache->getInvalidations(sharedGeneration, ranges);
+  if (not ranges.getRanges().empty()) {
+    QBDI_DEBUG("Apply {} invalidations of the shared cache",
+               ranges.getRanges().size());
+    clearCache(ranges);
   }
 }
 
 void Engine::clearCache(RangeSet<rword> rangeSet) {
+  PrecacheWorker::Pause pause(precacheWorker.get());
   blockManager->clearCache(rangeSet);
   if (not running && blockManager->isFlushPending()) {
-    blockManager->flushCommit();
+    flushCommit();
   }
 }
 
@@ -19,6 +19,7 @@
 #define ENGINE_H
 
 #include <cstdlib>
+#include <map>
 #include <memory>
 #include <stdint.h>
 #include <string>
@@ -33,6 +34,8 @@
 
 namespace QBDI {
 
+class AddressTable;
+class LLVMCPU;
 class LLVMCPUs;
 class ExecBlock;
 class ExecBlockManager;
@@ -40,6 +43,9 @@ class ExecBroker;
 class PatchRule;
 class InstrRule;
 class Patch;
+class PrecacheWorker;
+class SharedCache;
+struct Context;
 struct SeqLoc;
 
 struct CallbackRegistration {
@@ -50,6 +56,9 @@ struct CallbackRegistration {
 
 class Engine {
 private:
+  struct RunState;
+  using RunLoop = bool (Engine::*)(RunState &state);
+
   VMInstanceRef vminstance;
 
   std::unique_ptr<LLVMCPUs> llvmCPUs;
@@ -58,30 +67,107 @@ private:
   std::vector<PatchRule> patchRules;
   std::vector<std::pair<uint32_t, std::unique_ptr<InstrRule>>> instrRules;
   uint32_t instrRulesCounter;
+  // Ids of the rules which buffer records for a batch callback
+  std::vector<uint32_t> batchRules;
+  // Ranges of the instructions in the cache instrumented by each rule, cleared
+  // when the rule is deleted
+  std::map<uint32_t, RangeSet<rword>> instrumentedRanges;
   std::vector<std::pair<uint32_t, CallbackRegistration>> vmCallbacks;
   uint32_t vmCallbacksCounter;
   std::unique_ptr<GPRState> gprState;
   std::unique_ptr<FPRState> fprState;
   GPRState *curGPRState;
   FPRState *curFPRState;
+  // Context of curFPRState when it belongs to an ExecBlock
+  Context *curContext;
   ExecBlock *curExecBlock;
   CPUMode curCPUMode;
   Options options;
   VMEvent eventMask;
   bool running;
-
-  std::vector<Patch> patch(rword start);
+  // Dispatch loop of run, instantiated for the VM events registered
+  RunLoop currentRunLoop;
+  // Background translation, created by the first call of precacheAsync
+  std::unique_ptr<LLVMCPUs> precacheCPUs;
+  std::unique_ptr<PrecacheWorker> precacheWorker;
+  // Start addresses of the sequences executed since the head of the trace
+  // being recorded (OPT_ENABLE_TRACES)
+  std::vector<rword> tracePath;
+  // End of the last recorded sequence when its basic block continues in
+  // another sequence
+  rword traceSeqEnd;
+  // Rules of the callback sites of the VMEvent on sequences and basic blocks
+  // (OPT_INLINE_VM_EVENTS)
+  std::unique_ptr<InstrRule> seqEntryRule;
+  std::unique_ptr<InstrRule> seqExitRule;
+  // Start of the basic block entered through its callback site
+  rword inlineBasicBlockBegin;
+  // Translation cache shared with other engines, and generation of its last
+  // invalidation applied to the cache of this engine
+  std::shared_ptr<SharedCache> sharedCache;
+  uint64_t sharedGeneration;
+  // Stop address of the last run. The sequences are never linked to the
+  // sequence of the stop address of the run (OPT_ENABLE_BLOCK_CHAINING).
+  rword linkedStop;
+
+  std::vector<Patch> patch(rword start, const LLVMCPU &llvmcpu) const;
 
   void initGPRState();
   void initFPRState();
 
-  void instrument(std::vector<Patch> &basicBlock, size_t patchEnd);
+  void instrument(std::vector<Patch> &basicBlock, size_t patchEnd,
+                  const LLVMCPU &llvmcpu) const;
+
+  // With an address table, the key identifies the configuration between two
+  // processes (the addresses are located in the table). Without, it
+  // identifies the configuration between the engines of the process.
+  bool getTranslationCacheKey(uint64_t &key, AddressTable *table) const;
+  bool loadSharedRegion(rword address);
+  void publishSharedRegions();
+  void applySharedInvalidations();
+  // Clear the code of the ranges of previous that are no longer instrumented
+  void clearRemovedRanges(const RangeSet<rword> &previous);
+  // Commit the flush of the cache and remove the flushed code from the
+  // instrumentedRanges
+  void flushCommit();
+  // The instrumentedRanges of the rules, in the order of instrRules (the order
+  // of the rules in the translation cache key)
+  std::vector<RangeSet<rword>> getRuleRanges() const;
+  void setRuleRanges(const std::vector<RangeSet<rword>> &ruleRanges);
+  bool useCallbackSlot(const InstrRule *rule) const;
   void handleNewBasicBlock(rword pc);
+  void recordInstrumentation(const std::vector<Patch> &basicBlock,
+                             size_t patchEnd);
+  size_t writeNewBasicBlock(std::vector<Patch> &&basicBlock,
+                            const LLVMCPU &llvmcpu);
+  size_t precacheFrom(rword start, const Range<rword> &bounds,
+                      size_t *codeSize);
+  size_t commitPrecache();
+  bool writeTrace();
+
+  void flushBatchRecords(bool force);
+
+  void switchContext(ExecBlock *execBlock);
+
+  template <uint32_t Events>
+  bool runLoop(RunState &state);
+
+  void selectRunLoop();
+
+  void syncFPRState() const;
 
   VMAction signalEvent(VMEvent kind, rword currentPC, const SeqLoc *seqLoc,
                        rword basicBlockBegin, GPRState *gprState,
                        FPRState *fprState);
 
+  bool useInlineEvents() const;
+
+  // Callbacks of the sites written by seqEntryRule and seqExitRule
+  static VMAction sequenceEntryCB(VMInstanceRef vm, GPRState *gprState,
+                                  FPRState *fprState, void *data);
+  static VMAction sequenceExitCB(VMInstanceRef vm, GPRState *gprState,
+                                 FPRState *fprState, void *data);
+
 public:
   /*! Construct a new Engine for a given CPU with specific attributes
    *
@@ -253,6 +339,29 @@ public:
    */
   bool deleteInstrumentation(uint32_t id);
 
+  /*! Enable or disable an instrumentation. With OPT_ENABLE_CALLBACK_SLOTS,
+   * the callback slots of the instrumentation are updated in the cache.
+   * Otherwise, the code instrumented by the rule is cleared.
+   *
+   * @param[in] id       The id of the instrumentation.
+   * @param[in] enabled  Whether the instrumentation is enabled.
+   *
+   * @return True if the id is valid.
+   */
+  bool setCallbackEnabled(uint32_t id, bool enabled);
+
+  /*! Change the data pointer of an instrumentation. With
+   * OPT_ENABLE_CALLBACK_SLOTS, the callback slots of the instrumentation are
+   * updated in the cache. Otherwise, the code instrumented by the rule is
+   * cleared.
+   *
+   * @param[in] id    The id of the instrumentation.
+   * @param[in] data  The new data pointer.
+   *
+   * @return True if the id is valid and the data has been changed.
+   */
+  bool setInstrumentationData(uint32_t id, void *data);
+
   /*! Remove all the registered instrumentations.
    *
    */
@@ -278,6 +387,42 @@ public:
    */
   bool precacheBasicBlock(rword pc);
 
+  /*! Queue basic blocks to be translated by a background thread. The
+   * translated basic blocks are written in the cache when the execution
+   * reaches one of them, or by precacheBasicBlock and waitPrecache.
+   *
+   * @param[in] pcs  Start addresses of basic blocks
+   */
+  void precacheAsync(const std::vector<rword> &pcs);
+
+  /*! Pre-cache the basic blocks of a range reachable from its start address
+   * through direct jumps and calls.
+   *
+   * @param[in]  start     Start address of the range
+   * @param[in]  end       End address of the range (excluded)
+   * @param[out] codeSize  If not null, set to the size of the translated code
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheRange(rword start, rword end, size_t *codeSize = nullptr);
+
+  /*! Pre-cache the basic blocks of a function and of its callees reachable
+   * through direct jumps and calls, in the instrumented ranges.
+   *
+   * @param[in]  addr      Start address of the function
+   * @param[out] codeSize  If not null, set to the size of the translated code
+   *
+   * @return The number of basic blocks inserted in the cache.
+   */
+  size_t precacheFunction(rword addr, size_t *codeSize = nullptr);
+
+  /*! Wait for the basic blocks queued by precacheAsync and write them in the
+   * cache.
+   *
+   * @return The number of basic blocks written in the cache.
+   */
+  size_t waitPrecache();
+
   /*! Return an InstAnalysis for a cached instruction.
    * The pointer may be invalid by any noconst method call.
    *
@@ -306,6 +451,37 @@ public:
   /*! Clear the entire translation cache.
    */
   void clearAllCache();
+
+  /*! Set the maximal size of the translation cache. The least recently
+   * executed regions are evicted when the cache exceeds it.
+   *
+   * @param[in] budget  The size in bytes (0 to disable the limit).
+   */
+  void setCacheBudget(rword budget);
+
+  /*! Write the translation cache in a file.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return True if the file has been written.
+   */
+  bool saveTranslationCache(const std::string &path) const;
+
+  /*! Load a translation cache written by saveTranslationCache.
+   *
+   * @param[in] path  The path of the file.
+   *
+   * @return True if the file matches the configuration of the engine.
+   */
+  bool loadTranslationCache(const std::string &path);
+
+  /*! Share the translation cache of another engine.
+   *
+   * @param[in] other  The engine which owns the shared cache.
+   *
+   * @return True if the cache is shared.
+   */
+  bool shareCache(Engine &other);
 };
 
 } // namespace QBDI
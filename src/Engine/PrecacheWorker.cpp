@@ -0,0 +1,127 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <utility>
+
+#include "Engine/PrecacheWorker.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+PrecacheWorker::PrecacheWorker(TranslateFunc translate)
+    : translate(std::move(translate)), busy(false), stop(false) {
+  thread = std::thread(&PrecacheWorker::workerLoop, this);
+}
+
+PrecacheWorker::~PrecacheWorker() {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stop = true;
+  }
+  queueCV.notify_all();
+  thread.join();
+}
+
+void PrecacheWorker::workerLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCV.wait(lock, [this] { return stop or not queue.empty(); });
+      if (stop) {
+        return;
+      }
+    }
+    // The translateMutex is always taken before the queueMutex
+    std::lock_guard<std::recursive_mutex> translateLock(translateMutex);
+    std::pair<rword, CPUMode> item;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      if (stop) {
+        return;
+      }
+      // The queue may have been emptied while waiting for the translateMutex
+      if (queue.empty()) {
+        continue;
+      }
+      item = queue.front();
+      queue.pop_front();
+      busy = true;
+    }
+    QBDI_DEBUG("Precache basic block at address 0x{:x} in background",
+               item.first);
+    Patch::Vec basicBlock = translate(item.first, item.second);
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      results.push_back(std::move(basicBlock));
+      busy = false;
+    }
+    idleCV.notify_all();
+  }
+}
+
+void PrecacheWorker::push(const std::vector<rword> &addresses, CPUMode mode) {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    for (rword address : addresses) {
+      queue.emplace_back(address, mode);
+    }
+  }
+  queueCV.notify_one();
+}
+
+std::vector<Patch::Vec> PrecacheWorker::takeResults() {
+  std::lock_guard<std::mutex> lock(queueMutex);
+  std::vector<Patch::Vec> taken = std::move(results);
+  results.clear();
+  return taken;
+}
+
+void PrecacheWorker::wait() {
+  std::unique_lock<std::mutex> lock(queueMutex);
+  idleCV.wait(lock, [this] { return queue.empty() and not busy; });
+}
+
+PrecacheWorker::Pause::Pause(PrecacheWorker *worker)
+    : worker(worker), lock() {
+  if (worker == nullptr) {
+    return;
+  }
+  lock = std::unique_lock<std::recursive_mutex>(worker->translateMutex);
+  // No translation is running: the results are requeued to be translated
+  // again with the new configuration.
+  std::lock_guard<std::mutex> queueLock(worker->queueMutex);
+  auto &results = worker->results;
+  for (auto it = results.rbegin(); it != results.rend(); ++it) {
+    if (not it->empty()) {
+      const InstMetadata &metadata = it->front().metadata;
+      worker->queue.emplace_front(metadata.address, metadata.cpuMode);
+    }
+  }
+  results.clear();
+}
+
+PrecacheWorker::Pause::~Pause() {
+  if (worker == nullptr) {
+    return;
+  }
+  lock.unlock();
+  // The worker may be waiting for an empty queue: wake it up to translate the
+  // requeued basic blocks.
+  worker->queueCV.notify_one();
+}
+
+} // namespace QBDI
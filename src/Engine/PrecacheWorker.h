@@ -0,0 +1,109 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PRECACHEWORKER_H
+#define PRECACHEWORKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "QBDI/State.h"
+#include "Patch/Patch.h"
+
+namespace QBDI {
+
+/*! Thread that translates basic blocks ahead of their execution.
+ *
+ * The worker disassembles, patches and instruments the queued addresses with
+ * the translate function. The translated basic blocks are kept until the
+ * engine takes them to write them in the cache. The worker never accesses the
+ * cache itself.
+ */
+class PrecacheWorker {
+public:
+  using TranslateFunc = std::function<Patch::Vec(rword, CPUMode)>;
+
+  /*! Suspend the translations while the configuration of the engine (the
+   * options, the rules, ...) is modified. The basic blocks translated with the
+   * previous configuration are queued again. Nothing is done if the worker
+   * is a null pointer.
+   */
+  class Pause {
+  private:
+    PrecacheWorker *worker;
+    std::unique_lock<std::recursive_mutex> lock;
+
+  public:
+    Pause(PrecacheWorker *worker);
+
+    ~Pause();
+
+    Pause(const Pause &) = delete;
+    Pause &operator=(const Pause &) = delete;
+  };
+
+private:
+  TranslateFunc translate;
+
+  // Held by the worker during a translation
+  std::recursive_mutex translateMutex;
+
+  // Protect the queue and the results
+  std::mutex queueMutex;
+  std::condition_variable queueCV;
+  std::condition_variable idleCV;
+  std::deque<std::pair<rword, CPUMode>> queue;
+  std::vector<Patch::Vec> results;
+  bool busy;
+  bool stop;
+
+  std::thread thread;
+
+  void workerLoop();
+
+public:
+  PrecacheWorker(TranslateFunc translate);
+
+  ~PrecacheWorker();
+
+  PrecacheWorker(const PrecacheWorker &) = delete;
+  PrecacheWorker &operator=(const PrecacheWorker &) = delete;
+
+  /*! Queue basic blocks to translate.
+   *
+   * @param[in] addresses  The start addresses of the basic blocks.
+   * @param[in] mode       The CPU mode of the basic blocks.
+   */
+  void push(const std::vector<rword> &addresses, CPUMode mode);
+
+  /*! Take the basic blocks translated since the last call.
+   */
+  std::vector<Patch::Vec> takeResults();
+
+  /*! Wait until all the queued basic blocks are translated.
+   */
+  void wait();
+};
+
+} // namespace QBDI
+
+#endif // PRECACHEWORKER_H
@@ -780,6 +780,86 @@ uint32_t VM::addMemRangeCB(rword start, rword end, MemoryAccessType type,
   return id;
 }
 
+// addInlineCounter
+
+uint32_t VM::addInlineCounter(rword start, rword end, rword *counter) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(counter != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleInline::unique(
+      InstructionInRange::unique(start, end), InlineKind::Counter,
+      reinterpret_cast<rword>(counter)));
+}
+
+// addInlineCoverage
+
+uint32_t VM::addInlineCoverage(rword start, rword end, uint8_t *bitmap,
+                               rword size) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(bitmap != nullptr, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(size != 0, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleInline::unique(
+      InstructionInRange::unique(start, end), InlineKind::Coverage,
+      reinterpret_cast<rword>(bitmap), size));
+}
+
+// addInlineTrace
+
+uint32_t VM::addInlineTrace(rword start, rword end, InlineTraceBuffer *buffer,
+                            InlineTraceType type, unsigned reg) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(buffer != nullptr, return VMError::INVALID_EVENTID);
+  PatchCondition::UniquePtr condition = InstructionInRange::unique(start, end);
+  switch (type) {
+    case INLINE_TRACE_ADDRESS:
+      break;
+    case INLINE_TRACE_REGISTER:
+      QBDI_REQUIRE_ACTION(reg < REG_PC, return VMError::INVALID_EVENTID);
+      break;
+    case INLINE_TRACE_MEMORY_READ:
+      condition = And::unique(conv_unique<PatchCondition>(
+          std::move(condition), DoesReadAccess::unique()));
+      break;
+    default:
+      return VMError::INVALID_EVENTID;
+  }
+  return engine->addInstrRule(
+      InstrRuleInline::unique(std::move(condition), InlineKind::Trace,
+                              reinterpret_cast<rword>(buffer), type, reg));
+}
+
+// addEdgeCoverage
+
+uint32_t VM::addEdgeCoverage(rword start, rword end, uint8_t *bitmap) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(bitmap != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleEdgeCoverage::unique(
+      InstructionInRange::unique(start, end), reinterpret_cast<rword>(bitmap)));
+}
+
+// resetEdgeCoverage
+
+bool VM::resetEdgeCoverage(uint32_t id) {
+  if (id & EVENTID_VIRTCB_MASK) {
+    return false;
+  }
+  InstrRule *rule = engine->getInstrRule(id);
+  if (rule == nullptr) {
+    return false;
+  }
+  return rule->resetState();
+}
+
+// addBatchCB
+
+uint32_t VM::addBatchCB(rword start, rword end, unsigned reg,
+                        BatchCallback cbk, void *data) {
+  QBDI_REQUIRE_ACTION(start < end, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(reg < REG_PC, return VMError::INVALID_EVENTID);
+  QBDI_REQUIRE_ACTION(cbk != nullptr, return VMError::INVALID_EVENTID);
+  return engine->addInstrRule(InstrRuleBatchCB::unique(
+      InstructionInRange::unique(start, end), reg, cbk, data, this));
+}
+
 // addVMEventCB
 
 uint32_t VM::addVMEventCB(VMEvent mask, VMCallback cbk, void *data) {
@@ -841,6 +921,32 @@ bool VM::deleteInstrumentation(uint32_t id) {
   }
 }
 
+// setCallbackEnabled
+
+bool VM::setCallbackEnabled(uint32_t id, bool enabled) {
+  // The callbacks on a memory range are called by a shared gate
+  if (id & EVENTID_VIRTCB_MASK) {
+    return false;
+  }
+  return engine->setCallbackEnabled(id, enabled);
+}
+
+// setInstrumentationData
+
+bool VM::setInstrumentationData(uint32_t id, void *data) {
+  // The data of these callbacks are managed by the VM
+  if (id & EVENTID_VIRTCB_MASK) {
+    return false;
+  }
+  auto isId = [id](const auto &x) { return x.first == id; };
+  if (std::any_of(instCBData.begin(), instCBData.end(), isId) or
+      std::any_of(instrRuleCBData.begin(), instrRuleCBData.end(), isId) or
+      std::any_of(instrCBInfos->begin(), instrCBInfos->end(), isId)) {
+    return false;
+  }
+  return engine->setInstrumentationData(id, data);
+}
+
 // deleteAllInstrumentations
 
 void VM::deleteAllInstrumentations() {
@@ -939,12 +1045,54 @@ std::vector<MemoryAccess> VM::getBBMemoryAccess() const {
 
 bool VM::precacheBasicBlock(rword pc) { return engine->precacheBasicBlock(pc); }
 
+// precacheAsync
+
+void VM::precacheAsync(const std::vector<rword> &pcs) {
+  engine->precacheAsync(pcs);
+}
+
+// waitPrecache
+
+size_t VM::waitPrecache() { return engine->waitPrecache(); }
+
+// precacheRange
+
+size_t VM::precacheRange(rword start, rword end, size_t *codeSize) {
+  return engine->precacheRange(start, end, codeSize);
+}
+
+// precacheFunction
+
+size_t VM::precacheFunction(rword addr, size_t *codeSize) {
+  return engine->precacheFunction(addr, codeSize);
+}
+
 // clearAllCache
 
 void VM::clearAllCache() { engine->clearAllCache(); }
 
+// setCacheBudget
+
+void VM::setCacheBudget(rword budget) { engine->setCacheBudget(budget); }
+
 // clearCache
 
 void VM::clearCache(rword start, rword end) { engine->clearCache(start, end); }
 
+// saveTranslationCache
+
+bool VM::saveTranslationCache(const std::string &path) const {
+  return engine->saveTranslationCache(path);
+}
+
+// loadTranslationCache
+
+bool VM::loadTranslationCache(const std::string &path) {
+  return engine->loadTranslationCache(path);
+}
+
+// shareCache
+
+bool VM::shareCache(VM &other) { return engine->shareCache(*other.engine); }
+
 } // namespace QBDI
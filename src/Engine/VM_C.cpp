@@ -208,6 +208,44 @@ uint32_t qbdi_addMemRangeCB(VMInstanceRef instance, rword start, rword end,
                                                     data);
 }
 
+uint32_t qbdi_addInlineCounter(VMInstanceRef instance, rword start, rword end,
+                               rword *counter) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addInlineCounter(start, end, counter);
+}
+
+uint32_t qbdi_addInlineCoverage(VMInstanceRef instance, rword start, rword end,
+                                uint8_t *bitmap, rword size) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addInlineCoverage(start, end, bitmap,
+                                                        size);
+}
+
+uint32_t qbdi_addInlineTrace(VMInstanceRef instance, rword start, rword end,
+                             InlineTraceBuffer *buffer, InlineTraceType type,
+                             unsigned reg) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addInlineTrace(start, end, buffer, type,
+                                                     reg);
+}
+
+uint32_t qbdi_addEdgeCoverage(VMInstanceRef instance, rword start, rword end,
+                              uint8_t *bitmap) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addEdgeCoverage(start, end, bitmap);
+}
+
+bool qbdi_resetEdgeCoverage(VMInstanceRef instance, uint32_t id) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->resetEdgeCoverage(id);
+}
+
+uint32_t qbdi_addBatchCB(VMInstanceRef instance, rword start, rword end,
+                         unsigned reg, BatchCallback cbk, void *data) {
+  QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
+  return static_cast<VM *>(instance)->addBatchCB(start, end, reg, cbk, data);
+}
+
 uint32_t qbdi_addVMEventCB(VMInstanceRef instance, VMEvent mask, VMCallback cbk,
                            void *data) {
   QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
@@ -219,6 +257,18 @@ bool qbdi_deleteInstrumentation(VMInstanceRef instance, uint32_t id) {
   return static_cast<VM *>(instance)->deleteInstrumentation(id);
 }
 
+bool qbdi_setCallbackEnabled(VMInstanceRef instance, uint32_t id,
+                             bool enabled) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setCallbackEnabled(id, enabled);
+}
+
+bool qbdi_setInstrumentationData(VMInstanceRef instance, uint32_t id,
+                                 void *data) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  return static_cast<VM *>(instance)->setInstrumentationData(id, data);
+}
+
 void qbdi_deleteAllInstrumentations(VMInstanceRef instance) {
   QBDI_REQUIRE_ACTION(instance, return );
   static_cast<VM *>(instance)->deleteAllInstrumentations();
@@ -288,14 +338,61 @@ bool qbdi_precacheBasicBlock(VMInstanceRef instance, rword pc) {
   return static_cast<VM *>(instance)->precacheBasicBlock(pc);
 }
 
+void qbdi_precacheAsync(VMInstanceRef instance, const rword *pcs,
+                        size_t size) {
+  QBDI_REQUIRE_ACTION(instance, return );
+  QBDI_REQUIRE_ACTION(pcs != nullptr or size == 0, return );
+  static_cast<VM *>(instance)->precacheAsync(
+      std::vector<rword>(pcs, pcs + size));
+}
+
+size_t qbdi_waitPrecache(VMInstanceRef instance) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->waitPrecache();
+}
+
+size_t qbdi_precacheRange(VMInstanceRef instance, rword start, rword end,
+                          size_t *codeSize) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->precacheRange(start, end, codeSize);
+}
+
+size_t qbdi_precacheFunction(VMInstanceRef instance, rword addr,
+                             size_t *codeSize) {
+  QBDI_REQUIRE_ACTION(instance, return 0);
+  return static_cast<VM *>(instance)->precacheFunction(addr, codeSize);
+}
+
 void qbdi_clearAllCache(VMInstanceRef instance) {
   static_cast<VM *>(instance)->clearAllCache();
 }
 
+void qbdi_setCacheBudget(VMInstanceRef instance, rword budget) {
+  static_cast<VM *>(instance)->setCacheBudget(budget);
+}
+
 void qbdi_clearCache(VMInstanceRef instance, rword start, rword end) {
   static_cast<VM *>(instance)->clearCache(start, end);
 }
 
+bool qbdi_saveTranslationCache(VMInstanceRef instance, const char *path) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(path, return false);
+  return static_cast<VM *>(instance)->saveTranslationCache(path);
+}
+
+bool qbdi_loadTranslationCache(VMInstanceRef instance, const char *path) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(path, return false);
+  return static_cast<VM *>(instance)->loadTranslationCache(path);
+}
+
+bool qbdi_shareCache(VMInstanceRef instance, VMInstanceRef other) {
+  QBDI_REQUIRE_ACTION(instance, return false);
+  QBDI_REQUIRE_ACTION(other, return false);
+  return static_cast<VM *>(instance)->shareCache(*static_cast<VM *>(other));
+}
+
 uint32_t qbdi_addInstrRule(VMInstanceRef instance, InstrRuleCallbackC cbk,
                            AnalysisType type, void *data) {
   QBDI_REQUIRE_ACTION(instance, return VMError::INVALID_EVENTID);
@@ -19,12 +19,15 @@
 #include <iterator>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <system_error>
 
 #include "llvm/ADT/Optional.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrDesc.h"
+#include "llvm/MC/MCInstrInfo.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/Process.h"
 
@@ -32,6 +35,7 @@
 #include "ExecBlock/Context.h"
 #include "ExecBlock/ExecBlock.h"
 #include "Patch/ExecBlockFlags.h"
+#include "Patch/InstInfo.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchGenerator.h"
 #include "Patch/PatchRules.h"
@@ -40,6 +44,8 @@
 #include "Patch/Types.h"
 #include "Utility/InstAnalysis_prive.h"
 #include "Utility/LogSys.h"
+#include "Utility/Module.h"
+#include "Utility/Serialize.h"
 #include "Utility/System.h"
 #include "Utility/memory_ostream.h"
 
@@ -52,7 +58,7 @@ ExecBlock::ExecBlock(
     const LLVMCPUs &llvmCPUs, VMInstanceRef vminstance,
     const std::vector<std::unique_ptr<RelocatableInst>> *execBlockPrologue,
     const std::vector<std::unique_ptr<RelocatableInst>> *execBlockEpilogue,
-    uint32_t epilogueSize_)
+    uint32_t epilogueSize_, uint32_t pageCount, Context *sharedContext)
     : vminstance(vminstance), llvmCPUs(llvmCPUs), epilogueSize(epilogueSize_),
       isFull(false) {
 
@@ -69,24 +75,58 @@ ExecBlock::ExecBlock(
   if constexpr (is_ios)
     mflags |= PF::MF_EXEC;
 
-  // Allocate 2 pages block
-  codeBlock = QBDI::allocateMappedMemory(2 * pageSize, nullptr, mflags, ec);
+  // The code block and the data block have the same size, unless the context
+  // leaves less than half of the data block for the shadows
+  uint64_t blockSize = pageCount * pageSize;
+  QBDI_REQUIRE_ACTION(pageCount > 0 && blockSize <= EXEC_BLOCK_MAX_CODE_SIZE,
+                      abort());
+  uint64_t dataSize = blockSize;
+  while (dataSize < sizeof(Context) + blockSize / 2) {
+    dataSize += pageSize;
+  }
+
+  // Allocate 2 blocks, near the shared context if any
+  llvm::sys::MemoryBlock nearBlock(sharedContext, sizeof(Context));
+  codeBlock = QBDI::allocateMappedMemory(
+      blockSize + dataSize, sharedContext != nullptr ? &nearBlock : nullptr,
+      mflags, ec);
   QBDI_REQUIRE_ACTION(codeBlock.base() != nullptr, abort());
   // Split it in two blocks
   dataBlock = llvm::sys::MemoryBlock(
       reinterpret_cast<void *>(reinterpret_cast<uint64_t>(codeBlock.base()) +
-                               pageSize),
-      pageSize);
-  codeBlock = llvm::sys::MemoryBlock(codeBlock.base(), pageSize);
-  QBDI_DEBUG("codeBlock @ 0x{:x} | dataBlock @ 0x{:x} | pageSize {} bytes",
+                               blockSize),
+      dataSize);
+  codeBlock = llvm::sys::MemoryBlock(codeBlock.base(), blockSize);
+  QBDI_DEBUG("codeBlock @ 0x{:x} | dataBlock @ 0x{:x} | blockSize {} bytes",
              reinterpret_cast<rword>(codeBlock.base()),
-             reinterpret_cast<rword>(dataBlock.base()), pageSize);
+             reinterpret_cast<rword>(dataBlock.base()), blockSize);
 
   // Other initializations
   context = static_cast<Context *>(dataBlock.base());
+  if (sharedContext != nullptr) {
+    if constexpr (is_x86_64) {
+      // The context is accessed with a pc relative displacement of 32 bits
+      rword begin = std::min(reinterpret_cast<rword>(sharedContext),
+                             reinterpret_cast<rword>(codeBlock.base()));
+      rword end = std::max(reinterpret_cast<rword>(sharedContext + 1),
+                           reinterpret_cast<rword>(codeBlock.base()) +
+                               codeBlock.allocatedSize());
+      if (end - begin < (1ULL << 31)) {
+        context = sharedContext;
+      } else {
+        QBDI_DEBUG("Shared context @ 0x{:x} out of range, use the data block",
+                   reinterpret_cast<rword>(sharedContext));
+      }
+    } else if constexpr (is_x86) {
+      // The context is accessed with an absolute address
+      context = sharedContext;
+    }
+  }
   shadows = reinterpret_cast<rword *>(
       reinterpret_cast<rword>(dataBlock.base()) + sizeof(Context));
   shadowIdx = 0;
+  returnStack = NOT_FOUND;
+  lastAccess = 0;
   currentSeq = 0;
   currentInst = 0;
   codeStream = std::make_unique<memory_ostream>(codeBlock);
@@ -146,6 +186,13 @@ ExecBlock::~ExecBlock() {
   QBDI::releaseMappedMemory(codeBlock);
 }
 
+rword ExecBlock::getDataBlockAddress(rword offset) const {
+  if (offset < sizeof(Context)) {
+    return reinterpret_cast<rword>(context) + offset;
+  }
+  return getDataBlockBase() + offset;
+}
+
 void ExecBlock::changeVMInstanceRef(VMInstanceRef vminstance) {
   this->vminstance = vminstance;
 }
@@ -198,6 +245,8 @@ VMAction ExecBlock::execute() {
   do {
     context->hostState.callback = static_cast<rword>(0);
     context->hostState.data = static_cast<rword>(0);
+    // Overwritten by the exit of the sequences when the chaining is enabled
+    context->hostState.origin = seqRegistry[currentSeq].endInstID;
 
     QBDI_DEBUG("Execution of ExecBlock 0x{:x} resumed at 0x{:x}",
                reinterpret_cast<uintptr_t>(this), context->hostState.selector);
@@ -211,7 +260,13 @@ VMAction ExecBlock::execute() {
                  reinterpret_cast<uintptr_t>(this),
                  context->hostState.callback);
       QBDI_REQUIRE(currentInst < instMetadata.size());
+      // The instruction may belong to a linked sequence
+      if (currentInst < seqRegistry[currentSeq].startInstID or
+          currentInst > seqRegistry[currentSeq].endInstID) {
+        currentSeq = instRegistry[currentInst].seqID;
+      }
 
+      loadContextFPR(context);
       VMAction r =
           (reinterpret_cast<InstCallback>(context->hostState.callback))(
               vminstance, &context->gprState, &context->fprState,
@@ -278,9 +333,17 @@ VMAction ExecBlock::execute() {
                      context->hostState.callback);
           return STOP;
       }
+      // Only switch the state used by the end of the sequence
+      context->hostState.executeFlags = instRegistry[currentInst].resumeFlags;
     }
   } while (context->hostState.callback != 0);
-  currentInst = seqRegistry[currentSeq].endInstID;
+  currentInst = context->hostState.origin;
+  QBDI_REQUIRE(currentInst < instMetadata.size());
+  // The execution may have ended in a linked sequence
+  if (currentInst < seqRegistry[currentSeq].startInstID or
+      currentInst > seqRegistry[currentSeq].endInstID) {
+    currentSeq = instRegistry[currentInst].seqID;
+  }
 
   return CONTINUE;
 }
@@ -325,6 +388,7 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
     uint32_t rollbackShadowIdx = shadowIdx;
     size_t rollbackShadowRegistry = shadowRegistry.size();
     size_t rollbackTagRegistry = tagRegistry.size();
+    size_t rollbackCallbackSlots = callbackSlots.size();
 
     QBDI_DEBUG_BLOCK({
       std::string disass =
@@ -336,9 +400,22 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
           seqIt->metadata.address, disass.c_str());
     });
 
+    // An instruction which modifies the PC inside a sequence is a branch of a
+    // trace. It's followed by a guard, unless its target is constant.
+    rword guardTarget = 0;
+    if (seqIt->metadata.modifyPC and std::next(seqIt) != seqEnd) {
+      rword target;
+      guardTarget = std::next(seqIt)->metadata.address;
+      if (getStaticTarget(seqIt->metadata.inst, seqIt->metadata.address,
+                          seqIt->metadata.instSize, target) and
+          target == guardTarget) {
+        guardTarget = 0;
+      }
+    }
+
     // Attempt to write a complete patch. If not, rollback to the last complete
     // patch written
-    if (not writePatch(*seqIt, llvmcpu)) {
+    if (not writePatch(*seqIt, llvmcpu, guardTarget)) {
 
       QBDI_DEBUG("Rolling back to offset 0x{:x}", rollbackOffset);
 
@@ -349,13 +426,15 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
       shadowIdx = rollbackShadowIdx;
       shadowRegistry.resize(rollbackShadowRegistry);
       tagRegistry.resize(rollbackTagRegistry);
+      callbackSlots.resize(rollbackCallbackSlots);
       // It's a NULL rollback, don't terminate it
       if (rollbackOffset == startOffset) {
         QBDI_DEBUG("NULL rollback, nothing written to ExecBlock 0x{:x}",
                    reinterpret_cast<uintptr_t>(this));
         return {EXEC_BLOCK_FULL, 0, 0};
       }
-      needTerminator = true;
+      // The last written instruction may be a branch of a trace
+      needTerminator = not instMetadata.back().modifyPC;
       break;
     } else {
       // Complete instruction was written, we add the metadata
@@ -368,12 +447,19 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
           static_cast<uint16_t>(rollbackShadowRegistry),
           static_cast<uint16_t>(shadowRegistry.size() - rollbackShadowRegistry),
           static_cast<uint16_t>(rollbackTagRegistry),
-          static_cast<uint16_t>(tagRegistry.size() - rollbackTagRegistry)});
+          static_cast<uint16_t>(tagRegistry.size() - rollbackTagRegistry),
+          0});
       // compute offsetSkip of the new instruction
       std::vector<TagInfo> endPatchTag =
           queryTagByInst(instRegistry.size() - 1, RelocTagPatchEnd);
       QBDI_REQUIRE_ACTION(endPatchTag.size() == 1, abort());
       instRegistry.back().offsetSkip = endPatchTag[0].offset;
+      // The callback slots hold the index of their rule in the patch
+      for (size_t i = rollbackCallbackSlots; i < callbackSlots.size(); i++) {
+        CallbackSlotInfo &slot = callbackSlots[i];
+        QBDI_REQUIRE_ACTION(slot.ruleID < seqIt->instrRules.size(), abort());
+        slot.ruleID = seqIt->instrRules[slot.ruleID];
+      }
       // Update indexes
       needTerminator = not seqIt->metadata.modifyPC;
       executeFlags |= seqIt->metadata.execblockFlags;
@@ -396,8 +482,77 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
       llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
     }
   }
+  // A sequence that exits to a constant address can be linked later to the
+  // next sequence. Its exit is an indirect jump through a shadow that targets
+  // the epilogue until the sequence is linked. The other sequences exit
+  // through an inline cache of their last targets.
+  uint16_t linkShadow = NOT_FOUND;
+  rword linkTarget = 0;
+  uint16_t cacheShadow = NOT_FOUND;
+  uint16_t returnShadow = NOT_FOUND;
+  RelocatableInst::UniquePtrVec jmpEpilogue;
+  if (llvmcpu.getOptions() & Options::OPT_ENABLE_BLOCK_CHAINING) {
+    const InstMetadata &lastInst = instMetadata.back();
+    const llvm::MCInstrDesc &desc =
+        llvmcpu.getMCII().get(lastInst.inst.getOpcode());
+    size_t freeShadows =
+        (dataBlock.allocatedSize() - sizeof(Context)) / sizeof(rword) -
+        shadowIdx;
+    if (needTerminator) {
+      linkTarget = lastInst.endAddress();
+    } else if (not getStaticTarget(lastInst.inst, lastInst.address,
+                                   lastInst.instSize, linkTarget)) {
+      linkTarget = 0;
+    }
+    // The VM needs the last executed sequence to fill the inline caches
+    append(jmpEpilogue, getExitOrigin(getNextInstID() - 1));
+    // A call pushes its return address with a return slot on the shadow
+    // return stack. The return slot targets the epilogue until the return
+    // address is reached. A return jumps to the return slot of the top entry
+    // when its target matches the return address.
+    if ((llvmcpu.getOptions() & Options::OPT_ENABLE_SHADOW_STACK) and
+        not needTerminator and (desc.isCall() or desc.isReturn())) {
+      if (returnStack == NOT_FOUND and freeShadows > RETURN_STACK_SIZE) {
+        returnStack = newShadow();
+        for (uint16_t i = 1; i < RETURN_STACK_SIZE; i++) {
+          newShadow();
+        }
+        freeShadows -= RETURN_STACK_SIZE;
+        resetReturnStack();
+      }
+      if (returnStack != NOT_FOUND and desc.isCall() and freeShadows >= 1) {
+        returnShadow = newShadow();
+        freeShadows -= 1;
+        shadows[returnShadow] = getEpilogueAddress();
+        pendingReturns[lastInst.endAddress()].push_back(seqID);
+        append(jmpEpilogue,
+               getReturnStackPush(getShadowOffset(returnStack),
+                                  lastInst.endAddress(),
+                                  getShadowOffset(returnShadow)));
+      } else if (returnStack != NOT_FOUND and desc.isReturn()) {
+        append(jmpEpilogue, getReturnStackExit(getShadowOffset(returnStack)));
+      }
+    }
+    if (linkTarget != 0 and freeShadows >= 1) {
+      linkShadow = newShadow();
+      shadows[linkShadow] = getEpilogueAddress();
+      pendingLinks[linkTarget].push_back(seqID);
+      append(jmpEpilogue, JmpDataBlock(Offset(getShadowOffset(linkShadow))));
+    } else if (linkTarget == 0 and freeShadows >= INDIRECT_CACHE_SIZE) {
+      cacheShadow = newShadow();
+      for (uint16_t i = 1; i < INDIRECT_CACHE_SIZE; i++) {
+        newShadow();
+      }
+      resetIndirectCache(cacheShadow);
+      append(jmpEpilogue, getIndirectCacheExit(getShadowOffset(cacheShadow)));
+    } else {
+      linkTarget = 0;
+      append(jmpEpilogue, JmpEpilogue());
+    }
+  } else {
+    jmpEpilogue = JmpEpilogue();
+  }
   // JIT the jump to epilogue
-  RelocatableInst::UniquePtrVec jmpEpilogue = JmpEpilogue();
   for (const RelocatableInst::UniquePtr &inst : jmpEpilogue) {
     if (inst->getTag() != RelocatableInstTag::RelocInst) {
       continue;
@@ -412,7 +567,22 @@ ExecBlock::writeSequence(std::vector<Patch>::const_iterator seqIt,
   }
   // Register sequence
   uint16_t endInstID = getNextInstID() - 1;
-  seqRegistry.push_back(SeqInfo{startInstID, endInstID, executeFlags, cpuMode});
+  // After a callback, the context switch only needs the registers used by the
+  // remaining instructions. A linked sequence may need the flags of all the
+  // instructions.
+  const bool reduceFlags =
+      (llvmcpu.getOptions() &
+       (Options::OPT_DISABLE_FPR | Options::OPT_DISABLE_OPTIONAL_FPR |
+        Options::OPT_ENABLE_BLOCK_CHAINING)) == 0;
+  uint8_t resumeFlags = 0;
+  for (uint16_t id = endInstID + 1; id > startInstID; id--) {
+    resumeFlags |=
+        reduceFlags ? instMetadata[id - 1].execblockFlags : executeFlags;
+    instRegistry[id - 1].resumeFlags = resumeFlags;
+  }
+  seqRegistry.push_back(SeqInfo{startInstID, endInstID, executeFlags, cpuMode,
+                                {}, linkShadow, linkTarget, cacheShadow,
+                                returnShadow});
   finalizeScratchRegisterForPatch();
   // Return write results
   unsigned bytesWritten =
@@ -427,10 +597,146 @@ uint16_t ExecBlock::splitSequence(uint16_t instID) {
   uint16_t seqID = instRegistry[instID].seqID;
   seqRegistry.push_back(SeqInfo{
       instID, seqRegistry[seqID].endInstID, seqRegistry[seqID].executeFlags,
-      seqRegistry[seqID].cpuMode, seqRegistry[seqID].sr});
+      seqRegistry[seqID].cpuMode, seqRegistry[seqID].sr,
+      seqRegistry[seqID].linkShadow, seqRegistry[seqID].linkTarget,
+      seqRegistry[seqID].cacheShadow, seqRegistry[seqID].returnShadow});
   return getNextSeqID() - 1;
 }
 
+void ExecBlock::linkSequence(uint16_t seqID) {
+  QBDI_REQUIRE(seqID < seqRegistry.size());
+  if (pendingLinks.empty() and pendingReturns.empty()) {
+    return;
+  }
+  const SeqInfo &target = seqRegistry[seqID];
+  rword address = instMetadata[target.startInstID].address;
+  rword targetAddress =
+      reinterpret_cast<rword>(codeBlock.base()) +
+      static_cast<rword>(instRegistry[target.startInstID].offset);
+  auto it = pendingLinks.find(address);
+  if (it != pendingLinks.end()) {
+    for (uint16_t linkedSeqID : it->second) {
+      const SeqInfo &seq = seqRegistry[linkedSeqID];
+      // the context switch of the linked sequence must be enough for the
+      // target
+      if (seq.cpuMode != target.cpuMode or
+          (target.executeFlags & ~seq.executeFlags) != 0) {
+        continue;
+      }
+      QBDI_DEBUG("Link seqID {:x} of ExecBlock 0x{:x} to seqID {:x}",
+                 linkedSeqID, reinterpret_cast<uintptr_t>(this), seqID);
+      shadows[seq.linkShadow] = targetAddress;
+    }
+    pendingLinks.erase(it);
+  }
+  auto retIt = pendingReturns.find(address);
+  if (retIt != pendingReturns.end()) {
+    // A return slot can be reached by any return of the ExecBlock. The target
+    // mustn't need more executeFlags than the minimal context switch.
+    uint8_t minimalFlags = 0;
+    if (llvmCPUs.getCPU(target.cpuMode).getOptions() &
+        Options::OPT_DISABLE_OPTIONAL_FPR) {
+      minimalFlags = defaultExecuteFlags;
+    }
+    if ((target.executeFlags & ~minimalFlags) == 0) {
+      for (uint16_t callSeqID : retIt->second) {
+        const SeqInfo &seq = seqRegistry[callSeqID];
+        if (seq.cpuMode != target.cpuMode) {
+          continue;
+        }
+        QBDI_DEBUG("Link return of seqID {:x} of ExecBlock 0x{:x} to seqID "
+                   "{:x}",
+                   callSeqID, reinterpret_cast<uintptr_t>(this), seqID);
+        shadows[seq.returnShadow] = targetAddress;
+      }
+    }
+    pendingReturns.erase(retIt);
+  }
+}
+
+void ExecBlock::linkIndirect(uint16_t fromSeqID, uint16_t toSeqID) {
+  QBDI_REQUIRE(fromSeqID < seqRegistry.size());
+  QBDI_REQUIRE(toSeqID < seqRegistry.size());
+  const SeqInfo &seq = seqRegistry[fromSeqID];
+  const SeqInfo &target = seqRegistry[toSeqID];
+  if (seq.cacheShadow == NOT_FOUND or seq.cpuMode != target.cpuMode or
+      (target.executeFlags & ~seq.executeFlags) != 0) {
+    return;
+  }
+  rword targetAddress = instMetadata[target.startInstID].address;
+  rword *cache = &shadows[seq.cacheShadow];
+  for (uint16_t i = 0; i < INDIRECT_CACHE_ENTRIES; i++) {
+    if (cache[2 * i] == targetAddress) {
+      return;
+    }
+  }
+  QBDI_DEBUG("Cache target 0x{:x} of seqID {:x} of ExecBlock 0x{:x}",
+             targetAddress, fromSeqID, reinterpret_cast<uintptr_t>(this));
+  // The most recent target is the first entry of the cache
+  for (uint16_t i = INDIRECT_CACHE_ENTRIES - 1; i > 0; i--) {
+    cache[2 * i] = cache[2 * (i - 1)];
+    cache[2 * i + 1] = cache[2 * (i - 1) + 1];
+  }
+  cache[0] = targetAddress;
+  cache[1] = reinterpret_cast<rword>(codeBlock.base()) +
+             static_cast<rword>(instRegistry[target.startInstID].offset);
+}
+
+void ExecBlock::resetIndirectCache(uint16_t cacheShadow) {
+  // An empty entry targets the epilogue
+  for (uint16_t i = 0; i < INDIRECT_CACHE_ENTRIES; i++) {
+    shadows[cacheShadow + 2 * i] = 0;
+    shadows[cacheShadow + 2 * i + 1] = getEpilogueAddress();
+  }
+}
+
+void ExecBlock::resetReturnStack() {
+  // An empty entry never matches a return
+  for (uint16_t i = 0; i < RETURN_STACK_ENTRIES; i++) {
+    shadows[returnStack + 2 * i] = 0;
+    shadows[returnStack + 2 * i + 1] = 0;
+  }
+  shadows[returnStack + 2 * RETURN_STACK_ENTRIES] = 0;
+}
+
+void ExecBlock::popReturnStack(rword address) {
+  if (returnStack == NOT_FOUND) {
+    return;
+  }
+  rword &top = shadows[returnStack + 2 * RETURN_STACK_ENTRIES];
+  if (shadows[returnStack + top / sizeof(rword)] == address) {
+    top = (top - 2 * sizeof(rword)) % RETURN_STACK_RING_SIZE;
+  }
+}
+
+void ExecBlock::unlinkSequences() {
+  rword epilogueAddress = getEpilogueAddress();
+  pendingLinks.clear();
+  pendingReturns.clear();
+  for (size_t i = 0; i < seqRegistry.size(); i++) {
+    const SeqInfo &seq = seqRegistry[i];
+    // splitted sequences share the link of the original sequence
+    if (instRegistry[seq.startInstID].seqID != i) {
+      continue;
+    }
+    if (seq.linkShadow != NOT_FOUND) {
+      shadows[seq.linkShadow] = epilogueAddress;
+      pendingLinks[seq.linkTarget].push_back(static_cast<uint16_t>(i));
+    }
+    if (seq.cacheShadow != NOT_FOUND) {
+      resetIndirectCache(seq.cacheShadow);
+    }
+    if (seq.returnShadow != NOT_FOUND) {
+      shadows[seq.returnShadow] = epilogueAddress;
+      pendingReturns[instMetadata[seq.endInstID].endAddress()].push_back(
+          static_cast<uint16_t>(i));
+    }
+  }
+  if (returnStack != NOT_FOUND) {
+    resetReturnStack();
+  }
+}
+
 void ExecBlock::makeRX() {
   if (not isRX()) {
     QBDI_DEBUG("Making ExecBlock 0x{:x} RX", reinterpret_cast<uintptr_t>(this));
@@ -451,6 +757,65 @@ void ExecBlock::makeRW() {
   }
 }
 
+uint32_t ExecBlock::countSequence(uint16_t seqID) {
+  QBDI_REQUIRE(seqID < seqRegistry.size());
+  if (seqID >= seqCounters.size()) {
+    seqCounters.resize(seqRegistry.size(), 0);
+  }
+  uint32_t &counter = seqCounters[seqID];
+  if (counter == UINT32_MAX) {
+    return 0;
+  }
+  // saturate before the disabled value
+  if (counter < UINT32_MAX - 1) {
+    counter++;
+  }
+  return counter;
+}
+
+void ExecBlock::disableCounter(uint16_t seqID) {
+  QBDI_REQUIRE(seqID < seqRegistry.size());
+  if (seqID >= seqCounters.size()) {
+    seqCounters.resize(seqRegistry.size(), 0);
+  }
+  seqCounters[seqID] = UINT32_MAX;
+}
+
+uint16_t ExecBlock::newCallbackSlot(rword cbk, rword data, bool enabled,
+                                    uint16_t ruleIndex) {
+  // The rule and the offsets are set when the patch is written
+  CallbackSlotInfo slot{ruleIndex, 0, 0, 0, 0, 0, enabled};
+  slot.jumpShadow = newShadow(ShadowReservedTag::CALLBACK_SLOT_JUMP);
+  slot.cbkShadow = newShadow(ShadowReservedTag::CALLBACK_SLOT_CBK);
+  slot.dataShadow = newShadow(ShadowReservedTag::CALLBACK_SLOT_DATA);
+  shadows[slot.cbkShadow] = cbk;
+  shadows[slot.dataShadow] = data;
+  callbackSlots.push_back(slot);
+  return slot.jumpShadow;
+}
+
+void ExecBlock::updateCallbackSlot(const CallbackSlotInfo &slot) {
+  rword offset = slot.enabled ? slot.bodyOffset : slot.endOffset;
+  shadows[slot.jumpShadow] = reinterpret_cast<rword>(codeBlock.base()) + offset;
+}
+
+void ExecBlock::setCallbackEnabled(uint32_t ruleID, bool enabled) {
+  for (CallbackSlotInfo &slot : callbackSlots) {
+    if (slot.ruleID == ruleID) {
+      slot.enabled = enabled;
+      updateCallbackSlot(slot);
+    }
+  }
+}
+
+void ExecBlock::setCallbackData(uint32_t ruleID, rword data) {
+  for (const CallbackSlotInfo &slot : callbackSlots) {
+    if (slot.ruleID == ruleID) {
+      shadows[slot.dataShadow] = data;
+    }
+  }
+}
+
 uint16_t ExecBlock::newShadow(uint16_t tag) {
   uint16_t id = shadowIdx++;
   QBDI_REQUIRE_ACTION(id * sizeof(rword) <
@@ -645,4 +1010,244 @@ float ExecBlock::occupationRatio() const {
          static_cast<float>(codeBlock.allocatedSize());
 }
 
+// The operands of a saved instruction
+enum SavedOperandKind : uint8_t { SavedReg = 0, SavedImm = 1 };
+
+// The flags of a saved relocation. The guards of the traces compare the PC
+// with the complement of an address.
+enum SavedRelocFlags : uint8_t { RelocOwned = 1, RelocComplement = 2 };
+
+struct SavedReloc {
+  uint32_t offset;
+  uint8_t flags;
+  AddressLocation loc;
+};
+
+bool ExecBlock::save(std::ostream &os, rword base, AddressTable *table) const {
+  // The callback slots depend on the IDs of the rules of the VM
+  if (hasSharedContext() or not callbackSlots.empty()) {
+    return false;
+  }
+  // The decoded instructions only have register and immediate operands
+  for (const InstMetadata &metadata : instMetadata) {
+    for (const llvm::MCOperand &op : metadata.inst) {
+      if (not op.isReg() and not op.isImm()) {
+        return false;
+      }
+    }
+  }
+  // The absolute addresses of the code are saved as locations of the table.
+  // The other immediates don't depend on the modules.
+  std::vector<SavedReloc> relocs;
+  if (table != nullptr) {
+    std::vector<std::pair<uint32_t, rword>> immediates;
+    if (not getAbsoluteImmediates(immediates)) {
+      return false;
+    }
+    for (const auto &imm : immediates) {
+      SavedReloc reloc{imm.first, 0, {}};
+      if (table->getLocation(imm.second, reloc.loc)) {
+        relocs.push_back(reloc);
+      } else if (table->getLocation(~imm.second, reloc.loc)) {
+        reloc.flags |= RelocComplement;
+        relocs.push_back(reloc);
+      }
+    }
+  }
+  std::vector<SeqInfo> sequences = seqRegistry;
+  for (SeqInfo &seq : sequences) {
+    if (seq.linkTarget != 0) {
+      seq.linkTarget -= base;
+    }
+  }
+
+  uint32_t codeSize = static_cast<uint32_t>(codeBlock.allocatedSize());
+  uint32_t codeEnd = static_cast<uint32_t>(codeStream->current_pos());
+  writeValue(os, codeSize);
+  writeValue(os, epilogueSize);
+  writeValue(os, codeEnd);
+  os.write(static_cast<const char *>(codeBlock.base()), codeEnd);
+  writeValue(os, static_cast<uint32_t>(relocs.size()));
+  for (const SavedReloc &reloc : relocs) {
+    writeValue(os, reloc.offset);
+    writeValue(os, static_cast<uint8_t>(reloc.flags |
+                                        (reloc.loc.owned ? RelocOwned : 0)));
+    writeValue(os, reloc.loc.index);
+    writeValue(os, reloc.loc.offset);
+  }
+  writeValue(os, shadowIdx);
+  os.write(reinterpret_cast<const char *>(shadows), shadowIdx * sizeof(rword));
+  writeVector(os, shadowRegistry);
+  writeVector(os, tagRegistry);
+  writeVector(os, instRegistry);
+  writeVector(os, sequences);
+  writeValue(os, static_cast<uint32_t>(instMetadata.size()));
+  for (const InstMetadata &metadata : instMetadata) {
+    writeValue(os, metadata.address - base);
+    writeValue(os, metadata.instSize);
+    writeValue(os, metadata.patchSize);
+    writeValue(os, metadata.cpuMode);
+    writeValue(os, metadata.modifyPC);
+    writeValue(os, metadata.merge);
+    writeValue(os, metadata.execblockFlags);
+    writeValue(os, metadata.inst.getOpcode());
+    writeValue(os, metadata.inst.getFlags());
+    writeValue(os, static_cast<uint32_t>(metadata.inst.getNumOperands()));
+    for (const llvm::MCOperand &op : metadata.inst) {
+      if (op.isReg()) {
+        writeValue(os, SavedReg);
+        writeValue(os, static_cast<int64_t>(op.getReg()));
+      } else {
+        writeValue(os, SavedImm);
+        writeValue(os, op.getImm());
+      }
+    }
+  }
+  writeValue(os, isFull);
+  writeValue(os, returnStack);
+  return os.good();
+}
+
+bool ExecBlock::load(std::istream &is, rword base,
+                     const AddressTable *table) {
+  QBDI_REQUIRE_ACTION(instMetadata.empty(), abort());
+
+  uint32_t codeSize, savedEpilogueSize, codeEnd;
+  if (not readValue(is, codeSize) or not readValue(is, savedEpilogueSize) or
+      not readValue(is, codeEnd)) {
+    return false;
+  }
+  // The prologue and the epilogue of the saved ExecBlock must be the same
+  if (codeSize != codeBlock.allocatedSize() or
+      savedEpilogueSize != epilogueSize or
+      codeEnd > codeBlock.allocatedSize() - epilogueSize) {
+    QBDI_DEBUG("Incompatible saved ExecBlock");
+    return false;
+  }
+  if constexpr (not is_ios) {
+    makeRW();
+  }
+  is.read(static_cast<char *>(codeBlock.base()), codeEnd);
+  codeStream->seek(codeEnd);
+
+  uint32_t nbRelocs;
+  if (not readValue(is, nbRelocs)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < nbRelocs; i++) {
+    uint32_t offset;
+    uint8_t flags;
+    AddressLocation loc;
+    rword value;
+    if (not readValue(is, offset) or not readValue(is, flags) or
+        not readValue(is, loc.index) or not readValue(is, loc.offset) or
+        codeEnd < sizeof(rword) or offset > codeEnd - sizeof(rword)) {
+      return false;
+    }
+    loc.owned = (flags & RelocOwned) != 0;
+    if (table == nullptr or not table->getAddress(loc, value)) {
+      QBDI_DEBUG("Cannot relocate the address at offset 0x{:x}", offset);
+      return false;
+    }
+    if (flags & RelocComplement) {
+      value = ~value;
+    }
+    memcpy(static_cast<uint8_t *>(codeBlock.base()) + offset, &value,
+           sizeof(value));
+  }
+
+  size_t maxShadows =
+      (dataBlock.allocatedSize() - sizeof(Context)) / sizeof(rword);
+  if (not readValue(is, shadowIdx) or shadowIdx > maxShadows) {
+    return false;
+  }
+  is.read(reinterpret_cast<char *>(shadows), shadowIdx * sizeof(rword));
+  if (not readVector(is, shadowRegistry) or not readVector(is, tagRegistry) or
+      not readVector(is, instRegistry) or not readVector(is, seqRegistry)) {
+    return false;
+  }
+  for (SeqInfo &seq : seqRegistry) {
+    if (seq.linkTarget != 0) {
+      seq.linkTarget += base;
+    }
+  }
+
+  uint32_t nbInst;
+  if (not readValue(is, nbInst) or nbInst != instRegistry.size()) {
+    return false;
+  }
+  instMetadata.reserve(nbInst);
+  for (uint32_t i = 0; i < nbInst; i++) {
+    llvm::MCInst inst;
+    unsigned opcode, flags;
+    uint32_t nbOperands;
+    InstMetadata metadata(inst);
+    if (not readValue(is, metadata.address) or
+        not readValue(is, metadata.instSize) or
+        not readValue(is, metadata.patchSize) or
+        not readValue(is, metadata.cpuMode) or
+        not readValue(is, metadata.modifyPC) or
+        not readValue(is, metadata.merge) or
+        not readValue(is, metadata.execblockFlags) or
+        not readValue(is, opcode) or not readValue(is, flags) or
+        not readValue(is, nbOperands) or nbOperands > 64) {
+      return false;
+    }
+    metadata.address += base;
+    metadata.inst.setOpcode(opcode);
+    metadata.inst.setFlags(flags);
+    for (uint32_t j = 0; j < nbOperands; j++) {
+      SavedOperandKind kind;
+      int64_t value;
+      if (not readValue(is, kind) or not readValue(is, value)) {
+        return false;
+      }
+      if (kind == SavedReg) {
+        metadata.inst.addOperand(
+            llvm::MCOperand::createReg(static_cast<unsigned>(value)));
+      } else if (kind == SavedImm) {
+        metadata.inst.addOperand(llvm::MCOperand::createImm(value));
+      } else {
+        return false;
+      }
+    }
+    instMetadata.push_back(std::move(metadata));
+  }
+  if (not readValue(is, isFull) or not readValue(is, returnStack)) {
+    return false;
+  }
+
+  // Check the consistency of the registries
+  for (const InstInfo &info : instRegistry) {
+    if (info.seqID >= seqRegistry.size() or info.offset >= codeEnd or
+        info.shadowOffset + info.shadowSize > shadowRegistry.size() or
+        info.tagOffset + info.tagSize > tagRegistry.size()) {
+      return false;
+    }
+  }
+  for (const SeqInfo &seq : seqRegistry) {
+    if (seq.startInstID > seq.endInstID or seq.endInstID >= nbInst or
+        (seq.linkShadow != NOT_FOUND and seq.linkShadow >= shadowIdx) or
+        (seq.cacheShadow != NOT_FOUND and
+         seq.cacheShadow + INDIRECT_CACHE_SIZE > shadowIdx) or
+        (seq.returnShadow != NOT_FOUND and seq.returnShadow >= shadowIdx)) {
+      return false;
+    }
+  }
+  if (returnStack != NOT_FOUND and
+      returnStack + RETURN_STACK_SIZE > shadowIdx) {
+    return false;
+  }
+
+  // The links and the inline caches target the previous location of the
+  // ExecBlock: reset them and link the sequences again
+  currentSeq = 0;
+  currentInst = 0;
+  unlinkSequences();
+  for (size_t i = 0; i < seqRegistry.size(); i++) {
+    linkSequence(static_cast<uint16_t>(i));
+  }
+  return true;
+}
+
 } // namespace QBDI
@@ -18,7 +18,10 @@
 #ifndef EXECBLOCK_H
 #define EXECBLOCK_H
 
+#include <istream>
+#include <map>
 #include <memory>
+#include <ostream>
 #include <stdint.h>
 #include <vector>
 
@@ -50,6 +53,7 @@ class MCInst;
 
 namespace QBDI {
 
+class AddressTable;
 class LLVMCPUs;
 class LLVMCPU;
 class RelocatableInst;
@@ -65,6 +69,9 @@ struct InstInfo {
   uint16_t shadowSize;
   uint16_t tagOffset;
   uint16_t tagSize;
+  // executeFlags needed by the end of the sequence when the execution resumes
+  // at this instruction after a callback
+  uint8_t resumeFlags;
 };
 
 struct SeqInfo {
@@ -73,6 +80,10 @@ struct SeqInfo {
   uint8_t executeFlags;
   CPUMode cpuMode;
   ScratchRegisterSeqInfo sr;
+  uint16_t linkShadow;
+  rword linkTarget;
+  uint16_t cacheShadow;
+  uint16_t returnShadow;
 };
 
 struct SeqWriteResult {
@@ -92,8 +103,22 @@ struct TagInfo {
   uint16_t offset;
 };
 
+struct CallbackSlotInfo {
+  uint32_t ruleID;
+  uint16_t jumpShadow;
+  uint16_t cbkShadow;
+  uint16_t dataShadow;
+  uint16_t bodyOffset;
+  uint16_t endOffset;
+  bool enabled;
+};
+
 static const uint16_t EXEC_BLOCK_FULL = 0xFFFF;
 
+// Maximal size of the code block of an ExecBlock. The offsets in the code
+// block are stored on 16 bits.
+static const uint32_t EXEC_BLOCK_MAX_CODE_SIZE = 1 << 16;
+
 /*! Manages the concept of an exec block made of two contiguous memory blocks
  * (one for the code, the other for the data) used to store and execute
  * instrumented basic blocks.
@@ -123,6 +148,12 @@ private:
   uint32_t epilogueSize;
   bool isFull;
   ScratchRegisterInfo srInfo;
+  std::map<rword, std::vector<uint16_t>> pendingLinks;
+  std::map<rword, std::vector<uint16_t>> pendingReturns;
+  uint16_t returnStack;
+  std::vector<uint32_t> seqCounters;
+  uint64_t lastAccess;
+  std::vector<CallbackSlotInfo> callbackSlots;
 
   /*! Verify if the code block is in read execute mode.
    *
@@ -147,10 +178,26 @@ private:
   void initScratchRegisterForPatch(std::vector<Patch>::const_iterator seqStart,
                                    std::vector<Patch>::const_iterator seqEnd);
 
-  bool writePatch(const Patch &p, const LLVMCPU &llvmcpu);
+  bool writePatch(const Patch &p, const LLVMCPU &llvmcpu, rword guardTarget);
 
   void finalizeScratchRegisterForPatch();
 
+  void resetIndirectCache(uint16_t cacheShadow);
+
+  void resetReturnStack();
+
+  void updateCallbackSlot(const CallbackSlotInfo &slot);
+
+  // Offsets and values of the absolute immediates of the code (movabs), which
+  // are relocated when the ExecBlock is saved
+  bool getAbsoluteImmediates(
+      std::vector<std::pair<uint32_t, rword>> &immediates) const;
+
+  rword getEpilogueAddress() const {
+    return reinterpret_cast<rword>(codeBlock.base()) +
+           codeBlock.allocatedSize() - epilogueSize;
+  }
+
 public:
   /*! Construct a new ExecBlock
    *
@@ -160,6 +207,12 @@ public:
    * @param[in] execBlockPrologue  cached prologue of ExecManager
    * @param[in] execBlockEpilogue  cached epilogue of ExecManager
    * @param[in] epilogueSize       size in bytes of the epilogue (0 is not know)
+   * @param[in] pageCount          number of pages of the code block and of the
+   *                               data block
+   * @param[in] sharedContext      context of another ExecBlock to use instead
+   *                               of the context of the data block (nullptr
+   *                               to use its own context). The other ExecBlock
+   *                               must outlive this one.
    */
   ExecBlock(
       const LLVMCPUs &llvmCPUs, VMInstanceRef vminstance = nullptr,
@@ -167,7 +220,8 @@ public:
           nullptr,
       const std::vector<std::unique_ptr<RelocatableInst>> *execBlockEpilogue =
           nullptr,
-      uint32_t epilogueSize = 0);
+      uint32_t epilogueSize = 0, uint32_t pageCount = 1,
+      Context *sharedContext = nullptr);
 
   ~ExecBlock();
 
@@ -212,6 +266,83 @@ public:
    */
   uint16_t splitSequence(uint16_t instID);
 
+  /*! Link the sequences which exit to the start of a sequence. The linked
+   * sequences jump directly to this sequence instead of returning to the VM.
+   * A sequence is only linked when the target sequence doesn't need more
+   * executeFlags than itself.
+   *
+   * @param seqID  [in] ID of the sequence to link to.
+   */
+  void linkSequence(uint16_t seqID);
+
+  /*! Add a sequence to the inline cache of the indirect exit of another
+   * sequence. The next time the exit targets the address of the sequence, it
+   * jumps directly to it instead of returning to the VM.
+   *
+   * @param fromSeqID  [in] ID of the sequence with an indirect exit.
+   * @param toSeqID    [in] ID of the sequence reached by the exit.
+   */
+  void linkIndirect(uint16_t fromSeqID, uint16_t toSeqID);
+
+  /*! Remove all the links and clear the inline caches of the ExecBlock. Every
+   * sequence returns to the VM at its end.
+   */
+  void unlinkSequences();
+
+  /*! Pop the top entry of the shadow return stack if it matches an address.
+   * Used when a call returns without executing a return of the ExecBlock
+   * (execution transfer or return from another ExecBlock).
+   *
+   * @param address  [in] The address reached by the return.
+   */
+  void popReturnStack(rword address);
+
+  /*! Count an execution of a sequence started by the VM. Used to detect the
+   * hot sequences (OPT_ENABLE_TRACES).
+   *
+   * @param seqID  [in] ID of the sequence.
+   *
+   * @return The number of executions of the sequence, or 0 if its counter is
+   *         disabled.
+   */
+  uint32_t countSequence(uint16_t seqID);
+
+  /*! Disable the counter of a sequence. The traces don't start another trace.
+   *
+   * @param seqID  [in] ID of the sequence.
+   */
+  void disableCounter(uint16_t seqID);
+
+  /*! Allocate the shadows of a new callback slot for the current instruction
+   * (OPT_ENABLE_CALLBACK_SLOTS). Used by the relocation of the slot.
+   *
+   * @param cbk        [in] The callback of the slot.
+   * @param data       [in] The data of the callback.
+   * @param enabled    [in] Whether the callback is enabled.
+   * @param ruleIndex  [in] Index of the rule of the slot in the rules applied
+   *                        on the instruction.
+   *
+   * @return The ID of the shadow which holds the target of the jump that
+   *         starts the slot.
+   */
+  uint16_t newCallbackSlot(rword cbk, rword data, bool enabled,
+                           uint16_t ruleIndex);
+
+  /*! Enable or disable the callback slots of an instrumentation rule. A
+   * disabled slot jumps over its callback.
+   *
+   * @param ruleID   [in] The ID of the instrumentation rule.
+   * @param enabled  [in] Whether the callback is enabled.
+   */
+  void setCallbackEnabled(uint32_t ruleID, bool enabled);
+
+  /*! Change the data of the callback slots of an instrumentation rule.
+   *
+   * @param ruleID  [in] The ID of the instrumentation rule.
+   * @param data    [in] The new data of the callback.
+   */
+  void setCallbackData(uint32_t ruleID, rword data);
+
   /*! Get the address of the DataBlock
    *
    * @return The DataBlock offset.
@@ -220,13 +351,33 @@ public:
     return reinterpret_cast<rword>(dataBlock.base());
   }
 
-  /*! Compute the offset between the current code stream position and the start
-   * of the data block. Used for pc relative memory access to the data block.
+  /*! Get the address of a location in the data block. The locations of the
+   * context are redirected to the shared context, if any.
+   *
+   * @param[in] offset  The offset of the location in the data block.
+   *
+   * @return The address of the location.
+   */
+  rword getDataBlockAddress(rword offset) const;
+
+  /*! Compute the offset between the current code stream position and a
+   * location in the data block. Used for pc relative memory access to the data
+   * block.
+   *
+   * @param[in] offset  The offset of the location in the data block.
    *
    * @return The computed offset.
    */
-  rword getDataBlockOffset() const {
-    return codeBlock.allocatedSize() - codeStream->current_pos();
+  rword getDataBlockOffset(rword offset) const {
+    return getDataBlockAddress(offset) -
+           (reinterpret_cast<rword>(codeBlock.base()) +
+            codeStream->current_pos());
+  }
+
+  /*! Return true if the context is shared with another ExecBlock.
+   */
+  bool hasSharedContext() const {
+    return reinterpret_cast<void *>(context) != dataBlock.base();
   }
 
   /*! Compute the offset between the current code stream position and the start
@@ -239,6 +390,20 @@ public:
     return codeBlock.allocatedSize() - epilogueSize - codeStream->current_pos();
   }
 
+  /*! Get the size of the code block
+   *
+   * @return The size in bytes of the code block.
+   */
+  rword getCodeSize() const { return codeBlock.allocatedSize(); }
+
+  /*! Get the size of the memory mapped by the ExecBlock
+   *
+   * @return The size in bytes of the code block and the data block.
+   */
+  rword getMappedSize() const {
+    return codeBlock.allocatedSize() + dataBlock.allocatedSize();
+  }
+
   /*! Get the size of the epilogue
    *
    * @return The size of the epilogue.
@@ -483,9 +648,60 @@ public:
    */
   float occupationRatio() const;
 
+  /*! Date of the last lookup of a sequence of the ExecBlock, used to evict the
+   * least recently executed regions of the cache.
+   */
+  uint64_t getLastAccess() const { return lastAccess; }
+
+  void setLastAccess(uint64_t date) { lastAccess = date; }
+
   const ScratchRegisterInfo &getScratchRegisterInfo() const { return srInfo; }
+
+  /*! Write the instrumented code of the ExecBlock, its shadows and its
+   * registries in a binary stream. The ExecBlock mustn't use a shared context.
+   * The links and the inline caches aren't saved.
+   *
+   * @param[in] os     The stream.
+   * @param[in] base   The addresses of the instructions are saved relative to
+   *                   this base.
+   * @param[in] table  The absolute addresses of the code are saved as
+   *                   locations of this table (nullptr to keep them as is).
+   *
+   * @return False if the ExecBlock cannot be saved. Nothing is written in the
+   * stream in this case.
+   */
+  bool save(std::ostream &os, rword base, AddressTable *table) const;
+
+  /*! Restore an ExecBlock written with save. The ExecBlock must be empty and
+   * have the same size as the saved one.
+   *
+   * @param[in] is     The stream.
+   * @param[in] base   The base of the addresses of the instructions.
+   * @param[in] table  The table used to relocate the absolute addresses of the
+   *                   code (nullptr if they were kept as is).
+   *
+   * @return False if the data are invalid or cannot be relocated. The
+   * ExecBlock cannot be used in this case.
+   */
+  bool load(std::istream &is, rword base, const AddressTable *table);
 };
 
+/*! Update the FPRState of a context with the state written in its XSAVE area
+ * by the last context switch, if any. Must be called before the host reads or
+ * writes the FPRState of the context.
+ *
+ * @param[in] context  The context.
+ */
+void loadContextFPR(Context *context);
+
+/*! Set the FPRState of a context. The next context switch converts it in the
+ * XSAVE area of the context if needed.
+ *
+ * @param[in] context   The context.
+ * @param[in] fprState  The new FPRState.
+ */
+void setContextFPR(Context *context, const FPRState *fprState);
+
 } // namespace QBDI
 
 #endif // EXECBLOCK_H
@@ -17,33 +17,43 @@
  */
 #include <algorithm>
 #include <iterator>
+#include <sstream>
 #include <stdlib.h>
+#include <string>
 #include <utility>
 
 #include "Engine/LLVMCPU.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/ExecBlockManager.h"
+#include "ExecBlock/SharedCache.h"
 #include "ExecBroker/ExecBroker.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/Patch.h"
 #include "Patch/PatchRules.h"
 #include "Patch/RelocatableInst.h"
 #include "Utility/LogSys.h"
+#include "Utility/Module.h"
+#include "Utility/Serialize.h"
+
+#include "QBDI/Memory.hpp"
 
 namespace QBDI {
 
 ExecBlockManager::ExecBlockManager(const LLVMCPUs &llvmCPUs,
                                    VMInstanceRef vminstance)
-    : total_translated_size(1), total_translation_size(1),
-      vminstance(vminstance), llvmCPUs(llvmCPUs),
+    : total_translated_size(1), total_translation_size(1), needFlush(false),
+      dispatchCacheStats({0, 0}), cacheBudget(0), evictionStats({0, 0}),
+      accessClock(0), vminstance(vminstance), llvmCPUs(llvmCPUs),
       execBlockPrologue(getExecBlockPrologue(llvmCPUs.getOptions())),
       execBlockEpilogue(getExecBlockEpilogue(llvmCPUs.getOptions())) {
 
   auto execBrokerBlock = std::make_unique<ExecBlock>(
       llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue, 0);
   epilogueSize = execBrokerBlock->getEpilogueSize();
+  pageSize = execBrokerBlock->getCodeSize();
   execBroker = std::make_unique<ExecBroker>(std::move(execBrokerBlock),
                                             llvmCPUs, vminstance);
+  clearDispatchCache();
 }
 
 ExecBlockManager::~ExecBlockManager() {
@@ -73,8 +83,10 @@ void ExecBlockManager::printCacheStatistics() const {
   QBDI_DEBUG("\tCache made of {} regions:", regions.size());
   for (size_t i = 0; i < regions.size(); i++) {
     float occupation = 0.0;
+    rword codeSize = 0;
     for (size_t j = 0; j < regions[i].blocks.size(); j++) {
       occupation += regions[i].blocks[j]->occupationRatio();
+      codeSize += regions[i].blocks[j]->getCodeSize();
     }
     if (regions[i].blocks.size() > 1) {
       region_overflow += 1;
@@ -83,72 +95,100 @@ void ExecBlockManager::printCacheStatistics() const {
       occupation /= regions[i].blocks.size();
     }
     mean_occupation += occupation;
-    QBDI_DEBUG("\t\t[0x{:x}, 0x{:x}]: {} blocks, {} occupation ratio",
-               regions[i].covered.start(), regions[i].covered.end(),
-               regions[i].blocks.size(), occupation);
+    QBDI_DEBUG(
+        "\t\t[0x{:x}, 0x{:x}]: {} blocks ({} bytes), {} occupation ratio",
+        regions[i].covered.start(), regions[i].covered.end(),
+        regions[i].blocks.size(), codeSize, occupation);
   }
   if (regions.size() > 0) {
     mean_occupation /= regions.size();
   }
   QBDI_DEBUG("\tMean occupation ratio: {}", mean_occupation);
   QBDI_DEBUG("\tRegion overflow count: {}", region_overflow);
+  QBDI_DEBUG("\tDispatch cache: {} hits, {} misses", dispatchCacheStats.hit,
+             dispatchCacheStats.miss);
+  QBDI_DEBUG("\tEvicted regions: {} ({} bytes)", evictionStats.regions,
+             evictionStats.size);
+}
+
+void ExecBlockManager::clearDispatchCache() {
+  dispatchCache.fill(DispatchCacheEntry{0, nullptr, {}});
 }
 
 ExecBlock *ExecBlockManager::getProgrammedExecBlock(rword address,
                                                     SeqLoc *programmedSeqLock) {
   QBDI_DEBUG("Looking up sequence at address {:x}", address);
 
+  // Attempting dispatch cache resolution
+  DispatchCacheEntry &entry = getDispatchCacheEntry(address);
+  accessClock++;
+  if (entry.address == address and entry.block != nullptr) {
+    dispatchCacheStats.hit++;
+    entry.block->setLastAccess(accessClock);
+    // copy current sequence info
+    if (programmedSeqLock != nullptr) {
+      *programmedSeqLock = entry.seqLoc;
+    }
+    entry.block->selectSeq(entry.seqLoc.seqID);
+    return entry.block;
+  }
+  dispatchCacheStats.miss++;
+
   size_t r = searchRegion(address);
 
   if (r < regions.size() && regions[r].covered.contains(address)) {
     ExecRegion &region = regions[r];
 
     // Attempting sequenceCache resolution
-    const std::map<rword, SeqLoc>::const_iterator seqLoc =
-        region.sequenceCache.find(address);
-    if (seqLoc != region.sequenceCache.end()) {
-      QBDI_DEBUG("Found sequence 0x{:x} in ExecBlock 0x{:x} as seqID {:x}",
-                 address,
-                 reinterpret_cast<uintptr_t>(
-                     region.blocks[seqLoc->second.blockIdx].get()),
-                 seqLoc->second.seqID);
+    const SeqLoc *seqLoc = region.sequenceCache.find(address);
+    if (seqLoc != nullptr) {
+      QBDI_DEBUG(
+          "Found sequence 0x{:x} in ExecBlock 0x{:x} as seqID {:x}", address,
+          reinterpret_cast<uintptr_t>(region.blocks[seqLoc->blockIdx].get()),
+          seqLoc->seqID);
       // copy current sequence info
       if (programmedSeqLock != nullptr) {
-        *programmedSeqLock = seqLoc->second;
+        *programmedSeqLock = *seqLoc;
       }
       // Select sequence and return execBlock
-      region.blocks[seqLoc->second.blockIdx]->selectSeq(seqLoc->second.seqID);
-      return region.blocks[seqLoc->second.blockIdx].get();
+      ExecBlock *block = region.blocks[seqLoc->blockIdx].get();
+      entry = DispatchCacheEntry{address, block, *seqLoc};
+      block->setLastAccess(accessClock);
+      block->selectSeq(seqLoc->seqID);
+      return block;
     }
 
     // Attempting instCache resolution
-    const std::map<rword, InstLoc>::const_iterator instLoc =
-        region.instCache.find(address);
-    if (instLoc != region.instCache.end()) {
+    const InstLoc *instLoc = region.instCache.find(address);
+    if (instLoc != nullptr) {
       // Retrieving corresponding block and seqLoc
-      ExecBlock *block = region.blocks[instLoc->second.blockIdx].get();
-      uint16_t existingSeqId = block->getSeqID(instLoc->second.instID);
-      const SeqLoc &existingSeqLoc =
+      ExecBlock *block = region.blocks[instLoc->blockIdx].get();
+      uint16_t existingSeqId = block->getSeqID(instLoc->instID);
+      // copy the SeqLoc, the insertion of the new sequence may move it
+      const SeqLoc existingSeqLoc =
           region.sequenceCache[block
                                    ->getInstMetadata(
                                        block->getSeqStart(existingSeqId))
                                    .address];
       // Creating a new sequence at that instruction and
       // saving it in the sequenceCache
-      uint16_t newSeqID = block->splitSequence(instLoc->second.instID);
-      regions[r].sequenceCache[address] = SeqLoc{
-          instLoc->second.blockIdx, newSeqID, existingSeqLoc.bbEnd, address,
+      uint16_t newSeqID = block->splitSequence(instLoc->instID);
+      SeqLoc &newSeqLoc = region.sequenceCache[address];
+      newSeqLoc = SeqLoc{
+          instLoc->blockIdx, newSeqID, existingSeqLoc.bbEnd, address,
           existingSeqLoc.seqEnd,
       };
       QBDI_DEBUG(
           "Splitted seqID {:x} at instID {:x} in ExecBlock 0x{:x} as new "
           "sequence with seqID {:x}",
-          existingSeqId, instLoc->second.instID,
-          reinterpret_cast<uintptr_t>(block), newSeqID);
+          existingSeqId, instLoc->instID, reinterpret_cast<uintptr_t>(block),
+          newSeqID);
+      entry = DispatchCacheEntry{address, block, newSeqLoc};
       // copy current sequence info
       if (programmedSeqLock != nullptr) {
-        *programmedSeqLock = regions[r].sequenceCache[address];
+        *programmedSeqLock = newSeqLoc;
       }
+      block->setLastAccess(accessClock);
       block->selectSeq(newSeqID);
       return block;
     }
@@ -166,13 +206,12 @@ const ExecBlock *ExecBlockManager::getExecBlock(rword address) const {
     const ExecRegion &region = regions[r];
 
     // Attempting instCache resolution
-    const std::map<rword, InstLoc>::const_iterator instLoc =
-        region.instCache.find(address);
-    if (instLoc != region.instCache.end()) {
-      QBDI_DEBUG("Found address 0x{:x} in ExecBlock 0x{:x}", address,
-                 reinterpret_cast<uintptr_t>(
-                     region.blocks[instLoc->second.blockIdx].get()));
-      return region.blocks[instLoc->second.blockIdx].get();
+    const InstLoc *instLoc = region.instCache.find(address);
+    if (instLoc != nullptr) {
+      QBDI_DEBUG(
+          "Found address 0x{:x} in ExecBlock 0x{:x}", address,
+          reinterpret_cast<uintptr_t>(region.blocks[instLoc->blockIdx].get()));
+      return region.blocks[instLoc->blockIdx].get();
     }
   }
   QBDI_DEBUG("Cache miss for address 0x{:x}", address);
@@ -182,11 +221,7 @@ const ExecBlock *ExecBlockManager::getExecBlock(rword address) const {
 const SeqLoc *ExecBlockManager::getSeqLoc(rword address) const {
   size_t r = searchRegion(address);
   if (r < regions.size() && regions[r].covered.contains(address)) {
-    const std::map<rword, SeqLoc>::const_iterator seqLoc =
-        regions[r].sequenceCache.find(address);
-    if (seqLoc != regions[r].sequenceCache.end()) {
-      return &(seqLoc->second);
-    }
+    return regions[r].sequenceCache.find(address);
   }
   return nullptr;
 }
@@ -218,6 +253,7 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
   unsigned translated = 0;
   unsigned translation = 0;
   size_t patchIdx = 0;
+  bool newBlock = false;
   const Patch &firstPatch = basicBlock.front();
   const Patch &lastPatch = basicBlock.back();
   rword bbStart = firstPatch.metadata.address;
@@ -250,6 +286,7 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
     return;
   }
   QBDI_DEBUG("Writting new basic block 0x{:x}", firstPatch.metadata.address);
+  region.instCache.reserve(region.instCache.size() + patchEnd);
 
   // Writing the basic block as one or more sequences
   while (patchIdx < patchEnd) {
@@ -260,9 +297,14 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
       // or oversized basic blocks can cause overflows.
       if (i >= region.blocks.size()) {
         QBDI_REQUIRE_ACTION(i < (1 << 16), abort());
+        // The ExecBlocks of a region share the context of the first one, to
+        // avoid a copy of the state when the execution moves between them.
+        Context *sharedContext =
+            region.blocks.empty() ? nullptr : region.blocks[0]->getContext();
         region.blocks.emplace_back(std::make_unique<ExecBlock>(
             llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue,
-            epilogueSize));
+            epilogueSize, getNewBlockPageCount(region), sharedContext));
+        newBlock = true;
       }
       // Write sequence
       SeqWriteResult res = region.blocks[i]->writeSequence(
@@ -293,6 +335,8 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
             basicBlock[patchIdx].metadata.address,
             basicBlock[patchIdx + res.patchWritten - 1].metadata.endAddress(),
             reinterpret_cast<uintptr_t>(region.blocks[i].get()), res.seqID);
+        // A new sequence is expected to be executed soon
+        region.blocks[i]->setLastAccess(accessClock);
         // Updating counters
         translated +=
             basicBlock[patchIdx + res.patchWritten - 1].metadata.endAddress() -
@@ -307,6 +351,123 @@ void ExecBlockManager::writeBasicBlock(std::vector<Patch> &&basicBlock,
   total_translation_size += translation;
   total_translated_size += translated;
   updateRegionStat(r, translated);
+  if (newBlock and cacheBudget != 0) {
+    evictRegions(r);
+  }
+}
+
+bool ExecBlockManager::writeTrace(std::vector<Patch> &&trace) {
+  QBDI_REQUIRE_ACTION(not trace.empty(), return false);
+  rword head = trace.front().metadata.address;
+
+  size_t r = searchRegion(head);
+  if (r >= regions.size() or not regions[r].covered.contains(head)) {
+    QBDI_DEBUG("Region of trace 0x{:x} not found", head);
+    return false;
+  }
+  ExecRegion &region = regions[r];
+
+  // The trace is confined to the region of its head, it is truncated at the
+  // first instruction outside of the region.
+  size_t patchEnd = 0;
+  while (patchEnd < trace.size() and
+         region.covered.contains(
+             Range<rword>{trace[patchEnd].metadata.address,
+                          trace[patchEnd].metadata.endAddress()})) {
+    patchEnd++;
+  }
+  if (patchEnd == 0) {
+    return false;
+  }
+
+  bool newBlock = false;
+  for (size_t i = 0; true; i++) {
+    if (i >= region.blocks.size()) {
+      QBDI_REQUIRE_ACTION(i < (1 << 16), abort());
+      Context *sharedContext =
+          region.blocks.empty() ? nullptr : region.blocks[0]->getContext();
+      region.blocks.emplace_back(std::make_unique<ExecBlock>(
+          llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue,
+          epilogueSize, getNewBlockPageCount(region), sharedContext));
+      newBlock = true;
+    }
+    // The trace is written as a single sequence. It may be shorter than
+    // expected when the ExecBlock is almost full.
+    SeqWriteResult res = region.blocks[i]->writeSequence(
+        trace.begin(), trace.begin() + patchEnd);
+    if (res.seqID == EXEC_BLOCK_FULL) {
+      continue;
+    }
+    rword seqEnd = trace[res.patchWritten - 1].metadata.endAddress();
+    // The trace replaces the sequence of its head. Its instructions aren't
+    // added to the instruction cache, they remain mapped to their basic
+    // blocks.
+    region.sequenceCache[head] =
+        SeqLoc{static_cast<uint16_t>(i), res.seqID, seqEnd, head, seqEnd};
+    for (size_t j = 0; j < res.patchWritten; j++) {
+      std::move(trace[j].userInstCB.begin(), trace[j].userInstCB.end(),
+                std::back_inserter(region.userInstCB));
+      trace[j].userInstCB.clear();
+    }
+    region.blocks[i]->disableCounter(res.seqID);
+    region.blocks[i]->setLastAccess(accessClock);
+    region.published = false;
+    getDispatchCacheEntry(head) = DispatchCacheEntry{0, nullptr, {}};
+    QBDI_DEBUG("Trace 0x{:x}-0x{:x} of {} instructions written in ExecBlock "
+               "0x{:x} as seqID {:x}",
+               head, seqEnd, res.patchWritten,
+               reinterpret_cast<uintptr_t>(region.blocks[i].get()), res.seqID);
+    total_translation_size += res.bytesWritten;
+    if (newBlock and cacheBudget != 0) {
+      evictRegions(r);
+    }
+    return true;
+  }
+}
+
+void ExecBlockManager::evictRegions(size_t keep) {
+  // Size of the regions which aren't already flushed, with the date of their
+  // last execution
+  rword cacheSize = 0;
+  std::vector<std::pair<uint64_t, size_t>> candidates;
+  std::vector<rword> regionSize(regions.size(), 0);
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (regions[i].toFlush) {
+      continue;
+    }
+    uint64_t lastAccess = 0;
+    for (const auto &block : regions[i].blocks) {
+      regionSize[i] += block->getMappedSize();
+      lastAccess = std::max(lastAccess, block->getLastAccess());
+    }
+    cacheSize += regionSize[i];
+    if (i != keep) {
+      candidates.emplace_back(lastAccess, i);
+    }
+  }
+  if (cacheSize <= cacheBudget) {
+    return;
+  }
+  // Evict the coldest regions until a quarter of the budget is free, to avoid
+  // an eviction at each new ExecBlock
+  rword target = cacheBudget - cacheBudget / 4;
+  std::sort(candidates.begin(), candidates.end());
+  for (const auto &candidate : candidates) {
+    if (cacheSize <= target) {
+      break;
+    }
+    ExecRegion &region = regions[candidate.second];
+    QBDI_DEBUG("Evict region [0x{:x}, 0x{:x}] ({} bytes)",
+               region.covered.start(), region.covered.end(),
+               regionSize[candidate.second]);
+    // The region is erased by the next flushCommit, no sequence is linked to
+    // another region
+    region.toFlush = true;
+    needFlush = true;
+    cacheSize -= regionSize[candidate.second];
+    evictionStats.regions++;
+    evictionStats.size += regionSize[candidate.second];
+  }
 }
 
 size_t ExecBlockManager::searchRegion(rword address) const {
@@ -344,19 +505,25 @@ void ExecBlockManager::mergeRegion(size_t i) {
   QBDI_DEBUG("Merge region {} [0x{:x}, 0x{:x}] and region {} [0x{:x}, 0x{:x}]",
              i, regions[i].covered.start(), regions[i].covered.end(), i + 1,
              regions[i + 1].covered.start(), regions[i + 1].covered.end());
+  uint16_t blockOffset = static_cast<uint16_t>(regions[i].blocks.size());
   // SeqLoc
-  for (const auto &it : regions[i + 1].sequenceCache) {
-    regions[i].sequenceCache[it.first] = SeqLoc{
-        static_cast<uint16_t>(it.second.blockIdx + regions[i].blocks.size()),
-        it.second.seqID, it.second.bbEnd, it.second.seqStart, it.second.seqEnd};
-  }
+  regions[i].sequenceCache.reserve(regions[i].sequenceCache.size() +
+                                   regions[i + 1].sequenceCache.size());
+  regions[i + 1].sequenceCache.forEach(
+      [&](rword address, const SeqLoc &seqLoc) {
+        regions[i].sequenceCache[address] =
+            SeqLoc{static_cast<uint16_t>(seqLoc.blockIdx + blockOffset),
+                   seqLoc.seqID, seqLoc.bbEnd, seqLoc.seqStart, seqLoc.seqEnd};
+      });
   // InstLoc
-  for (const auto &it : regions[i + 1].instCache) {
-    regions[i].instCache[it.first] = InstLoc{
-        static_cast<uint16_t>(it.second.blockIdx + regions[i].blocks.size()),
-        it.second.instID,
+  regions[i].instCache.reserve(regions[i].instCache.size() +
+                               regions[i + 1].instCache.size());
+  regions[i + 1].instCache.forEach([&](rword address, const InstLoc &instLoc) {
+    regions[i].instCache[address] = InstLoc{
+        static_cast<uint16_t>(instLoc.blockIdx + blockOffset),
+        instLoc.instID,
     };
-  }
+  });
 
   // range
   regions[i].covered.setEnd(regions[i + 1].covered.end());
@@ -366,8 +533,12 @@ void ExecBlockManager::mergeRegion(size_t i) {
             std::back_inserter(regions[i].blocks));
   // flush
   regions[i].toFlush |= regions[i + 1].toFlush;
+  regions[i].published = false;
 
   regions.erase(regions.begin() + i + 1);
+
+  // the index of the ExecBlocks of the merged region has changed
+  clearDispatchCache();
 }
 
 size_t ExecBlockManager::findRegion(const Range<rword> &codeRange) {
@@ -487,6 +658,7 @@ size_t ExecBlockManager::findRegion(const Range<rword> &codeRange) {
 
 void ExecBlockManager::updateRegionStat(size_t r, rword translated) {
   regions[r].translated += translated;
+  regions[r].published = false;
   // Remaining code block space
   regions[r].available = regions[r].blocks[0]->getEpilogueOffset();
   // Space which needs to be reserved for the non translated part of the covered
@@ -506,6 +678,28 @@ void ExecBlockManager::updateRegionStat(size_t r, rword translated) {
   }
 }
 
+uint32_t
+ExecBlockManager::getNewBlockPageCount(const ExecRegion &region) const {
+  uint32_t maxPageCount =
+      std::max<rword>(1, EXEC_BLOCK_MAX_CODE_SIZE / pageSize);
+  uint32_t pageCount = 1;
+  if (region.blocks.empty()) {
+    // Expected size of the instrumented code of the region
+    rword expected = static_cast<rword>(
+        static_cast<float>(region.covered.size()) * getExpansionRatio());
+    while (pageCount < maxPageCount && pageCount * pageSize < expected) {
+      pageCount <<= 1;
+    }
+  } else {
+    // The region overflows, double the size of its last ExecBlock
+    pageCount = std::min<rword>(
+        maxPageCount, 2 * (region.blocks.back()->getCodeSize() / pageSize));
+  }
+  QBDI_DEBUG("New ExecBlock of {} pages for region [0x{:x}, 0x{:x}]",
+             pageCount, region.covered.start(), region.covered.end());
+  return pageCount;
+}
+
 void ExecBlockManager::clearCache(RangeSet<rword> rangeSet) {
   const std::vector<Range<rword>> &ranges = rangeSet.getRanges();
   for (Range<rword> r : ranges) {
@@ -516,9 +710,15 @@ void ExecBlockManager::clearCache(RangeSet<rword> rangeSet) {
   total_translation_size = 1;
 }
 
-void ExecBlockManager::flushCommit() {
+RangeSet<rword> ExecBlockManager::flushCommit() {
+  RangeSet<rword> flushed;
   // It needs to be erased from last to first to preserve index validity
   if (needFlush) {
+    for (const ExecRegion &r : regions) {
+      if (r.toFlush) {
+        flushed.add(r.covered);
+      }
+    }
     QBDI_DEBUG("Flushing analysis caches");
     regions.erase(std::remove_if(regions.begin(), regions.end(),
                                  [](const ExecRegion &r) -> bool {
@@ -530,7 +730,9 @@ void ExecBlockManager::flushCommit() {
                                  }),
                   regions.end());
     needFlush = false;
+    clearDispatchCache();
   }
+  return flushed;
 }
 
 void ExecBlockManager::clearCache(Range<rword> range) {
@@ -540,6 +742,11 @@ void ExecBlockManager::clearCache(Range<rword> range) {
     if (regions[i].covered.overlaps(range)) {
       regions[i].toFlush = true;
       needFlush = true;
+      // the region may still be executed before the flush, remove the links
+      // to its sequences to return to the VM
+      for (auto &block : regions[i].blocks) {
+        block->unlinkSequences();
+      }
     }
   }
 }
@@ -548,6 +755,7 @@ void ExecBlockManager::clearCache(bool flushNow) {
   QBDI_DEBUG("Erasing all cache");
   if (flushNow) {
     regions.clear();
+    clearDispatchCache();
     total_translated_size = 1;
     total_translation_size = 1;
     needFlush = false;
@@ -556,7 +764,317 @@ void ExecBlockManager::clearCache(bool flushNow) {
       r.toFlush = true;
       needFlush = true;
     }
+    unlinkSequences();
+  }
+}
+
+void ExecBlockManager::unlinkSequences() {
+  QBDI_DEBUG("Remove the links between sequences");
+  for (auto &r : regions) {
+    for (auto &block : r.blocks) {
+      block->unlinkSequences();
+    }
+  }
+}
+
+void ExecBlockManager::setCallbackEnabled(uint32_t ruleID, bool enabled) {
+  for (auto &r : regions) {
+    for (auto &block : r.blocks) {
+      block->setCallbackEnabled(ruleID, enabled);
+    }
+  }
+}
+
+void ExecBlockManager::setCallbackData(uint32_t ruleID, rword data) {
+  for (auto &r : regions) {
+    for (auto &block : r.blocks) {
+      block->setCallbackData(ruleID, data);
+    }
+  }
+}
+
+bool ExecBlockManager::saveRegion(
+    const ExecRegion &region, std::ostream &os, rword base, AddressTable *table,
+    const std::vector<RangeSet<rword>> &ruleRanges) const {
+  // The user callbacks of the region are owned by this cache
+  if (not region.userInstCB.empty()) {
+    return false;
+  }
+  // Save the first ExecBlocks of the region until one of them cannot be
+  // saved. The sequences of the other ExecBlocks will be translated again.
+  std::ostringstream blocks;
+  uint16_t nbBlocks = 0;
+  for (const auto &block : region.blocks) {
+    std::ostringstream data;
+    if (not block->save(data, base, table)) {
+      break;
+    }
+    writeValue(blocks, static_cast<uint32_t>(block->getCodeSize() / pageSize));
+    blocks << data.str();
+    nbBlocks++;
+  }
+  if (nbBlocks == 0) {
+    return false;
+  }
+  std::vector<std::pair<rword, SeqLoc>> sequences;
+  region.sequenceCache.forEach([&](rword address, const SeqLoc &seqLoc) {
+    if (seqLoc.blockIdx < nbBlocks) {
+      sequences.emplace_back(address - base, seqLoc);
+    }
+  });
+  std::vector<std::pair<rword, InstLoc>> insts;
+  region.instCache.forEach([&](rword address, const InstLoc &instLoc) {
+    if (instLoc.blockIdx < nbBlocks) {
+      insts.emplace_back(address - base, instLoc);
+    }
+  });
+
+  writeValue(os, region.translated);
+  writeValue(os, nbBlocks);
+  os << blocks.str();
+  writeVector(os, sequences);
+  writeVector(os, insts);
+  // The ranges of the region instrumented by each rule
+  writeValue(os, static_cast<uint32_t>(ruleRanges.size()));
+  for (const RangeSet<rword> &ranges : ruleRanges) {
+    std::vector<std::pair<rword, rword>> inRegion;
+    for (const Range<rword> &r : ranges.getRanges()) {
+      if (r.overlaps(region.covered)) {
+        Range<rword> part = r.intersect(region.covered);
+        inRegion.emplace_back(part.start() - base, part.end() - base);
+      }
+    }
+    writeVector(os, inRegion);
+  }
+  return true;
+}
+
+bool ExecBlockManager::loadRegion(std::istream &is, ExecRegion &region,
+                                  rword base, const AddressTable *table,
+                                  std::vector<RangeSet<rword>> &ruleRanges) {
+  uint16_t nbBlocks;
+  if (not readValue(is, region.translated) or not readValue(is, nbBlocks)) {
+    return false;
+  }
+  for (uint16_t i = 0; i < nbBlocks; i++) {
+    uint32_t pageCount;
+    if (not readValue(is, pageCount) or pageCount == 0 or
+        pageCount * pageSize > EXEC_BLOCK_MAX_CODE_SIZE) {
+      return false;
+    }
+    region.blocks.emplace_back(std::make_unique<ExecBlock>(
+        llvmCPUs, vminstance, &execBlockPrologue, &execBlockEpilogue,
+        epilogueSize, pageCount));
+    if (not region.blocks.back()->load(is, base, table)) {
+      return false;
+    }
+  }
+  std::vector<std::pair<rword, SeqLoc>> sequences;
+  std::vector<std::pair<rword, InstLoc>> insts;
+  if (not readVector(is, sequences) or not readVector(is, insts)) {
+    return false;
+  }
+  region.sequenceCache.reserve(sequences.size());
+  for (const auto &seq : sequences) {
+    const SeqLoc &seqLoc = seq.second;
+    if (seqLoc.blockIdx >= nbBlocks or
+        seqLoc.seqID >= region.blocks[seqLoc.blockIdx]->getNextSeqID()) {
+      return false;
+    }
+    region.sequenceCache[seq.first + base] = seq.second;
+  }
+  region.instCache.reserve(insts.size());
+  for (const auto &inst : insts) {
+    const InstLoc &instLoc = inst.second;
+    if (instLoc.blockIdx >= nbBlocks or
+        instLoc.instID >= region.blocks[instLoc.blockIdx]->getNextInstID()) {
+      return false;
+    }
+    region.instCache[inst.first + base] = inst.second;
+  }
+  uint32_t nbRules;
+  if (not readValue(is, nbRules) or nbRules != ruleRanges.size()) {
+    return false;
+  }
+  std::vector<RangeSet<rword>> loaded(nbRules);
+  for (uint32_t i = 0; i < nbRules; i++) {
+    std::vector<std::pair<rword, rword>> inRegion;
+    if (not readVector(is, inRegion)) {
+      return false;
+    }
+    for (const auto &r : inRegion) {
+      if (r.first >= r.second or
+          not region.covered.contains(
+              Range<rword>(r.first + base, r.second + base))) {
+        return false;
+      }
+      loaded[i].add(Range<rword>(r.first + base, r.second + base));
+    }
+  }
+  for (uint32_t i = 0; i < nbRules; i++) {
+    ruleRanges[i].add(loaded[i]);
+  }
+  return true;
+}
+
+bool ExecBlockManager::findInsertion(const Range<rword> &covered,
+                                     size_t &insert) const {
+  insert = 0;
+  while (insert < regions.size() and
+         regions[insert].covered.start() < covered.start()) {
+    insert++;
+  }
+  return not((insert < regions.size() and
+              regions[insert].covered.overlaps(covered)) or
+             (insert > 0 and regions[insert - 1].covered.overlaps(covered)));
+}
+
+size_t ExecBlockManager::saveTranslationCache(
+    std::ostream &os, AddressTable &table,
+    const std::vector<RangeSet<rword>> &ruleRanges) const {
+  std::vector<std::string> records;
+
+  for (const ExecRegion &region : regions) {
+    // The region is saved relative to its module
+    AddressLocation start, last;
+    if (region.toFlush or
+        not table.getLocation(region.covered.start(), start) or
+        not table.getLocation(region.covered.end() - 1, last) or
+        start.owned or last.owned or start.index != last.index) {
+      continue;
+    }
+    std::ostringstream data;
+    if (not saveRegion(region, data, region.covered.start() - start.offset,
+                       &table, ruleRanges)) {
+      continue;
+    }
+
+    std::ostringstream record;
+    writeValue(record, start.index);
+    writeValue(record, start.offset);
+    writeValue(record, region.covered.size());
+    record << data.str();
+    records.push_back(record.str());
+  }
+
+  // The modules referenced by the regions are known once they are saved
+  table.save(os);
+  writeValue(os, static_cast<uint32_t>(records.size()));
+  for (const std::string &record : records) {
+    writeString(os, record);
+  }
+  QBDI_DEBUG("Save {} regions in the translation cache", records.size());
+  return records.size();
+}
+
+size_t ExecBlockManager::loadTranslationCache(
+    std::istream &is, AddressTable &table, const RangeSet<rword> &instrumented,
+    std::vector<RangeSet<rword>> &ruleRanges) {
+  uint32_t nbRecords;
+  size_t loaded = 0;
+
+  if (not table.load(is) or not readValue(is, nbRecords)) {
+    return 0;
+  }
+  for (uint32_t r = 0; r < nbRecords; r++) {
+    std::string data;
+    if (not readString(is, data, 1 << 28)) {
+      QBDI_WARN("Truncated translation cache");
+      break;
+    }
+    std::istringstream record(data);
+
+    // The region is relocated at the current address of its module
+    AddressLocation loc{false, 0, 0};
+    rword size, start, last;
+    if (not readValue(record, loc.index) or not readValue(record, loc.offset) or
+        not readValue(record, size) or size == 0 or
+        loc.offset + size < loc.offset) {
+      QBDI_WARN("Invalid region in the translation cache");
+      continue;
+    }
+    if (not table.getAddress(loc, start) or
+        not table.getAddress({false, loc.index, loc.offset + size - 1},
+                             last)) {
+      QBDI_DEBUG("The module of a region isn't loaded or has changed");
+      continue;
+    }
+    rword end = last + 1;
+    Range<rword> covered(start, end);
+    if (not instrumented.contains(covered)) {
+      QBDI_DEBUG("Region [0x{:x}, 0x{:x}] isn't instrumented", start, end);
+      continue;
+    }
+    size_t insert;
+    if (not findInsertion(covered, insert)) {
+      QBDI_DEBUG("Region [0x{:x}, 0x{:x}] is already in the cache", start, end);
+      continue;
+    }
+
+    ExecRegion region{covered, 0, 0, {}};
+    if (not loadRegion(record, region, start - loc.offset, &table,
+                       ruleRanges)) {
+      QBDI_WARN("Invalid region [0x{:x}, 0x{:x}] in the translation cache",
+                start, end);
+      continue;
+    }
+
+    QBDI_DEBUG("Load region [0x{:x}, 0x{:x}] from the translation cache",
+               start, end);
+    regions.insert(regions.begin() + insert, std::move(region));
+    updateRegionStat(insert, 0);
+    loaded++;
+  }
+  clearDispatchCache();
+  return loaded;
+}
+
+size_t ExecBlockManager::publishRegions(
+    SharedCache &cache, uint64_t key,
+    const std::vector<RangeSet<rword>> &ruleRanges) {
+  size_t published = 0;
+  for (ExecRegion &region : regions) {
+    if (region.toFlush or region.published) {
+      continue;
+    }
+    std::ostringstream data;
+    if (saveRegion(region, data, 0, nullptr, ruleRanges)) {
+      cache.publish(key, SharedRegion{region.covered, data.str()});
+      published++;
+    }
+    // A region which cannot be saved is tried again once it has changed
+    region.published = true;
+  }
+  return published;
+}
+
+bool ExecBlockManager::loadSharedRegion(
+    const SharedCache &cache, uint64_t key, rword address,
+    const RangeSet<rword> &instrumented,
+    std::vector<RangeSet<rword>> &ruleRanges) {
+  std::shared_ptr<const SharedRegion> shared = cache.find(key, address);
+  if (shared == nullptr or not instrumented.contains(shared->covered)) {
+    return false;
+  }
+  size_t insert;
+  if (not findInsertion(shared->covered, insert)) {
+    return false;
+  }
+  std::istringstream data(shared->data);
+  ExecRegion region{shared->covered, 0, 0, {}};
+  if (not loadRegion(data, region, 0, nullptr, ruleRanges)) {
+    QBDI_WARN("Invalid region [0x{:x}, 0x{:x}] in the shared cache",
+              shared->covered.start(), shared->covered.end());
+    return false;
   }
+  QBDI_DEBUG("Load region [0x{:x}, 0x{:x}] from the shared cache",
+             shared->covered.start(), shared->covered.end());
+  regions.insert(regions.begin() + insert, std::move(region));
+  updateRegionStat(insert, 0);
+  // The region is already in the shared cache
+  regions[insert].published = true;
+  clearDispatchCache();
+  return true;
 }
 
 } // namespace QBDI
@@ -19,8 +19,10 @@
 #define EXECBLOCKMANAGER_H
 
 #include <algorithm>
-#include <map>
+#include <array>
+#include <istream>
 #include <memory>
+#include <ostream>
 #include <stddef.h>
 #include <stdint.h>
 #include <vector>
@@ -28,14 +30,17 @@
 #include "QBDI/Callback.h"
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
+#include "Utility/AddressMap.h"
 
 namespace QBDI {
 
+class AddressTable;
 class ExecBlock;
 class ExecBroker;
 class LLVMCPUs;
 class Patch;
 class RelocatableInst;
+class SharedCache;
 
 struct InstLoc {
   uint16_t blockIdx;
@@ -55,9 +60,11 @@ struct ExecRegion {
   unsigned translated;
   unsigned available;
   std::vector<std::unique_ptr<ExecBlock>> blocks;
-  std::map<rword, SeqLoc> sequenceCache;
-  std::map<rword, InstLoc> instCache;
+  AddressMap<SeqLoc> sequenceCache;
+  AddressMap<InstLoc> instCache;
   bool toFlush = false;
+  // The region hasn't changed since its publication in the SharedCache
+  bool published = false;
 
   // lambda ptr for user callback set with addInstrRule
   // These pointers should be remove at the same time as the region
@@ -67,6 +74,25 @@ struct ExecRegion {
   ExecRegion &operator=(ExecRegion &&) = default;
 };
 
+struct DispatchCacheEntry {
+  rword address;
+  ExecBlock *block;
+  SeqLoc seqLoc;
+};
+
+struct DispatchCacheStats {
+  uint64_t hit;
+  uint64_t miss;
+};
+
+struct EvictionStats {
+  uint64_t regions;
+  uint64_t size;
+};
+
+// Number of entries of the dispatch cache (must be a power of two)
+static const size_t DISPATCH_CACHE_SIZE = 256;
+
 class ExecBlockManager {
 private:
   std::unique_ptr<ExecBroker> execBroker;
@@ -75,9 +101,24 @@ private:
   rword total_translation_size;
   bool needFlush;
 
+  // direct-mapped cache of the last sequences returned by
+  // getProgrammedExecBlock
+  std::array<DispatchCacheEntry, DISPATCH_CACHE_SIZE> dispatchCache;
+  DispatchCacheStats dispatchCacheStats;
+
+  // maximal size in bytes of the ExecBlocks of the regions (0 if unlimited)
+  rword cacheBudget;
+  EvictionStats evictionStats;
+  // incremented at each lookup, used to date the last execution of the
+  // ExecBlocks
+  uint64_t accessClock;
+
   VMInstanceRef vminstance;
   const LLVMCPUs &llvmCPUs;
 
+  // size of a page of the ExecBlocks
+  rword pageSize;
+
   // cache ExecBlock prologue and epilogue
   uint32_t epilogueSize;
   const std::vector<std::unique_ptr<RelocatableInst>> execBlockPrologue;
@@ -85,14 +126,47 @@ private:
 
   size_t searchRegion(rword start) const;
 
+  inline DispatchCacheEntry &getDispatchCacheEntry(rword address) {
+    // multiplicative hash of the address
+    return dispatchCache[static_cast<size_t>(
+                             (static_cast<uint64_t>(address) *
+                              0x9E3779B97F4A7C15ULL) >>
+                             32) &
+                         (DISPATCH_CACHE_SIZE - 1)];
+  }
+
+  void clearDispatchCache();
+
   void mergeRegion(size_t i);
 
   size_t findRegion(const Range<rword> &codeRange);
 
   void updateRegionStat(size_t r, rword translated);
 
+  uint32_t getNewBlockPageCount(const ExecRegion &region) const;
+
   float getExpansionRatio() const;
 
+  void evictRegions(size_t keep);
+
+  // Write the ExecBlocks and the caches of a region, with the part of the
+  // ranges instrumented by each rule inside the region. The addresses of the
+  // instructions are written relative to base, the absolute addresses of the
+  // code as locations of the table (if any).
+  bool saveRegion(const ExecRegion &region, std::ostream &os, rword base,
+                  AddressTable *table,
+                  const std::vector<RangeSet<rword>> &ruleRanges) const;
+
+  // Read a region written by saveRegion, and add the ranges instrumented by
+  // each rule in the region to ruleRanges
+  bool loadRegion(std::istream &is, ExecRegion &region, rword base,
+                  const AddressTable *table,
+                  std::vector<RangeSet<rword>> &ruleRanges);
+
+  // Find where a new region is inserted. Return false if it overlaps an
+  // existing region.
+  bool findInsertion(const Range<rword> &covered, size_t &insert) const;
+
 public:
   ExecBlockManager(const LLVMCPUs &llvmCPUs,
                    VMInstanceRef vminstance = nullptr);
@@ -107,6 +181,22 @@ public:
 
   void printCacheStatistics() const;
 
+  const DispatchCacheStats &getDispatchCacheStats() const {
+    return dispatchCacheStats;
+  }
+
+  const EvictionStats &getEvictionStats() const { return evictionStats; }
+
+  /*! Set the maximal size of the cache. When a new ExecBlock exceeds it, the
+   * least recently executed regions are flushed at the next flushCommit.
+   *
+   * @param[in] budget  The size in bytes of the code and data blocks of the
+   *                    regions (0 to disable the limit).
+   */
+  void setCacheBudget(rword budget) { cacheBudget = budget; }
+
+  rword getCacheBudget() const { return cacheBudget; }
+
   ExecBlock *getProgrammedExecBlock(rword address,
                                     SeqLoc *programmedSeqLock = nullptr);
 
@@ -118,15 +208,110 @@ public:
 
   void writeBasicBlock(std::vector<Patch> &&basicBlock, size_t patchEnd);
 
+  /*! Write a trace (the patches of consecutive basic blocks) as a single
+   * sequence which replaces the sequence of its first instruction. The basic
+   * blocks of the trace must already be in the cache.
+   *
+   * @param[in] trace  The patches of the trace.
+   *
+   * @return False if the trace wasn't written.
+   */
+  bool writeTrace(std::vector<Patch> &&trace);
+
   bool isFlushPending() { return needFlush; }
 
-  void flushCommit();
+  /*! Erase the regions marked to be flushed.
+   *
+   * @return The ranges covered by the erased regions.
+   */
+  RangeSet<rword> flushCommit();
 
   void clearCache(bool flushNow = true);
 
   void clearCache(Range<rword> range);
 
   void clearCache(RangeSet<rword> rangeSet);
+
+  void unlinkSequences();
+
+  /*! Enable or disable the callback slots of an instrumentation rule in all
+   * the ExecBlocks (OPT_ENABLE_CALLBACK_SLOTS).
+   *
+   * @param[in] ruleID   The ID of the instrumentation rule.
+   * @param[in] enabled  Whether the callback is enabled.
+   */
+  void setCallbackEnabled(uint32_t ruleID, bool enabled);
+
+  /*! Change the data of the callback slots of an instrumentation rule in all
+   * the ExecBlocks (OPT_ENABLE_CALLBACK_SLOTS).
+   *
+   * @param[in] ruleID  The ID of the instrumentation rule.
+   * @param[in] data    The new data of the callback.
+   */
+  void setCallbackData(uint32_t ruleID, rword data);
+
+  /*! Write the regions of the cache in a binary stream. Only the regions of a
+   * loaded module are saved, with the ExecBlocks which don't use a shared
+   * context. The addresses are saved as offsets in their module, or in the
+   * objects of the table owned by the VM.
+   *
+   * @param[in] os          The stream.
+   * @param[in] table       The address table of the configuration of the VM.
+   * @param[in] ruleRanges  The ranges instrumented by each rule, in the order
+   *                        of the rules in the configuration key.
+   *
+   * @return The number of saved regions.
+   */
+  size_t saveTranslationCache(
+      std::ostream &os, AddressTable &table,
+      const std::vector<RangeSet<rword>> &ruleRanges) const;
+
+  /*! Restore the regions written with saveTranslationCache, relocated at the
+   * current address of their module. A region is only restored if its module
+   * is loaded with the same build ID, if it's inside the instrumented range
+   * and if it doesn't overlap an existing region.
+   *
+   * @param[in] is            The stream.
+   * @param[in] table         The address table of the configuration of the VM.
+   * @param[in] instrumented  The instrumented range of the VM.
+   * @param[out] ruleRanges   The ranges instrumented by each rule, in which
+   *                          the ranges of the restored regions are added.
+   *
+   * @return The number of restored regions.
+   */
+  size_t loadTranslationCache(std::istream &is, AddressTable &table,
+                              const RangeSet<rword> &instrumented,
+                              std::vector<RangeSet<rword>> &ruleRanges);
+
+  /*! Publish the regions changed since their last publication in a shared
+   * cache.
+   *
+   * @param[in] cache       The shared cache.
+   * @param[in] key         The configuration key of the engine.
+   * @param[in] ruleRanges  The ranges instrumented by each rule, in the order
+   *                        of the rules in the configuration key.
+   *
+   * @return The number of published regions.
+   */
+  size_t publishRegions(SharedCache &cache, uint64_t key,
+                        const std::vector<RangeSet<rword>> &ruleRanges);
+
+  /*! Load the region of the shared cache which covers an address. The region
+   * is only loaded if it's inside the instrumented range and if it doesn't
+   * overlap an existing region.
+   *
+   * @param[in] cache         The shared cache.
+   * @param[in] key           The configuration key of the engine.
+   * @param[in] address       The address to execute.
+   * @param[in] instrumented  The instrumented range of the VM.
+   * @param[out] ruleRanges   The ranges instrumented by each rule, in which
+   *                          the ranges of the loaded region are added.
+   *
+   * @return True if a region was loaded.
+   */
+  bool loadSharedRegion(const SharedCache &cache, uint64_t key, rword address,
+                        const RangeSet<rword> &instrumented,
+                        std::vector<RangeSet<rword>> &ruleRanges);
 };
 
 } // namespace QBDI
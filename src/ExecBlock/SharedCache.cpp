@@ -0,0 +1,139 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "ExecBlock/SharedCache.h"
+#include "Utility/LogSys.h"
+
+namespace QBDI {
+
+// Number of invalidations kept in a snapshot. An engine which missed older
+// invalidations clears its whole cache.
+static const size_t MAX_INVALIDATIONS = 64;
+
+SharedCache::SharedCache()
+    : snapshot(std::make_shared<const SharedCacheSnapshot>(
+          SharedCacheSnapshot{0, {}, {}})) {}
+
+std::shared_ptr<const SharedRegion> SharedCache::find(uint64_t key,
+                                                      rword address) const {
+  std::shared_ptr<const SharedCacheSnapshot> current = getSnapshot();
+  auto it = current->regions.find(key);
+  if (it == current->regions.end()) {
+    return nullptr;
+  }
+  const std::vector<std::shared_ptr<const SharedRegion>> &regions = it->second;
+  // first region which starts after the address
+  auto r = std::upper_bound(
+      regions.begin(), regions.end(), address,
+      [](rword addr, const std::shared_ptr<const SharedRegion> &region) {
+        return addr < region->covered.start();
+      });
+  if (r == regions.begin()) {
+    return nullptr;
+  }
+  --r;
+  if ((*r)->covered.contains(address)) {
+    return *r;
+  }
+  return nullptr;
+}
+
+void SharedCache::publish(uint64_t key, SharedRegion &&region) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  std::shared_ptr<SharedCacheSnapshot> next =
+      std::make_shared<SharedCacheSnapshot>(*getSnapshot());
+
+  std::vector<std::shared_ptr<const SharedRegion>> &regions =
+      next->regions[key];
+  const Range<rword> covered = region.covered;
+  regions.erase(
+      std::remove_if(regions.begin(), regions.end(),
+                     [&covered](const std::shared_ptr<const SharedRegion> &r) {
+                       return r->covered.overlaps(covered);
+                     }),
+      regions.end());
+  auto insert = std::find_if(
+      regions.begin(), regions.end(),
+      [&covered](const std::shared_ptr<const SharedRegion> &r) {
+        return covered.start() < r->covered.start();
+      });
+  regions.insert(insert,
+                 std::make_shared<const SharedRegion>(std::move(region)));
+
+  QBDI_DEBUG("Publish region [0x{:x}, 0x{:x}] in the shared cache",
+             covered.start(), covered.end());
+  std::atomic_store(&snapshot,
+                    std::shared_ptr<const SharedCacheSnapshot>(next));
+}
+
+void SharedCache::invalidate(const RangeSet<rword> &ranges) {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  std::shared_ptr<SharedCacheSnapshot> next =
+      std::make_shared<SharedCacheSnapshot>(*getSnapshot());
+
+  next->generation++;
+  for (auto &item : next->regions) {
+    std::vector<std::shared_ptr<const SharedRegion>> &regions = item.second;
+    regions.erase(
+        std::remove_if(regions.begin(), regions.end(),
+                       [&ranges](const std::shared_ptr<const SharedRegion> &r) {
+                         for (const Range<rword> &range : ranges.getRanges()) {
+                           if (r->covered.overlaps(range)) {
+                             return true;
+                           }
+                         }
+                         return false;
+                       }),
+        regions.end());
+  }
+  for (const Range<rword> &range : ranges.getRanges()) {
+    next->invalidations.emplace_back(next->generation, range);
+  }
+  if (next->invalidations.size() > MAX_INVALIDATIONS) {
+    next->invalidations.erase(next->invalidations.begin(),
+                              next->invalidations.end() - MAX_INVALIDATIONS);
+  }
+
+  QBDI_DEBUG("Invalidate {} ranges of the shared cache (generation {})",
+             ranges.getRanges().size(), next->generation);
+  std::atomic_store(&snapshot,
+                    std::shared_ptr<const SharedCacheSnapshot>(next));
+}
+
+uint64_t SharedCache::getInvalidations(uint64_t since,
+                                       RangeSet<rword> &ranges) const {
+  std::shared_ptr<const SharedCacheSnapshot> current = getSnapshot();
+  if (since == current->generation) {
+    return since;
+  }
+  // the oldest invalidations after this generation have been dropped
+  if (current->invalidations.empty() or
+      current->invalidations.front().first > since + 1) {
+    ranges.add(Range<rword>(0, static_cast<rword>(-1)));
+    return current->generation;
+  }
+  for (const auto &item : current->invalidations) {
+    if (item.first > since) {
+      ranges.add(item.second);
+    }
+  }
+  return current->generation;
+}
+
+} // namespace QBDI
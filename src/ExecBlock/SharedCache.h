@@ -0,0 +1,116 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SHAREDCACHE_H
+#define SHAREDCACHE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+// A translated region published by an ExecBlockManager
+struct SharedRegion {
+  Range<rword> covered;
+  // The region written by ExecBlockManager::saveRegion
+  std::string data;
+};
+
+// An immutable state of a SharedCache
+struct SharedCacheSnapshot {
+  uint64_t generation;
+  // The regions of each configuration key, sorted and without overlap
+  std::map<uint64_t, std::vector<std::shared_ptr<const SharedRegion>>> regions;
+  // The ranges invalidated by the last generations
+  std::vector<std::pair<uint64_t, Range<rword>>> invalidations;
+};
+
+/*! Translation cache shared by the engines of several threads.
+ *
+ * The engines publish the regions of their cache and load the regions
+ * published by the others instead of translating the code again. A region is
+ * only loaded by an engine with the same configuration key (options and
+ * instrumentation).
+ *
+ * The state of the cache is an immutable snapshot. The readers load the
+ * current snapshot without lock and keep it alive while they use it. The
+ * writers are serialized and publish a modified copy of the snapshot.
+ */
+class SharedCache {
+private:
+  // Accessed with std::atomic_load and std::atomic_store
+  std::shared_ptr<const SharedCacheSnapshot> snapshot;
+
+  // Serialize the writers
+  std::mutex writeMutex;
+
+  inline std::shared_ptr<const SharedCacheSnapshot> getSnapshot() const {
+    return std::atomic_load(&snapshot);
+  }
+
+public:
+  SharedCache();
+
+  SharedCache(const SharedCache &) = delete;
+
+  /*! Find the region which covers an address.
+   *
+   * @param[in] key      The configuration key of the engine
+   * @param[in] address  The address
+   *
+   * @return The region or nullptr.
+   */
+  std::shared_ptr<const SharedRegion> find(uint64_t key, rword address) const;
+
+  /*! Publish a region. The previous regions of the same key that overlap it
+   * are replaced.
+   *
+   * @param[in] key     The configuration key of the engine
+   * @param[in] region  The region
+   */
+  void publish(uint64_t key, SharedRegion &&region);
+
+  /*! Remove the regions of all the keys that overlap a set of ranges. The
+   * engines clear these ranges in their own cache before their next run.
+   *
+   * @param[in] ranges  The invalidated ranges
+   */
+  void invalidate(const RangeSet<rword> &ranges);
+
+  /*! Get the ranges invalidated since a generation.
+   *
+   * @param[in]  since   The generation of the last call
+   * @param[out] ranges  The ranges invalidated after this generation
+   *
+   * @return The current generation.
+   */
+  uint64_t getInvalidations(uint64_t since, RangeSet<rword> &ranges) const;
+
+  inline uint64_t getGeneration() const { return getSnapshot()->generation; }
+};
+
+} // namespace QBDI
+
+#endif // SHAREDCACHE_H
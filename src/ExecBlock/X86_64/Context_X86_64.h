@@ -18,6 +18,9 @@
 #ifndef CONTEXT_X86_64_H
 #define CONTEXT_X86_64_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "QBDI/State.h"
 
 namespace QBDI {
@@ -33,6 +36,23 @@ struct QBDI_ALIGNED(8) HostState {
   rword data;
   rword origin;
   rword executeFlags;
+  rword xsaveValid;
+  rword xsaveMask;
+};
+
+/*! X86_64 XSAVE area (standard format) for the x87, SSE, AVX and AVX-512
+ * components.
+ */
+struct QBDI_ALIGNED(64) XSaveArea {
+  uint8_t legacy[512]; // FXSAVE layout, identical to the start of FPRState
+  uint64_t xstateBV;
+  uint64_t xcompBV;
+  uint8_t reserved[48];
+  uint8_t ymmh[256];     // upper 128 bits of YMM0-15
+  uint8_t mpx[256];      // MPX components, never switched
+  uint8_t opmask[64];    // K0-7
+  uint8_t zmmHi256[512]; // upper 256 bits of ZMM0-15
+  uint8_t hi16Zmm[1024]; // ZMM16-31
 };
 
 /*! X86_64 Execution context.
@@ -42,10 +62,16 @@ struct QBDI_ALIGNED(8) Context {
 public:
   // fprState needs to be first for memory alignement reasons
   FPRState fprState;
+  // Guest FPR when switched with XRSTOR / XSAVEOPT. If hostState.xsaveValid is
+  // set, it is newer than fprState.
+  XSaveArea xsave;
   GPRState gprState;
   HostState hostState;
 };
 
+static_assert(offsetof(Context, xsave) % 64 == 0,
+              "The XSAVE area must be 64 bytes aligned");
+
 } // namespace QBDI
 
 #endif // CONTEXT_X86_64_H
@@ -18,19 +18,27 @@
  */
 #include <memory>
 #include <stdint.h>
+#include <string.h>
 #include <vector>
 
+#include "X86InstrInfo.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
 #include "llvm/Support/Memory.h"
 
 #include "QBDI/Config.h"
+#include "QBDI/Options.h"
 #include "QBDI/State.h"
 #include "Engine/LLVMCPU.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/X86_64/Context_X86_64.h"
 #include "Patch/Patch.h"
 #include "Patch/RelocatableInst.h"
+#include "Patch/X86_64/ExecBlockFlags_X86_64.h"
 #include "Patch/X86_64/PatchRules_X86_64.h"
 #include "Utility/LogSys.h"
+#include "Utility/System.h"
 
 #if defined(QBDI_PLATFORM_WINDOWS)
 extern "C" void qbdi_runCodeBlock(void *codeBlock, QBDI::rword execflags);
@@ -41,6 +49,133 @@ extern void qbdi_runCodeBlock(void *codeBlock,
 
 namespace QBDI {
 
+// Components of the XSAVE area switched with the guest
+static const uint64_t XSTATE_X87 = 1 << 0;
+static const uint64_t XSTATE_SSE = 1 << 1;
+static const uint64_t XSTATE_AVX = 1 << 2;
+static const uint64_t XSTATE_OPMASK = 1 << 5;
+static const uint64_t XSTATE_ZMM_HI256 = 1 << 6;
+static const uint64_t XSTATE_HI16_ZMM = 1 << 7;
+static const uint64_t XSTATE_AVX512 =
+    XSTATE_OPMASK | XSTATE_ZMM_HI256 | XSTATE_HI16_ZMM;
+
+static_assert(offsetof(XSaveArea, ymmh) == 576, "Unexpected XSAVE layout");
+static_assert(offsetof(XSaveArea, opmask) == 1088, "Unexpected XSAVE layout");
+static_assert(offsetof(XSaveArea, zmmHi256) == 1152,
+              "Unexpected XSAVE layout");
+static_assert(offsetof(XSaveArea, hi16Zmm) == 1664, "Unexpected XSAVE layout");
+static_assert(offsetof(FPRState, ymm0) == sizeof(XSaveArea::legacy),
+              "Unexpected FPRState layout");
+
+// Location of a component of the XSAVE area in the FPRState
+struct XSaveComponent {
+  uint64_t feature;
+  size_t xsaveOffset;
+  size_t fprOffset;
+  size_t size;
+};
+
+static const XSaveComponent XSAVE_COMPONENTS[] = {
+#if defined(QBDI_ARCH_X86_64)
+    {XSTATE_AVX, offsetof(XSaveArea, ymmh), offsetof(FPRState, ymm0),
+     offsetof(FPRState, k0) - offsetof(FPRState, ymm0)},
+    {XSTATE_OPMASK, offsetof(XSaveArea, opmask), offsetof(FPRState, k0),
+     sizeof(XSaveArea::opmask)},
+    {XSTATE_ZMM_HI256, offsetof(XSaveArea, zmmHi256), offsetof(FPRState, zmm0),
+     sizeof(XSaveArea::zmmHi256)},
+    {XSTATE_HI16_ZMM, offsetof(XSaveArea, hi16Zmm), offsetof(FPRState, zmm16),
+     sizeof(XSaveArea::hi16Zmm)},
+#else
+    {XSTATE_AVX, offsetof(XSaveArea, ymmh), offsetof(FPRState, ymm0),
+     sizeof(FPRState) - offsetof(FPRState, ymm0)},
+#endif
+};
+
+#if defined(QBDI_ARCH_X86_64)
+static_assert(offsetof(FPRState, zmm16) - offsetof(FPRState, k0) ==
+                  sizeof(XSaveArea::opmask) + sizeof(XSaveArea::zmmHi256),
+              "Unexpected FPRState layout");
+static_assert(sizeof(FPRState) - offsetof(FPRState, zmm16) ==
+                  sizeof(XSaveArea::hi16Zmm),
+              "Unexpected FPRState layout");
+#endif
+
+// Components enabled by the OS. The AVX-512 state isn't part of the FPRState
+// on X86.
+static uint64_t getXSaveFeatures() {
+  static const uint64_t features =
+      XSTATE_X87 | XSTATE_SSE |
+      (isHostCPUFeaturePresent("avx") ? XSTATE_AVX : 0) |
+      ((is_x86_64 and isHostCPUFeaturePresent("avx512f")) ? XSTATE_AVX512 : 0);
+  return features;
+}
+
+static void convertToXSave(Context *context) {
+  const uint8_t *fpr = reinterpret_cast<const uint8_t *>(&context->fprState);
+  uint8_t *xsave = reinterpret_cast<uint8_t *>(&context->xsave);
+  const uint64_t features = getXSaveFeatures();
+
+  memcpy(context->xsave.legacy, fpr, sizeof(context->xsave.legacy));
+  context->xsave.xstateBV = features;
+  context->xsave.xcompBV = 0;
+  memset(context->xsave.reserved, 0, sizeof(context->xsave.reserved));
+  for (const XSaveComponent &c : XSAVE_COMPONENTS) {
+    if (features & c.feature) {
+      memcpy(xsave + c.xsaveOffset, fpr + c.fprOffset, c.size);
+    }
+  }
+  context->hostState.xsaveValid = 1;
+}
+
+void loadContextFPR(Context *context) {
+  if (context == nullptr or context->hostState.xsaveValid == 0) {
+    return;
+  }
+  FPRState *fpr = &context->fprState;
+  uint8_t *raw = reinterpret_cast<uint8_t *>(fpr);
+  const uint8_t *xsave = reinterpret_cast<const uint8_t *>(&context->xsave);
+  const uint64_t features = getXSaveFeatures();
+  const uint64_t xstateBV = context->xsave.xstateBV;
+
+  memcpy(raw, context->xsave.legacy, sizeof(context->xsave.legacy));
+  // XSAVEOPT doesn't write the components in their initial configuration
+  if ((xstateBV & XSTATE_X87) == 0) {
+    fpr->rfcw = 0x37F;
+    fpr->rfsw = 0;
+    fpr->ftw = 0;
+    fpr->fop = 0;
+    fpr->ip = 0;
+    fpr->cs = 0;
+    fpr->dp = 0;
+    fpr->ds = 0;
+    memset(&fpr->stmm0, 0, 8 * sizeof(MMSTReg));
+  }
+  if ((xstateBV & XSTATE_SSE) == 0) {
+    if constexpr (is_x86_64) {
+      memset(&fpr->xmm0, 0, 16 * 16);
+    } else {
+      memset(&fpr->xmm0, 0, 8 * 16);
+    }
+  }
+  // The registers of the components not supported by the host keep the value
+  // set by the user
+  for (const XSaveComponent &c : XSAVE_COMPONENTS) {
+    if ((features & c.feature) == 0) {
+      continue;
+    } else if (xstateBV & c.feature) {
+      memcpy(raw + c.fprOffset, xsave + c.xsaveOffset, c.size);
+    } else {
+      memset(raw + c.fprOffset, 0, c.size);
+    }
+  }
+  context->hostState.xsaveValid = 0;
+}
+
+void setContextFPR(Context *context, const FPRState *fprState) {
+  context->fprState = *fprState;
+  context->hostState.xsaveValid = 0;
+}
+
 void ExecBlock::selectSeq(uint16_t seqID) {
   QBDI_REQUIRE(seqID < seqRegistry.size());
   currentSeq = seqID;
@@ -61,31 +196,72 @@ void ExecBlock::run() {
       makeRX();
     }
   }
+  // The FPRState is converted to the XSAVE area only when the host has updated
+  // it since the last context switch
+  const rword flags = context->hostState.executeFlags;
+  if ((flags & ExecBlockFlags::needFPU) and
+      useXSaveContextSwitch(llvmCPUs.getOptions())) {
+    if (context->hostState.xsaveValid == 0) {
+      convertToXSave(context);
+    }
+    // Any VEX or EVEX instruction may clear the upper bits of ZMM0-15. The
+    // other AVX-512 registers are only switched when the sequence uses them.
+    uint64_t mask = XSTATE_X87 | XSTATE_SSE | XSTATE_AVX | XSTATE_ZMM_HI256;
+    if (flags & ExecBlockFlags::needAVX512) {
+      mask |= XSTATE_AVX512;
+    }
+    context->hostState.xsaveMask = mask & getXSaveFeatures();
+  }
   qbdi_runCodeBlock(codeBlock.base(), context->hostState.executeFlags);
 }
 
-bool ExecBlock::writePatch(const Patch &p, const LLVMCPU &llvmcpu) {
+bool ExecBlock::writePatch(const Patch &p, const LLVMCPU &llvmcpu,
+                           rword guardTarget) {
   QBDI_REQUIRE(p.finalize);
 
-  if (getEpilogueOffset() <= MINIMAL_BLOCK_SIZE) {
+  uint32_t minimalBlockSize = MINIMAL_BLOCK_SIZE;
+  if (llvmcpu.getOptions() & Options::OPT_ENABLE_BLOCK_CHAINING) {
+    minimalBlockSize += INDIRECT_EXIT_SIZE;
+    if (llvmcpu.getOptions() & Options::OPT_ENABLE_SHADOW_STACK) {
+      minimalBlockSize += RETURN_STACK_EXIT_SIZE;
+    }
+  }
+  if (guardTarget != 0) {
+    minimalBlockSize += TRACE_GUARD_SIZE;
+  }
+
+  if (getEpilogueOffset() <= minimalBlockSize) {
     isFull = true;
     return false;
   }
 
   for (const RelocatableInst::UniquePtr &inst : p.insts) {
-    if (inst->getTag() != RelocatableInstTag::RelocInst) {
+    if (inst->getTag() == RelocatableInstTag::RelocTagCallbackSlotBody) {
+      callbackSlots.back().bodyOffset = codeStream->current_pos();
+      continue;
+    } else if (inst->getTag() == RelocatableInstTag::RelocTagCallbackSlotEnd) {
+      callbackSlots.back().endOffset = codeStream->current_pos();
+      updateCallbackSlot(callbackSlots.back());
+      continue;
+    } else if (inst->getTag() != RelocatableInstTag::RelocInst) {
       QBDI_DEBUG("RelocTag 0x{:x}", inst->getTag());
       tagRegistry.push_back(
           TagInfo{static_cast<uint16_t>(inst->getTag()),
                   static_cast<uint16_t>(codeStream->current_pos())});
       continue;
-    } else if (getEpilogueOffset() > MINIMAL_BLOCK_SIZE) {
+    } else if (getEpilogueOffset() > minimalBlockSize) {
       llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
     } else {
       QBDI_DEBUG("Not enough space left: rollback");
       return false;
     }
   }
+  if (guardTarget != 0) {
+    for (const RelocatableInst::UniquePtr &inst :
+         getTraceGuard(guardTarget, getNextInstID())) {
+      llvmcpu.writeInstruction(inst->reloc(this), codeStream.get());
+    }
+  }
 
   return true;
 }
@@ -96,4 +272,35 @@ void ExecBlock::initScratchRegisterForPatch(
 
 void ExecBlock::finalizeScratchRegisterForPatch() {}
 
+bool ExecBlock::getAbsoluteImmediates(
+    std::vector<std::pair<uint32_t, rword>> &immediates) const {
+  // On X86, the code also uses the absolute address of the data block
+  if constexpr (not is_x86_64) {
+    return false;
+  }
+  const LLVMCPU &llvmcpu = llvmCPUs.getCPU(CPUMode::DEFAULT);
+  const uint8_t *code = static_cast<const uint8_t *>(codeBlock.base());
+  uint64_t codeEnd = codeStream->current_pos();
+  uint64_t offset = 0;
+  while (offset < codeEnd) {
+    llvm::MCInst inst;
+    uint64_t size;
+    llvm::MCDisassembler::DecodeStatus dstatus = llvmcpu.getInstruction(
+        inst, size, llvm::ArrayRef<uint8_t>(code + offset, codeEnd - offset),
+        reinterpret_cast<uint64_t>(code + offset));
+    if (dstatus != llvm::MCDisassembler::Success or size == 0) {
+      QBDI_DEBUG("Cannot decode the ExecBlock 0x{:x} at offset 0x{:x}",
+                 reinterpret_cast<uintptr_t>(this), offset);
+      return false;
+    }
+    // The immediate of a movabs is its last 8 bytes
+    if (inst.getOpcode() == llvm::X86::MOV64ri) {
+      immediates.emplace_back(static_cast<uint32_t>(offset + size - 8),
+                              static_cast<rword>(inst.getOperand(1).getImm()));
+    }
+    offset += size;
+  }
+  return true;
+}
+
 } // namespace QBDI
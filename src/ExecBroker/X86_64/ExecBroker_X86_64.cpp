@@ -61,7 +61,7 @@ bool ExecBroker::transferExecution(rword addr, GPRState *gprState,
 
   // Write transfer state
   transferBlock->getContext()->gprState = *gprState;
-  transferBlock->getContext()->fprState = *fprState;
+  setContextFPR(transferBlock->getContext(), fprState);
   transferBlock->getContext()->hostState.selector = addr;
   transferBlock->getContext()->hostState.executeFlags = defaultExecuteFlags;
   // Execute transfer
@@ -71,6 +71,7 @@ bool ExecBroker::transferExecution(rword addr, GPRState *gprState,
   transferBlock->run();
 
   // Read transfer result
+  loadContextFPR(transferBlock->getContext());
   *gprState = transferBlock->getContext()->gprState;
   *fprState = transferBlock->getContext()->fprState;
 
@@ -20,6 +20,8 @@
 
 #include <stdint.h>
 
+#include "QBDI/State.h"
+
 namespace llvm {
 class MCInst;
 class MCInstrDesc;
@@ -39,6 +41,17 @@ bool useAllRegisters(const llvm::MCInst &inst);
 bool unsupportedRead(const llvm::MCInst &inst);
 bool unsupportedWrite(const llvm::MCInst &inst);
 
+// Return True when the instruction always transfers the execution to the same
+// address (direct jump or direct call). The address is stored in target.
+bool getStaticTarget(const llvm::MCInst &inst, rword address, uint32_t instSize,
+                     rword &target);
+
+// Return True when the instruction transfers the execution either to the same
+// address or to the next instruction (conditional jump). The address is stored
+// in target.
+bool getConditionalTarget(const llvm::MCInst &inst, rword address,
+                          uint32_t instSize, rword &target);
+
 }; // namespace QBDI
 
 #endif // INSTCLASSES_H
@@ -18,8 +18,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <utility>
+#include <vector>
 
+#include "QBDI/Options.h"
+#include "Engine/LLVMCPU.h"
 #include "Engine/VM_internal.h"
+#include "Patch/InstInfo.h"
 #include "Patch/InstMetadata.h"
 #include "Patch/InstrRule.h"
 #include "Patch/InstrRules.h"
@@ -40,7 +44,8 @@ namespace QBDI {
 void InstrRule::instrument(Patch &patch,
                            const PatchGenerator::UniquePtrVec &patchGen,
                            bool breakToHost, InstPosition position,
-                           int priority, RelocatableInstTag tag) const {
+                           int priority, RelocatableInstTag tag,
+                           const RelocatableInst *slot) const {
 
   if (patchGen.size() == 0 && breakToHost == false) {
     QBDI_DEBUG("Empty patch Generator");
@@ -119,6 +124,14 @@ void InstrRule::instrument(Patch &patch,
     }
   }
 
+  // A callback slot jumps over the whole instrumentation, including the
+  // save and the restoration of the temporary registers, when it's disabled
+  if (slot != nullptr) {
+    instru.insert(instru.begin(), RelocTag::unique(RelocTagCallbackSlotBody));
+    instru.insert(instru.begin(), slot->clone());
+    instru.push_back(RelocTag::unique(RelocTagCallbackSlotEnd));
+  }
+
   // add Tag
   instru.insert(instru.begin(), RelocTag::unique(tag));
 
@@ -144,7 +157,8 @@ InstrRuleBasicCBK::InstrRuleBasicCBK(PatchConditionUniquePtr &&condition,
                                      int priority, RelocatableInstTag tag)
     : AutoUnique<InstrRule, InstrRuleBasicCBK>(priority),
       condition(std::forward<PatchConditionUniquePtr>(condition)),
-      patchGen(getCallbackGenerator(cbk, data)), position(position),
+      patchGen(getCallbackGenerator(cbk, data)),
+      slotGen(getCallbackSlotGenerator()), position(position),
       breakToHost(breakToHost), tag(tag), cbk(cbk), data(data) {}
 
 InstrRuleBasicCBK::~InstrRuleBasicCBK() = default;
@@ -161,15 +175,46 @@ bool InstrRuleBasicCBK::changeDataPtr(void *new_data) {
   return true;
 }
 
+bool InstrRuleBasicCBK::tryInstrument(Patch &patch,
+                                      const LLVMCPU &llvmcpu) const {
+  if (not canBeApplied(patch, llvmcpu)) {
+    return false;
+  }
+  if (llvmcpu.getOptions() & Options::OPT_ENABLE_CALLBACK_SLOTS) {
+    // The ID of the rule will be the next one in the rules of the patch
+    CallbackSlot slot(reinterpret_cast<rword>(cbk),
+                      reinterpret_cast<rword>(data), enabled,
+                      static_cast<uint16_t>(patch.instrRules.size()));
+    instrument(patch, slotGen, breakToHost, position, priority, tag, &slot);
+  } else {
+    instrument(patch, patchGen, breakToHost, position, priority, tag);
+  }
+  return true;
+}
+
 std::unique_ptr<InstrRule> InstrRuleBasicCBK::clone() const {
-  return InstrRuleBasicCBK::unique(condition->clone(), cbk, data, position,
-                                   breakToHost, priority);
+  std::unique_ptr<InstrRule> rule = InstrRuleBasicCBK::unique(
+      condition->clone(), cbk, data, position, breakToHost, priority);
+  rule->setEnabled(enabled);
+  return rule;
 };
 
 RangeSet<rword> InstrRuleBasicCBK::affectedRange() const {
   return condition->affectedRange();
 }
 
+bool InstrRuleBasicCBK::fingerprint(Fingerprint &fp) const {
+  fp.add("InstrRuleBasicCBK");
+  condition->fingerprint(fp);
+  fp.addAddress(reinterpret_cast<rword>(cbk));
+  fp.addAddress(reinterpret_cast<rword>(data));
+  fp.add(position);
+  fp.add(breakToHost);
+  fp.add(priority);
+  fp.add(tag);
+  return true;
+}
+
 // InstrRuleDynamic
 // ================
 
@@ -191,14 +236,268 @@ bool InstrRuleDynamic::canBeApplied(const Patch &patch,
 }
 
 std::unique_ptr<InstrRule> InstrRuleDynamic::clone() const {
-  return InstrRuleDynamic::unique(condition->clone(), patchGenMethod, position,
-                                  breakToHost, priority);
+  std::unique_ptr<InstrRule> rule = InstrRuleDynamic::unique(
+      condition->clone(), patchGenMethod, position, breakToHost, priority);
+  rule->setEnabled(enabled);
+  return rule;
 };
 
 RangeSet<rword> InstrRuleDynamic::affectedRange() const {
   return condition->affectedRange();
 }
 
+bool InstrRuleDynamic::fingerprint(Fingerprint &fp) const {
+  fp.add("InstrRuleDynamic");
+  condition->fingerprint(fp);
+  fp.addAddress(reinterpret_cast<rword>(patchGenMethod));
+  fp.add(position);
+  fp.add(breakToHost);
+  fp.add(priority);
+  fp.add(tag);
+  return true;
+}
+
+// InstrRuleInline
+// ===============
+
+InstrRuleInline::InstrRuleInline(PatchConditionUniquePtr &&condition,
+                                 InlineKind kind, rword target, rword param,
+                                 unsigned reg, int priority)
+    : AutoUnique<InstrRule, InstrRuleInline>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      patchGen(getInlineGenerator(kind, target, param, reg)), kind(kind),
+      target(target), param(param), reg(reg) {}
+
+InstrRuleInline::~InstrRuleInline() = default;
+
+bool InstrRuleInline::tryInstrument(Patch &patch,
+                                    const LLVMCPU &llvmcpu) const {
+  if (not condition->test(patch.metadata.inst, patch.metadata.address,
+                          patch.metadata.instSize, llvmcpu)) {
+    return false;
+  }
+  // The inline instrumentation doesn't have a fallback to the host, and
+  // doesn't spill the registers on the stack of the guest
+  TempManager tempManager(patch, true);
+  if (tempManager.getFreeRegisterNumber() < getInlineTempNumber(kind)) {
+    QBDI_WARN("Not enough free registers to instrument inline 0x{:x}",
+              patch.metadata.address);
+    return false;
+  }
+  instrument(patch, patchGen, false, InstPosition::PREINST, priority,
+             RelocTagInvalid);
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRuleInline::clone() const {
+  std::unique_ptr<InstrRule> rule = InstrRuleInline::unique(
+      condition->clone(), kind, target, param, reg, priority);
+  rule->setEnabled(enabled);
+  return rule;
+};
+
+RangeSet<rword> InstrRuleInline::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRuleInline::fingerprint(Fingerprint &fp) const {
+  fp.add("InstrRuleInline");
+  condition->fingerprint(fp);
+  fp.add(kind);
+  fp.addAddress(target);
+  // The byte of the coverage map is selected by a hash of the address
+  if (kind == InlineKind::Coverage) {
+    fp.addPositionDependent();
+  }
+  fp.add(param);
+  fp.add(reg);
+  fp.add(priority);
+  return true;
+}
+
+// InstrRuleEdgeCoverage
+// =====================
+
+InstrRuleEdgeCoverage::InstrRuleEdgeCoverage(
+    PatchConditionUniquePtr &&condition, rword bitmap, int priority)
+    : AutoUnique<InstrRule, InstrRuleEdgeCoverage>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      prevLocation(std::make_unique<rword>(0)),
+      patchGen(getInlineGenerator(InlineKind::Edge, bitmap,
+                                  reinterpret_cast<rword>(prevLocation.get()),
+                                  0)),
+      bitmap(bitmap) {}
+
+InstrRuleEdgeCoverage::~InstrRuleEdgeCoverage() = default;
+
+bool InstrRuleEdgeCoverage::tryInstrument(Patch &patch,
+                                          const LLVMCPU &llvmcpu) const {
+  if (not patch.basicBlockStart or
+      not condition->test(patch.metadata.inst, patch.metadata.address,
+                          patch.metadata.instSize, llvmcpu)) {
+    return false;
+  }
+  TempManager tempManager(patch, true);
+  if (tempManager.getFreeRegisterNumber() <
+      getInlineTempNumber(InlineKind::Edge)) {
+    QBDI_WARN("Not enough free registers to record the edge to 0x{:x}",
+              patch.metadata.address);
+    return false;
+  }
+  instrument(patch, patchGen, false, InstPosition::PREINST, priority,
+             RelocTagInvalid);
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRuleEdgeCoverage::clone() const {
+  // The clone has its own previous location
+  std::unique_ptr<InstrRule> rule =
+      InstrRuleEdgeCoverage::unique(condition->clone(), bitmap, priority);
+  rule->setEnabled(enabled);
+  return rule;
+};
+
+RangeSet<rword> InstrRuleEdgeCoverage::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRuleEdgeCoverage::resetState() {
+  *prevLocation = 0;
+  return true;
+}
+
+bool InstrRuleEdgeCoverage::fingerprint(Fingerprint &fp) const {
+  fp.add("InstrRuleEdgeCoverage");
+  condition->fingerprint(fp);
+  fp.addAddress(bitmap);
+  fp.addOwned(reinterpret_cast<rword>(prevLocation.get()));
+  // The location of a basic block is a hash of its address
+  fp.addPositionDependent();
+  fp.add(priority);
+  return true;
+}
+
+// InstrRuleBatchCB
+// ================
+
+// The records are delivered when half of the buffer is used. The sequences
+// aren't linked while a batch rule exists: a sequence writes far fewer records
+// than the other half before the engine flushes the rule.
+static constexpr rword BATCH_FLUSH_THRESHOLD = QBDI_BATCH_SIZE / 2;
+
+InstrRuleBatchCB::InstrRuleBatchCB(PatchConditionUniquePtr &&condition,
+                                   unsigned reg, BatchCallback cbk,
+                                   void *cbk_data, VMInstanceRef vm,
+                                   int priority)
+    : AutoUnique<InstrRule, InstrRuleBatchCB>(priority),
+      condition(std::forward<PatchConditionUniquePtr>(condition)),
+      buffer(std::make_unique<BatchBuffer>()), delivered(0),
+      patchGen(getInlineGenerator(InlineKind::Batch,
+                                  reinterpret_cast<rword>(buffer.get()), 0,
+                                  reg)),
+      reg(reg), cbk(cbk), cbk_data(cbk_data), vm(vm) {
+  buffer->total = 0;
+}
+
+InstrRuleBatchCB::~InstrRuleBatchCB() = default;
+
+bool InstrRuleBatchCB::tryInstrument(Patch &patch,
+                                     const LLVMCPU &llvmcpu) const {
+  if (not condition->test(patch.metadata.inst, patch.metadata.address,
+                          patch.metadata.instSize, llvmcpu)) {
+    return false;
+  }
+  unsigned tempNumber = getInlineTempNumber(InlineKind::Batch);
+  if (getReadSize(patch.metadata.inst) > 0) {
+    // The address of a PC relative access needs another temporary
+    tempNumber++;
+  }
+  TempManager tempManager(patch, true);
+  if (tempManager.getFreeRegisterNumber() < tempNumber) {
+    QBDI_WARN("Not enough free registers to record 0x{:x} in a batch",
+              patch.metadata.address);
+    return false;
+  }
+  instrument(patch, patchGen, false, InstPosition::PREINST, priority,
+             RelocTagInvalid);
+  return true;
+}
+
+void InstrRuleBatchCB::flushRecords(bool force) {
+  rword total = buffer->total;
+  rword pending = total - delivered;
+  if (pending == 0 or (not force and pending < BATCH_FLUSH_THRESHOLD)) {
+    return;
+  }
+  if (pending > QBDI_BATCH_SIZE) {
+    QBDI_WARN("{} batch records have been overwritten",
+              pending - QBDI_BATCH_SIZE);
+    pending = QBDI_BATCH_SIZE;
+  }
+  // The records are copied in a local vector as the callback may delete the
+  // rule.
+  std::vector<BatchRecord> records;
+  records.reserve(pending);
+  for (rword n = total - pending; n != total; n++) {
+    size_t pos = n % QBDI_BATCH_SIZE;
+    records.push_back({buffer->addresses[pos], buffer->values[pos],
+                       buffer->accesses[pos]});
+  }
+  delivered = total;
+  cbk(vm, records.data(), records.size(), cbk_data);
+}
+
+std::unique_ptr<InstrRule> InstrRuleBatchCB::clone() const {
+  // The clone has its own buffer
+  std::unique_ptr<InstrRule> rule = InstrRuleBatchCB::unique(
+      condition->clone(), reg, cbk, cbk_data, vm, priority);
+  rule->setEnabled(enabled);
+  return rule;
+};
+
+RangeSet<rword> InstrRuleBatchCB::affectedRange() const {
+  return condition->affectedRange();
+}
+
+bool InstrRuleBatchCB::fingerprint(Fingerprint &fp) const {
+  fp.add("InstrRuleBatchCB");
+  condition->fingerprint(fp);
+  fp.addOwned(reinterpret_cast<rword>(buffer.get()));
+  fp.add(reg);
+  fp.add(priority);
+  return true;
+}
+
+// InstrRuleSequenceEvent
+// ======================
+
+InstrRuleSequenceEvent::InstrRuleSequenceEvent(InstCallback cbk, void *data,
+                                               InstPosition position,
+                                               int priority)
+    : AutoUnique<InstrRule, InstrRuleSequenceEvent>(priority),
+      patchGen(getCallbackGenerator(cbk, data)), position(position), cbk(cbk),
+      data(data) {}
+
+InstrRuleSequenceEvent::~InstrRuleSequenceEvent() = default;
+
+bool InstrRuleSequenceEvent::tryInstrument(Patch &patch,
+                                           const LLVMCPU &llvmcpu) const {
+  // The site is never a callback slot: it isn't registered in the rules of
+  // the patch
+  instrument(patch, patchGen, true, position, priority, RelocTagInvalid);
+  return true;
+}
+
+std::unique_ptr<InstrRule> InstrRuleSequenceEvent::clone() const {
+  return InstrRuleSequenceEvent::unique(cbk, data, position, priority);
+};
+
+RangeSet<rword> InstrRuleSequenceEvent::affectedRange() const {
+  RangeSet<rword> r;
+  r.add(Range<rword>(0, (rword)-1));
+  return r;
+}
+
 // InstrRuleUser
 // =============
 
@@ -22,8 +22,10 @@
 #include <memory>
 #include <vector>
 
+#include "Patch/InstrRules.h"
 #include "Patch/PatchUtils.h"
 #include "Patch/Types.h"
+#include "Utility/Serialize.h"
 
 #include "QBDI/Callback.h"
 #include "QBDI/InstAnalysis.h"
@@ -36,6 +38,7 @@ class LLVMCPU;
 class Patch;
 class PatchCondition;
 class PatchGenerator;
+class RelocatableInst;
 
 using PatchConditionUniquePtr = std::unique_ptr<PatchCondition>;
 using PatchGeneratorUniquePtrVec = std::vector<std::unique_ptr<PatchGenerator>>;
@@ -49,8 +52,12 @@ protected:
   // The rule with the lesser priority will be applied first
   int priority;
 
+  // A disabled rule isn't applied, or its callback slots are skipped
+  bool enabled;
+
 public:
-  InstrRule(int priority = PRIORITY_DEFAULT) : priority(priority) {}
+  InstrRule(int priority = PRIORITY_DEFAULT)
+      : priority(priority), enabled(true) {}
 
   virtual ~InstrRule() = default;
 
@@ -63,10 +70,47 @@ public:
 
   inline void setPriority(int priority) { this->priority = priority; };
 
+  inline bool isEnabled() const { return enabled; };
+
+  inline void setEnabled(bool enabled) { this->enabled = enabled; };
+
+  /*! Return true if the rule writes callback slots with the option
+   * OPT_ENABLE_CALLBACK_SLOTS. The slots can be enabled, disabled and receive
+   * a new data pointer without instrumenting the code again.
+   */
+  inline virtual bool hasCallbackSlot() const { return false; };
+
   inline virtual void changeVMInstanceRef(VMInstanceRef vminstance){};
 
   inline virtual bool changeDataPtr(void *data) { return false; };
 
+  /*! Reset the state kept by the instrumentation between two executions.
+   *
+   * @return False if the rule doesn't have a state.
+   */
+  inline virtual bool resetState() { return false; };
+
+  /*! Return true if the rule buffers records for a batch callback.
+   */
+  inline virtual bool hasBatchRecords() const { return false; };
+
+  /*! Deliver the records buffered by the rule to its batch callback.
+   *
+   * @param[in] force  Deliver the records even if the flush threshold isn't
+   *                   reached.
+   */
+  inline virtual void flushRecords(bool force){};
+
+  /*! Add the parameters of the rule to a fingerprint. Two rules with the same
+   * fingerprint generate the same instrumentation.
+   *
+   * @param[in] fp  The fingerprint.
+   *
+   * @return False if the instrumentation generated by the rule cannot be
+   * identified (user callback).
+   */
+  virtual bool fingerprint(Fingerprint &fp) const = 0;
+
   /*! Determine wheter this rule have to be apply on this Path and instrument if
    * needed.
    *
@@ -84,16 +128,20 @@ public:
    * @param[in] position    Add the patch before or after the instruction
    * @param[in] priority    The priority of this patch
    * @param[in] tag         The tag for this patch
+   * @param[in] slot        The callback slot which starts the patch (nullptr
+   *                        if the patch isn't a callback slot)
    */
   void instrument(Patch &patch, const PatchGeneratorUniquePtrVec &patchGen,
                   bool breakToHost, InstPosition position, int priority,
-                  RelocatableInstTag tag) const;
+                  RelocatableInstTag tag,
+                  const RelocatableInst *slot = nullptr) const;
 };
 
 class InstrRuleBasicCBK : public AutoUnique<InstrRule, InstrRuleBasicCBK> {
 
   PatchConditionUniquePtr condition;
   PatchGeneratorUniquePtrVec patchGen;
+  PatchGeneratorUniquePtrVec slotGen;
   InstPosition position;
   bool breakToHost;
   RelocatableInstTag tag;
@@ -143,14 +191,11 @@ public:
 
   bool changeDataPtr(void *data) override;
 
-  inline bool tryInstrument(Patch &patch,
-                            const LLVMCPU &llvmcpu) const override {
-    if (canBeApplied(patch, llvmcpu)) {
-      instrument(patch, patchGen, breakToHost, position, priority, tag);
-      return true;
-    }
-    return false;
-  }
+  inline bool hasCallbackSlot() const override { return true; };
+
+  bool fingerprint(Fingerprint &fp) const override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
 };
 
 typedef const PatchGeneratorUniquePtrVec &(*PatchGenMethod)(
@@ -205,6 +250,8 @@ public:
    */
   bool canBeApplied(const Patch &patch, const LLVMCPU &llvmcpu) const;
 
+  bool fingerprint(Fingerprint &fp) const override;
+
   inline bool tryInstrument(Patch &patch,
                             const LLVMCPU &llvmcpu) const override {
     if (canBeApplied(patch, llvmcpu)) {
@@ -216,6 +263,173 @@ public:
   }
 };
 
+class InstrRuleInline : public AutoUnique<InstrRule, InstrRuleInline> {
+
+  PatchConditionUniquePtr condition;
+  PatchGeneratorUniquePtrVec patchGen;
+  InlineKind kind;
+  rword target;
+  rword param;
+  unsigned reg;
+
+public:
+  /*! Allocate a new inline instrumentation rule. The instrumentation is
+   * written before the instruction and is executed without break to host.
+   *
+   * @param[in] condition   A PatchCondition which determine wheter or not this
+   *                        PatchRule applies.
+   * @param[in] kind        The kind of inline instrumentation
+   * @param[in] target      The address of the counter, of the coverage map or
+   *                        of the InlineTraceBuffer
+   * @param[in] param       The size of the coverage map or the
+   *                        InlineTraceType of the trace
+   * @param[in] reg         The register recorded by INLINE_TRACE_REGISTER
+   * @param[in] priority    Priority of the instrumentation
+   */
+  InstrRuleInline(PatchConditionUniquePtr &&condition, InlineKind kind,
+                  rword target, rword param = 0, unsigned reg = 0,
+                  int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleInline() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  bool fingerprint(Fingerprint &fp) const override;
+
+  /*! Instrument the patch if the condition applies and if enough registers
+   * unused by the instruction are available for the inline instrumentation.
+   */
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleEdgeCoverage
+    : public AutoUnique<InstrRule, InstrRuleEdgeCoverage> {
+
+  PatchConditionUniquePtr condition;
+  // The location of the previous basic block, written by the instrumentation
+  std::unique_ptr<rword> prevLocation;
+  PatchGeneratorUniquePtrVec patchGen;
+  rword bitmap;
+
+public:
+  /*! Allocate a new AFL style edge coverage rule. The instrumentation is
+   * written before the first instruction of each basic block and is executed
+   * without break to host.
+   *
+   * @param[in] condition   A PatchCondition which determine wheter or not this
+   *                        PatchRule applies.
+   * @param[in] bitmap      The address of the coverage map of
+   *                        QBDI_EDGE_MAP_SIZE bytes
+   * @param[in] priority    Priority of the instrumentation
+   */
+  InstrRuleEdgeCoverage(PatchConditionUniquePtr &&condition, rword bitmap,
+                        int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleEdgeCoverage() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  // Reset the previous location
+  bool resetState() override;
+
+  bool fingerprint(Fingerprint &fp) const override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleBatchCB : public AutoUnique<InstrRule, InstrRuleBatchCB> {
+
+  PatchConditionUniquePtr condition;
+  // The ring buffer written by the instrumentation
+  std::unique_ptr<BatchBuffer> buffer;
+  // Number of records already delivered to the callback
+  rword delivered;
+  PatchGeneratorUniquePtrVec patchGen;
+  unsigned reg;
+  BatchCallback cbk;
+  void *cbk_data;
+  VMInstanceRef vm;
+
+public:
+  /*! Allocate a new batch callback rule. The instrumentation writes a
+   * BatchRecord before each instruction without break to host, and the
+   * records are delivered to the callback by the engine.
+   *
+   * @param[in] condition   A PatchCondition which determine wheter or not this
+   *                        PatchRule applies.
+   * @param[in] reg         The register recorded in BatchRecord.value
+   * @param[in] cbk         The batch callback
+   * @param[in] cbk_data    The user data of the callback
+   * @param[in] vm          The VM instance given to the callback
+   * @param[in] priority    Priority of the instrumentation
+   */
+  InstrRuleBatchCB(PatchConditionUniquePtr &&condition, unsigned reg,
+                   BatchCallback cbk, void *cbk_data, VMInstanceRef vm,
+                   int priority = PRIORITY_DEFAULT);
+
+  ~InstrRuleBatchCB() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  inline void changeVMInstanceRef(VMInstanceRef vminstance) override {
+    vm = vminstance;
+  };
+
+  inline bool changeDataPtr(void *data) override {
+    cbk_data = data;
+    return true;
+  };
+
+  inline bool hasBatchRecords() const override { return true; };
+
+  void flushRecords(bool force) override;
+
+  bool fingerprint(Fingerprint &fp) const override;
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
+class InstrRuleSequenceEvent
+    : public AutoUnique<InstrRule, InstrRuleSequenceEvent> {
+
+  PatchGeneratorUniquePtrVec patchGen;
+  InstPosition position;
+  InstCallback cbk;
+  void *data;
+
+public:
+  /*! Allocate a new rule that writes the callback site of a VMEvent on
+   * sequences and basic blocks (OPT_INLINE_VM_EVENTS). The rule doesn't have
+   * a condition: the engine only applies it on the first and the last
+   * instruction of a basic block.
+   *
+   * @param[in] cbk        The callback which signals the event
+   * @param[in] data       The data pointer to give to the callback
+   * @param[in] position   Before the first instruction (PREINST) or after the
+   *                       last one (POSTINST)
+   * @param[in] priority   Priority of the callback
+   */
+  InstrRuleSequenceEvent(InstCallback cbk, void *data, InstPosition position,
+                         int priority);
+
+  ~InstrRuleSequenceEvent() override;
+
+  std::unique_ptr<InstrRule> clone() const override;
+
+  RangeSet<rword> affectedRange() const override;
+
+  // The callback site contains the address of the engine
+  inline bool fingerprint(Fingerprint &fp) const override { return false; }
+
+  bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
+};
+
 class InstrRuleUser : public AutoClone<InstrRule, InstrRuleUser> {
 
   InstrRuleCallback cbk;
@@ -242,6 +456,9 @@ public:
 
   inline RangeSet<rword> affectedRange() const override { return range; }
 
+  // The instrumentation depends on the result of the user callback
+  inline bool fingerprint(Fingerprint &fp) const override { return false; }
+
   bool tryInstrument(Patch &patch, const LLVMCPU &llvmcpu) const override;
 };
 
@@ -55,4 +55,31 @@ PatchGenerator::UniquePtrVec getCallbackGenerator(InstCallback cbk,
   return callbackGenerator;
 }
 
+/*! Output a list of PatchGenerator which would set up the host state part of
+ * the context for the callback of the current callback slot. The callback and
+ * its data are read in the shadows of the slot.
+ *
+ * @return A list of PatchGenerator to set up this callback call.
+ */
+PatchGenerator::UniquePtrVec getCallbackSlotGenerator() {
+  PatchGenerator::UniquePtrVec callbackGenerator;
+
+  // Write callback address in host state
+  callbackGenerator.push_back(
+      ReadTemp::unique(Temp(0), Shadow(ShadowReservedTag::CALLBACK_SLOT_CBK)));
+  callbackGenerator.push_back(WriteTemp::unique(
+      Temp(0), Offset(offsetof(Context, hostState.callback))));
+  // Write callback data pointer in host state
+  callbackGenerator.push_back(
+      ReadTemp::unique(Temp(0), Shadow(ShadowReservedTag::CALLBACK_SLOT_DATA)));
+  callbackGenerator.push_back(
+      WriteTemp::unique(Temp(0), Offset(offsetof(Context, hostState.data))));
+  // Write internal instruction id of a callback
+  callbackGenerator.push_back(GetInstId::unique(Temp(0)));
+  callbackGenerator.push_back(
+      WriteTemp::unique(Temp(0), Offset(offsetof(Context, hostState.origin))));
+
+  return callbackGenerator;
+}
+
 } // namespace QBDI
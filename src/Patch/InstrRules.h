@@ -41,6 +41,57 @@ class RelocatableInst;
 std::vector<std::unique_ptr<PatchGenerator>>
 getCallbackGenerator(InstCallback cbk, void *data);
 
+/*
+ * Setup the user callback of the current callback slot in the host state
+ * (OPT_ENABLE_CALLBACK_SLOTS)
+ *
+ * The callback and its data are read in the shadows of the slot.
+ */
+std::vector<std::unique_ptr<PatchGenerator>> getCallbackSlotGenerator();
+
+/*
+ * Kind of inline instrumentation (instrumentation without break to host)
+ */
+enum class InlineKind {
+  Counter,  // increment a rword counter
+  Coverage, // set a byte of a coverage map
+  Trace,    // write an entry in an InlineTraceBuffer
+  Edge,     // update an edge of an AFL style coverage map
+  Batch,    // write a BatchRecord in a BatchBuffer
+};
+
+/*
+ * Ring buffer written by a batch callback instrumentation. The position of
+ * the next record is the lower 16 bits of total.
+ */
+struct BatchBuffer {
+  rword total; // Number of records written
+  rword addresses[QBDI_BATCH_SIZE];
+  rword values[QBDI_BATCH_SIZE];
+  rword accesses[QBDI_BATCH_SIZE];
+};
+
+/*
+ * Setup an inline instrumentation. The generated code doesn't modify the
+ * flags and doesn't use the stack.
+ *
+ * @param[in] kind    The kind of instrumentation
+ * @param[in] target  The address of the counter, of the coverage map, of the
+ *                    InlineTraceBuffer or of the BatchBuffer
+ * @param[in] param   The size of the coverage map, the InlineTraceType of the
+ *                    trace or the address of the previous location of an edge
+ *                    coverage
+ * @param[in] reg     The register recorded by INLINE_TRACE_REGISTER or by a
+ *                    batch callback
+ */
+std::vector<std::unique_ptr<PatchGenerator>>
+getInlineGenerator(InlineKind kind, rword target, rword param, unsigned reg);
+
+/*
+ * Number of temporary registers used by an inline instrumentation
+ */
+unsigned getInlineTempNumber(InlineKind kind);
+
 std::vector<std::unique_ptr<RelocatableInst>>
 getBreakToHost(Reg temp, const Patch &patch, bool restore);
 } // namespace QBDI
@@ -51,12 +51,16 @@ public:
   InstMetadata metadata;
   std::vector<std::unique_ptr<RelocatableInst>> insts;
   std::vector<std::unique_ptr<InstCbLambda>> userInstCB;
+  // IDs of the instrumentation rules applied on the instruction
+  std::vector<uint32_t> instrRules;
   // Registers Used and Defs by the instruction
   std::map<unsigned, RegisterUsage> regUsage;
   // Registers used by the TempRegister for this patch
   std::set<unsigned> tempReg;
   const LLVMCPU *llvmcpu;
   bool finalize = false;
+  // The instruction is the first of a translated basic block
+  bool basicBlockStart = false;
 
   using Vec = std::vector<Patch>;
 
@@ -26,6 +26,7 @@
 
 #include "Patch/PatchUtils.h"
 #include "Patch/Types.h"
+#include "Utility/Serialize.h"
 
 #include "QBDI/Range.h"
 #include "QBDI/State.h"
@@ -54,6 +55,12 @@ public:
     return r;
   }
 
+  /*! Add the type and the parameters of the condition to a fingerprint.
+   *
+   * @param[in] fp  The fingerprint.
+   */
+  virtual void fingerprint(Fingerprint &fp) const = 0;
+
   virtual ~PatchCondition() = default;
 };
 
@@ -71,6 +78,11 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("MnemonicIs");
+    fp.add(mnemonic);
+  }
 };
 
 class OpIs : public AutoClone<PatchCondition, OpIs> {
@@ -85,6 +97,11 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("OpIs");
+    fp.add(op);
+  }
 };
 
 class UseReg : public AutoClone<PatchCondition, UseReg> {
@@ -99,6 +116,11 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("UseReg");
+    fp.add(reg.getID());
+  }
 };
 
 class InstructionInRange
@@ -124,6 +146,12 @@ public:
     r.add(range);
     return r;
   }
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("InstructionInRange");
+    fp.addAddress(range.start());
+    fp.add(range.size());
+  }
 };
 
 class AddressIs : public AutoClone<PatchCondition, AddressIs> {
@@ -144,6 +172,11 @@ public:
     r.add(Range<rword>(breakpoint, breakpoint + 1));
     return r;
   }
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("AddressIs");
+    fp.addAddress(breakpoint);
+  }
 };
 
 class And : public AutoUnique<PatchCondition, And> {
@@ -178,6 +211,14 @@ public:
   inline std::unique_ptr<PatchCondition> clone() const override {
     return And::unique(cloneVec(conditions));
   };
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("And");
+    fp.add(static_cast<uint64_t>(conditions.size()));
+    for (const PatchCondition::UniquePtr &cond : conditions) {
+      cond->fingerprint(fp);
+    }
+  }
 };
 
 class Or : public AutoUnique<PatchCondition, Or> {
@@ -211,6 +252,14 @@ public:
   inline std::unique_ptr<PatchCondition> clone() const override {
     return Or::unique(cloneVec(conditions));
   };
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("Or");
+    fp.add(static_cast<uint64_t>(conditions.size()));
+    for (const PatchCondition::UniquePtr &cond : conditions) {
+      cond->fingerprint(fp);
+    }
+  }
 };
 
 class Not : public AutoUnique<PatchCondition, Not> {
@@ -232,6 +281,11 @@ public:
   inline std::unique_ptr<PatchCondition> clone() const override {
     return Not::unique(condition->clone());
   };
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("Not");
+    condition->fingerprint(fp);
+  }
 };
 
 class True : public AutoClone<PatchCondition, True> {
@@ -244,6 +298,8 @@ public:
             const LLVMCPU &llvmcpu) const override {
     return true;
   }
+
+  void fingerprint(Fingerprint &fp) const override { fp.add("True"); }
 };
 
 class DoesReadAccess : public AutoClone<PatchCondition, DoesReadAccess> {
@@ -254,6 +310,8 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  void fingerprint(Fingerprint &fp) const override { fp.add("DoesReadAccess"); }
 };
 
 class DoesWriteAccess : public AutoClone<PatchCondition, DoesWriteAccess> {
@@ -264,6 +322,10 @@ public:
 
   bool test(const llvm::MCInst &inst, rword address, rword instSize,
             const LLVMCPU &llvmcpu) const override;
+
+  void fingerprint(Fingerprint &fp) const override {
+    fp.add("DoesWriteAccess");
+  }
 };
 
 } // namespace QBDI
@@ -381,6 +381,26 @@ public:
            Patch *toMerge) const override;
 };
 
+class JmpDataBlock : public AutoClone<PatchGenerator, JmpDataBlock>,
+                     public PureEval<JmpDataBlock> {
+  Offset offset;
+
+public:
+  /*! Generate an indirect jump to the address stored in the data block.
+   *
+   * @param[in] offset  Offset in the data block of the target address.
+   */
+  JmpDataBlock(Offset offset) : offset(offset) {}
+
+  /*! Output:
+   *
+   * JMP DataBlock[Offset]
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
 } // namespace QBDI
 
 #endif
@@ -19,6 +19,7 @@
 #define PATCHRULES_H
 
 #include <memory>
+#include <stdint.h>
 #include <vector>
 
 #include "QBDI/Options.h"
@@ -37,6 +38,45 @@ getExecBlockEpilogue(Options opts);
 
 std::vector<std::unique_ptr<RelocatableInst>> getTerminator(rword address);
 
+std::vector<std::unique_ptr<RelocatableInst>> getExitOrigin(uint16_t instID);
+
+// Number of targets remembered by the inline cache of an indirect exit
+static const uint16_t INDIRECT_CACHE_ENTRIES = 2;
+
+// Size in rword of the inline cache in the data block: a pair
+// (target address, sequence address) for each entry, followed by a scratch
+// slot
+static const uint16_t INDIRECT_CACHE_SIZE = 2 * INDIRECT_CACHE_ENTRIES + 1;
+
+std::vector<std::unique_ptr<RelocatableInst>>
+getIndirectCacheExit(rword cacheOffset);
+
+// Size in bytes of the ring of the shadow return stack. The offset of the top
+// entry is wrapped with a move of its lowest byte.
+static const uint16_t RETURN_STACK_RING_SIZE = 256;
+
+// Number of return addresses remembered by the shadow return stack
+static const uint16_t RETURN_STACK_ENTRIES =
+    RETURN_STACK_RING_SIZE / (2 * sizeof(rword));
+
+// Size in rword of the shadow return stack in the data block: a pair
+// (return address, address of the return slot) for each entry, followed by
+// the offset of the top entry and a scratch slot
+static const uint16_t RETURN_STACK_SIZE =
+    RETURN_STACK_RING_SIZE / sizeof(rword) + 2;
+
+std::vector<std::unique_ptr<RelocatableInst>>
+getReturnStackPush(rword stackOffset, rword returnAddress, rword slotOffset);
+
+std::vector<std::unique_ptr<RelocatableInst>>
+getReturnStackExit(rword stackOffset);
+
+// Check that the execution follows the path of a trace after an instruction
+// which modifies the PC. Exit to the VM with the instruction as origin
+// otherwise.
+std::vector<std::unique_ptr<RelocatableInst>> getTraceGuard(rword target,
+                                                            uint16_t instID);
+
 std::vector<PatchRule> getDefaultPatchRules(Options opts);
 
 } // namespace QBDI
@@ -99,6 +99,22 @@ public:
   llvm::MCInst reloc(ExecBlock *execBlock) const override;
 };
 
+class CallbackSlot : public AutoClone<RelocatableInst, CallbackSlot> {
+  rword cbk;
+  rword data;
+  bool enabled;
+  uint16_t ruleIndex;
+
+public:
+  CallbackSlot(rword cbk, rword data, bool enabled, uint16_t ruleIndex)
+      : AutoClone<RelocatableInst, CallbackSlot>(), cbk(cbk), data(data),
+        enabled(enabled), ruleIndex(ruleIndex) {}
+
+  // Create the shadows of a new callback slot in the ExecBlock and jump to the
+  // address stored in the first one (the callback or the end of the slot)
+  llvm::MCInst reloc(ExecBlock *execBlock) const override;
+};
+
 class LoadDataBlock : public AutoClone<RelocatableInst, LoadDataBlock> {
   unsigned reg;
   int64_t offset;
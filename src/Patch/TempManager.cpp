@@ -125,6 +125,26 @@ Reg::Vec TempManager::getUsedRegisters() const {
 
 size_t TempManager::getUsedRegisterNumber() const { return temps.size(); }
 
+size_t TempManager::getFreeRegisterNumber() const {
+  size_t freeRegister = 0;
+  for (unsigned int i = _QBDI_FIRST_FREE_REGISTER; i < AVAILABLE_GPR; i++) {
+    if (patch.regUsage.count(GPR_ID[i]) != 0) {
+      continue;
+    }
+    bool allocated = false;
+    for (const auto &p : temps) {
+      if (p.second == i) {
+        allocated = true;
+        break;
+      }
+    }
+    if (not allocated) {
+      freeRegister++;
+    }
+  }
+  return freeRegister;
+}
+
 unsigned TempManager::getSizedSubReg(unsigned reg, unsigned size) const {
   if (getRegisterSize(reg) == size) {
     return reg;
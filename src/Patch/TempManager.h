@@ -57,6 +57,10 @@ public:
 
   size_t getUsedRegisterNumber() const;
 
+  // Number of temporaries that can be allocated without using a register of
+  // the instruction
+  size_t getFreeRegisterNumber() const;
+
   unsigned getSizedSubReg(unsigned reg, unsigned size) const;
 
   const Patch &getPatch() const { return patch; };
@@ -86,6 +86,11 @@ public:
 
 enum ShadowReservedTag : uint16_t {
 
+  // Callback slot Tag
+  CALLBACK_SLOT_JUMP = 0xffd0,
+  CALLBACK_SLOT_CBK = 0xffd1,
+  CALLBACK_SLOT_DATA = 0xffd2,
+
   // MemoryAccess Tag
   MEMORY_TAG_BEGIN = 0xffe0,
   MEMORY_TAG_END = 0xfff0,
@@ -196,6 +201,8 @@ enum RelocatableInstTag {
   RelocTagPatchEnd = 0x21,
   RelocTagPostInstMemAccess = 0x30,
   RelocTagPostInstStdCBK = 0x31,
+  RelocTagCallbackSlotBody = 0x40,
+  RelocTagCallbackSlotEnd = 0x41,
   RelocTagInvalid = 0xff,
 };
 
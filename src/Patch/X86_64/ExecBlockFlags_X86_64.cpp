@@ -39,6 +39,15 @@ struct ExecBlockFlagsArray {
     for (unsigned i = 0; i < llvm::X86::NUM_TARGET_REGS; i++) {
       if (llvm::X86::YMM0 <= i && i <= llvm::X86::YMM15) {
         arr[i] = ExecBlockFlags::needAVX | ExecBlockFlags::needFPU;
+      } else if ((llvm::X86::YMM16 <= i && i <= llvm::X86::YMM31) ||
+                 (llvm::X86::ZMM0 <= i && i <= llvm::X86::ZMM31)) {
+        arr[i] = ExecBlockFlags::needAVX512 | ExecBlockFlags::needAVX |
+                 ExecBlockFlags::needFPU;
+      } else if ((llvm::X86::XMM16 <= i && i <= llvm::X86::XMM31) ||
+                 (llvm::X86::K0 <= i && i <= llvm::X86::K7) ||
+                 llvm::X86::K0_K1 == i || llvm::X86::K2_K3 == i ||
+                 llvm::X86::K4_K5 == i || llvm::X86::K6_K7 == i) {
+        arr[i] = ExecBlockFlags::needAVX512 | ExecBlockFlags::needFPU;
       } else if ((llvm::X86::XMM0 <= i && i <= llvm::X86::XMM15) ||
                  (llvm::X86::ST0 <= i && i <= llvm::X86::ST7) ||
                  (llvm::X86::MM0 <= i && i <= llvm::X86::MM7) ||
@@ -63,9 +72,9 @@ struct ExecBlockFlagsArray {
 
 } // namespace
 
-const uint8_t defaultExecuteFlags = ExecBlockFlags::needAVX |
-                                    ExecBlockFlags::needFPU |
-                                    ExecBlockFlags::needFSGS;
+const uint8_t defaultExecuteFlags =
+    ExecBlockFlags::needAVX | ExecBlockFlags::needFPU |
+    ExecBlockFlags::needFSGS | ExecBlockFlags::needAVX512;
 
 uint8_t getExecBlockFlags(const llvm::MCInst &inst,
                           const QBDI::LLVMCPU &llvmcpu) {
@@ -26,6 +26,7 @@ typedef enum : uint8_t {
   needAVX = 1 << 0,
   needFPU = 1 << 1,
   needFSGS = 1 << 2,
+  needAVX512 = 1 << 3,
 } ExecBlockFlags;
 
 }
@@ -3015,4 +3015,40 @@ bool unsupportedWrite(const llvm::MCInst &inst) {
   }
 }
 
+bool getStaticTarget(const llvm::MCInst &inst, rword address, uint32_t instSize,
+                     rword &target) {
+  switch (inst.getOpcode()) {
+    case llvm::X86::JMP_1:
+    case llvm::X86::JMP_2:
+    case llvm::X86::JMP_4:
+    case llvm::X86::CALL64pcrel32:
+    case llvm::X86::CALLpcrel16:
+    case llvm::X86::CALLpcrel32:
+      // same computation as GetPCOffset with an Operand
+      target = address + instSize + inst.getOperand(0).getImm();
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool getConditionalTarget(const llvm::MCInst &inst, rword address,
+                          uint32_t instSize, rword &target) {
+  switch (inst.getOpcode()) {
+    case llvm::X86::JCC_1:
+    case llvm::X86::JCC_2:
+    case llvm::X86::JCC_4:
+    case llvm::X86::LOOP:
+    case llvm::X86::LOOPE:
+    case llvm::X86::LOOPNE:
+    case llvm::X86::JCXZ:
+    case llvm::X86::JECXZ:
+    case llvm::X86::JRCXZ:
+      target = address + instSize + inst.getOperand(0).getImm();
+      return true;
+    default:
+      return false;
+  }
+}
+
 }; // namespace QBDI
@@ -24,8 +24,10 @@
 #include "Patch/RelocatableInst.h"
 #include "Patch/Types.h"
 #include "Patch/X86_64/Layer2_X86_64.h"
+#include "Patch/X86_64/PatchGenerator_X86_64.h"
 #include "Patch/X86_64/RelocatableInst_X86_64.h"
 
+#include "QBDI/Callback.h"
 #include "QBDI/Config.h"
 #include "Utility/LogSys.h"
 
@@ -64,4 +66,67 @@ RelocatableInst::UniquePtrVec getBreakToHost(Reg temp, const Patch &patch,
   return breakToHost;
 }
 
+/* Generate the PatchGenerators of an inline instrumentation. The trace value
+ * is computed in Temp(0) before the entry is written with Temp(1) and Temp(2).
+ */
+PatchGenerator::UniquePtrVec getInlineGenerator(InlineKind kind, rword target,
+                                                rword param, unsigned reg) {
+  switch (kind) {
+    case InlineKind::Counter:
+      return conv_unique<PatchGenerator>(
+          IncrementCounter::unique(Temp(0), Temp(1), Constant(target)));
+    case InlineKind::Coverage:
+      return conv_unique<PatchGenerator>(
+          SetCoverageByte::unique(Temp(0), Constant(target), Constant(param)));
+    case InlineKind::Trace: {
+      PatchGenerator::UniquePtrVec traceGenerator;
+      switch (static_cast<InlineTraceType>(param)) {
+        case INLINE_TRACE_ADDRESS:
+          traceGenerator.push_back(GetConstant::unique(Temp(0), Constant(0)));
+          break;
+        case INLINE_TRACE_REGISTER:
+          QBDI_REQUIRE_ACTION(reg < REG_PC, abort());
+          traceGenerator.push_back(CopyReg::unique(Reg(reg), Temp(0)));
+          break;
+        case INLINE_TRACE_MEMORY_READ:
+          traceGenerator.push_back(GetReadValue::unique(Temp(0)));
+          break;
+        default:
+          QBDI_ERROR("Unknown inline trace type {}", param);
+          abort();
+      }
+      traceGenerator.push_back(WriteTraceEntry::unique(
+          Temp(0), Temp(1), Temp(2), Constant(target)));
+      return traceGenerator;
+    }
+    case InlineKind::Edge:
+      return conv_unique<PatchGenerator>(UpdateEdgeCoverage::unique(
+          Temp(0), Temp(1), Temp(2), Constant(target), Constant(param)));
+    case InlineKind::Batch:
+      QBDI_REQUIRE_ACTION(reg < REG_PC, abort());
+      return conv_unique<PatchGenerator>(
+          CopyReg::unique(Reg(reg), Temp(0)),
+          WriteBatchRecord::unique(Temp(0), Temp(1), Temp(2),
+                                   Constant(target)));
+  }
+  _QBDI_UNREACHABLE();
+}
+
+unsigned getInlineTempNumber(InlineKind kind) {
+  switch (kind) {
+    case InlineKind::Counter:
+      return 2;
+    case InlineKind::Coverage:
+      return 1;
+    case InlineKind::Trace:
+      return 3;
+    case InlineKind::Edge:
+      // The counter is set to 1 on X86
+      return is_x86 ? 2 : 3;
+    case InlineKind::Batch:
+      return 3;
+  }
+  _QBDI_UNREACHABLE();
+}
+
 } // namespace QBDI
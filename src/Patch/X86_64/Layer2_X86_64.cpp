@@ -28,6 +28,36 @@
 
 namespace QBDI {
 
+llvm::MCInst mov8mi(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, uint8_t imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV8mi);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
+llvm::MCInst mov8mr(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, unsigned int src) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV8mr);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+
+  return inst;
+}
+
 llvm::MCInst mov32rr(unsigned int dst, unsigned int src) {
   llvm::MCInst inst;
 
@@ -63,6 +93,21 @@ llvm::MCInst mov32mr(unsigned int base, rword scale, unsigned int offset,
   return inst;
 }
 
+llvm::MCInst mov32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, rword imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV32mi);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
 llvm::MCInst mov32rm8(unsigned int dst, unsigned int base, rword scale,
                       unsigned int offset, rword displacement,
                       unsigned int seg) {
@@ -122,6 +167,17 @@ llvm::MCInst movzx32rr8(unsigned int dst, unsigned int src) {
   return inst;
 }
 
+llvm::MCInst movzx32rr16(unsigned int dst, unsigned int src) {
+
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOVZX32rr16);
+  inst.addOperand(llvm::MCOperand::createReg(dst));
+  inst.addOperand(llvm::MCOperand::createReg(src));
+
+  return inst;
+}
+
 llvm::MCInst mov64rr(unsigned int dst, unsigned int src) {
   llvm::MCInst inst;
 
@@ -157,6 +213,21 @@ llvm::MCInst mov64mr(unsigned int base, rword scale, unsigned int offset,
   return inst;
 }
 
+llvm::MCInst mov64mi32(unsigned int base, rword scale, unsigned int offset,
+                       rword displacement, unsigned int seg, rword imm) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::MOV64mi32);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(scale));
+  inst.addOperand(llvm::MCOperand::createReg(offset));
+  inst.addOperand(llvm::MCOperand::createImm(displacement));
+  inst.addOperand(llvm::MCOperand::createReg(seg));
+  inst.addOperand(llvm::MCOperand::createImm(imm));
+
+  return inst;
+}
+
 llvm::MCInst mov64rm(unsigned int dst, unsigned int base, rword scale,
                      unsigned int offset, rword displacement,
                      unsigned int seg) {
@@ -204,6 +275,26 @@ llvm::MCInst test64ri32(unsigned int base, uint32_t imm) {
   return inst;
 }
 
+llvm::MCInst not32r(unsigned int reg) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::NOT32r);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+
+  return inst;
+}
+
+llvm::MCInst not64r(unsigned int reg) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::NOT64r);
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+  inst.addOperand(llvm::MCOperand::createReg(reg));
+
+  return inst;
+}
+
 llvm::MCInst jmp32m(unsigned int base, rword offset) {
   llvm::MCInst inst;
 
@@ -250,6 +341,19 @@ llvm::MCInst jne(int32_t offset) {
   return inst;
 }
 
+llvm::MCInst jrcxz(int32_t offset) {
+  llvm::MCInst inst;
+
+  // jump if (R|E)CX is zero. Doesn't read or modify the flags
+  if constexpr (is_x86_64)
+    inst.setOpcode(llvm::X86::JRCXZ);
+  else
+    inst.setOpcode(llvm::X86::JECXZ);
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+
+  return inst;
+}
+
 llvm::MCInst jmp(rword offset) {
   llvm::MCInst inst;
 
@@ -285,6 +389,32 @@ llvm::MCInst fxrstor(unsigned int base, rword offset) {
   return inst;
 }
 
+llvm::MCInst xsaveopt(unsigned int base, rword offset) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::XSAVEOPT);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(1));
+  inst.addOperand(llvm::MCOperand::createReg(0));
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+  inst.addOperand(llvm::MCOperand::createReg(0));
+
+  return inst;
+}
+
+llvm::MCInst xrstor(unsigned int base, rword offset) {
+  llvm::MCInst inst;
+
+  inst.setOpcode(llvm::X86::XRSTOR);
+  inst.addOperand(llvm::MCOperand::createReg(base));
+  inst.addOperand(llvm::MCOperand::createImm(1));
+  inst.addOperand(llvm::MCOperand::createReg(0));
+  inst.addOperand(llvm::MCOperand::createImm(offset));
+  inst.addOperand(llvm::MCOperand::createReg(0));
+
+  return inst;
+}
+
 llvm::MCInst vextractf128(unsigned int base, rword offset, unsigned int src,
                           uint8_t regoffset) {
   llvm::MCInst inst;
@@ -502,6 +632,14 @@ llvm::MCInst movmr(unsigned int base, rword scale, unsigned int offset,
     return mov32mr(base, scale, offset, disp, seg, src);
 }
 
+llvm::MCInst movmi(unsigned int base, rword scale, unsigned int offset,
+                   rword disp, unsigned int seg, rword imm) {
+  if constexpr (is_x86_64)
+    return mov64mi32(base, scale, offset, disp, seg, imm);
+  else
+    return mov32mi(base, scale, offset, disp, seg, imm);
+}
+
 llvm::MCInst movrm(unsigned int dst, unsigned int base, rword scale,
                    unsigned int offset, rword disp, unsigned int seg) {
   if constexpr (is_x86_64)
@@ -524,6 +662,13 @@ llvm::MCInst testri(unsigned int base, uint32_t imm) {
     return test32ri(base, imm);
 }
 
+llvm::MCInst notr(unsigned int reg) {
+  if constexpr (is_x86_64)
+    return not64r(reg);
+  else
+    return not32r(reg);
+}
+
 llvm::MCInst pushr(unsigned int reg) {
   if constexpr (is_x86_64)
     return push64r(reg);
@@ -586,6 +731,10 @@ RelocatableInst::UniquePtr Mov(Offset offset, Reg reg) {
   return StoreDataBlock::unique(reg, offset);
 }
 
+RelocatableInst::UniquePtr Mov(Offset offset, Constant cst) {
+  return DataBlockRelx86(movmi(0, 1, 0, 0, 0, cst), 0, offset, 11);
+}
+
 RelocatableInst::UniquePtr Mov(Shadow shadow, Reg reg, bool create) {
   return StoreShadow::unique(reg, shadow.getTag(), create);
 }
@@ -610,6 +759,14 @@ RelocatableInst::UniquePtr Fxrstor(Offset offset) {
   return DataBlockRelx86(fxrstor(0, 0), 0, offset, 7);
 }
 
+RelocatableInst::UniquePtr Xsaveopt(Offset offset) {
+  return DataBlockRelx86(xsaveopt(0, 0), 0, offset, 7);
+}
+
+RelocatableInst::UniquePtr Xrstor(Offset offset) {
+  return DataBlockRelx86(xrstor(0, 0), 0, offset, 7);
+}
+
 RelocatableInst::UniquePtr Vextractf128(Offset offset, unsigned int src,
                                         Constant regoffset) {
   return DataBlockRelx86(vextractf128(0, 0, src, regoffset), 0, offset, 10);
@@ -648,6 +805,12 @@ RelocatableInst::UniquePtr Jne(int32_t offset) {
   return NoReloc::unique(jne(offset));
 }
 
+RelocatableInst::UniquePtr Jrcxz(int32_t offset) {
+  return NoReloc::unique(jrcxz(offset));
+}
+
+RelocatableInst::UniquePtr Not(Reg reg) { return NoReloc::unique(notr(reg)); }
+
 RelocatableInst::UniquePtr Rdfsbase(Reg reg) {
   return NoReloc::unique(rdfsbase64(reg));
 }
@@ -32,6 +32,12 @@ class RelocatableInst;
 
 // low level layer 2
 
+llvm::MCInst mov8mi(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, uint8_t imm);
+
+llvm::MCInst mov8mr(unsigned int base, rword scale, unsigned int offset,
+                    rword displacement, unsigned int seg, unsigned int src);
+
 llvm::MCInst mov32rr(unsigned int dst, unsigned int src);
 
 llvm::MCInst mov32ri(unsigned int reg, rword imm);
@@ -39,6 +45,9 @@ llvm::MCInst mov32ri(unsigned int reg, rword imm);
 llvm::MCInst mov32mr(unsigned int base, rword scale, unsigned int offset,
                      rword displacement, unsigned int seg, unsigned int src);
 
+llvm::MCInst mov32mi(unsigned int base, rword scale, unsigned int offset,
+                     rword displacement, unsigned int seg, rword imm);
+
 llvm::MCInst mov32rm8(unsigned int dst, unsigned int base, rword scale,
                       unsigned int offset, rword displacement,
                       unsigned int seg);
@@ -52,6 +61,8 @@ llvm::MCInst mov32rm(unsigned int dst, unsigned int base, rword scale,
 
 llvm::MCInst movzx32rr8(unsigned int dst, unsigned int src);
 
+llvm::MCInst movzx32rr16(unsigned int dst, unsigned int src);
+
 llvm::MCInst mov64rr(unsigned int dst, unsigned int src);
 
 llvm::MCInst mov64ri(unsigned int reg, rword imm);
@@ -59,6 +70,9 @@ llvm::MCInst mov64ri(unsigned int reg, rword imm);
 llvm::MCInst mov64mr(unsigned int base, rword scale, unsigned int offset,
                      rword displacement, unsigned int seg, unsigned int src);
 
+llvm::MCInst mov64mi32(unsigned int base, rword scale, unsigned int offset,
+                       rword displacement, unsigned int seg, rword imm);
+
 llvm::MCInst mov64rm(unsigned int dst, unsigned int base, rword scale,
                      unsigned int offset, rword displacement, unsigned int seg);
 
@@ -68,10 +82,16 @@ llvm::MCInst test32ri(unsigned int base, uint32_t imm);
 
 llvm::MCInst test64ri32(unsigned int base, uint32_t imm);
 
+llvm::MCInst not32r(unsigned int reg);
+
+llvm::MCInst not64r(unsigned int reg);
+
 llvm::MCInst je(int32_t offset);
 
 llvm::MCInst jne(int32_t offset);
 
+llvm::MCInst jrcxz(int32_t offset);
+
 llvm::MCInst jmp32m(unsigned int base, rword offset);
 
 llvm::MCInst jmp64m(unsigned int base, rword offset);
@@ -82,6 +102,10 @@ llvm::MCInst fxsave(unsigned int base, rword offset);
 
 llvm::MCInst fxrstor(unsigned int base, rword offset);
 
+llvm::MCInst xsaveopt(unsigned int base, rword offset);
+
+llvm::MCInst xrstor(unsigned int base, rword offset);
+
 llvm::MCInst vextractf128(unsigned int base, rword offset, unsigned int src,
                           uint8_t regoffset);
 
@@ -135,6 +159,9 @@ llvm::MCInst movri(unsigned int dst, rword imm);
 llvm::MCInst movmr(unsigned int base, rword scale, unsigned int offset,
                    rword disp, unsigned int seg, unsigned int src);
 
+llvm::MCInst movmi(unsigned int base, rword scale, unsigned int offset,
+                   rword disp, unsigned int seg, rword imm);
+
 llvm::MCInst movrm(unsigned int dst, unsigned int base, rword scale,
                    unsigned int offset, rword disp, unsigned int seg);
 
@@ -142,6 +169,8 @@ llvm::MCInst movzxrr8(unsigned int dst, unsigned int src);
 
 llvm::MCInst testri(unsigned int base, uint32_t imm);
 
+llvm::MCInst notr(unsigned int reg);
+
 llvm::MCInst pushr(unsigned int reg);
 
 llvm::MCInst popr(unsigned int reg);
@@ -165,6 +194,8 @@ std::unique_ptr<RelocatableInst> Mov(Reg reg, Constant cst);
 
 std::unique_ptr<RelocatableInst> Mov(Offset offset, Reg reg);
 
+std::unique_ptr<RelocatableInst> Mov(Offset offset, Constant cst);
+
 std::unique_ptr<RelocatableInst> Mov(Shadow shadow, Reg reg,
                                      bool create = true);
 
@@ -178,6 +209,10 @@ std::unique_ptr<RelocatableInst> Fxsave(Offset offset);
 
 std::unique_ptr<RelocatableInst> Fxrstor(Offset offset);
 
+std::unique_ptr<RelocatableInst> Xsaveopt(Offset offset);
+
+std::unique_ptr<RelocatableInst> Xrstor(Offset offset);
+
 std::unique_ptr<RelocatableInst> Vextractf128(Offset offset, unsigned int src,
                                               Constant regoffset);
 
@@ -202,6 +237,10 @@ std::unique_ptr<RelocatableInst> Je(int32_t offset);
 
 std::unique_ptr<RelocatableInst> Jne(int32_t offset);
 
+std::unique_ptr<RelocatableInst> Jrcxz(int32_t offset);
+
+std::unique_ptr<RelocatableInst> Not(Reg reg);
+
 std::unique_ptr<RelocatableInst> Rdfsbase(Reg reg);
 
 std::unique_ptr<RelocatableInst> Rdgsbase(Reg reg);
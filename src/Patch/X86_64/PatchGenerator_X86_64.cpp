@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <utility>
@@ -25,10 +26,12 @@
 #include "llvm/MC/MCInstrDesc.h"
 #include "llvm/MC/MCInstrInfo.h"
 
+#include "QBDI/Callback.h"
 #include "QBDI/Config.h"
 #include "QBDI/Platform.h"
 #include "Engine/LLVMCPU.h"
 #include "Patch/InstInfo.h"
+#include "Patch/InstrRules.h"
 #include "Patch/Patch.h"
 #include "Patch/RelocatableInst.h"
 #include "Patch/TempManager.h"
@@ -63,6 +66,16 @@ RelocatableInst::UniquePtrVec JmpEpilogue::generate(const Patch *patch,
   return conv_unique<RelocatableInst>(EpilogueRel::unique(jmp(0), 0, -1));
 }
 
+// JmpDataBlock
+// ============
+
+RelocatableInst::UniquePtrVec JmpDataBlock::generate(const Patch *patch,
+                                                     TempManager *temp_manager,
+                                                     Patch *toMerge) const {
+
+  return conv_unique<RelocatableInst>(JmpM(offset));
+}
+
 // Target Specific PatchGenerator
 
 // GetPCOffset
@@ -568,4 +581,154 @@ RelocatableInst::UniquePtrVec GetWriteValue::generate(const Patch *patch,
       abort());
 }
 
+// Mix the bits of an address (finalizer of MurmurHash3)
+static inline uint64_t hashAddress(rword address) {
+  uint64_t hash = address;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// IncrementCounter
+// ================
+
+RelocatableInst::UniquePtrVec
+IncrementCounter::generate(const Patch *patch, TempManager *temp_manager,
+                           Patch *toMerge) const {
+  Reg addrReg = temp_manager->getRegForTemp(addr);
+  Reg valueReg = temp_manager->getRegForTemp(value);
+
+  return conv_unique<RelocatableInst>(
+      NoReloc::unique(movri(addrReg, counter)),
+      NoReloc::unique(movrm(valueReg, addrReg, 1, 0, 0, 0)),
+      NoReloc::unique(lea(valueReg, valueReg, 1, 0, 1, 0)),
+      NoReloc::unique(movmr(addrReg, 1, 0, 0, 0, valueReg)));
+}
+
+// SetCoverageByte
+// ===============
+
+RelocatableInst::UniquePtrVec
+SetCoverageByte::generate(const Patch *patch, TempManager *temp_manager,
+                          Patch *toMerge) const {
+  QBDI_REQUIRE_ACTION(size != 0, abort());
+  uint64_t hash = hashAddress(patch->metadata.address);
+
+  Reg reg = temp_manager->getRegForTemp(temp);
+
+  return conv_unique<RelocatableInst>(
+      NoReloc::unique(movri(reg, bitmap + (hash % size))),
+      NoReloc::unique(mov8mi(reg, 1, 0, 0, 0, 1)));
+}
+
+// WriteTraceEntry
+// ===============
+
+RelocatableInst::UniquePtrVec
+WriteTraceEntry::generate(const Patch *patch, TempManager *temp_manager,
+                          Patch *toMerge) const {
+  Reg valueReg = temp_manager->getRegForTemp(value);
+  Reg bufferReg = temp_manager->getRegForTemp(buffer);
+  Reg indexReg = temp_manager->getRegForTemp(index);
+  unsigned index32 = temp_manager->getSizedSubReg(indexReg, 4);
+  unsigned index16 = temp_manager->getSizedSubReg(indexReg, 2);
+
+  // The position is read and written on 16 bits to wrap without modifying
+  // the flags.
+  static_assert(QBDI_INLINE_TRACE_SIZE == 0x10000);
+
+  return conv_unique<RelocatableInst>(
+      NoReloc::unique(movri(bufferReg, traceBuffer)),
+      NoReloc::unique(mov32rm16(index32, bufferReg, 1, 0, 0, 0)),
+      NoReloc::unique(movmr(bufferReg, sizeof(rword), indexReg,
+                            offsetof(InlineTraceBuffer, values), 0,
+                            valueReg)),
+      NoReloc::unique(movri(valueReg, patch->metadata.address)),
+      NoReloc::unique(movmr(bufferReg, sizeof(rword), indexReg,
+                            offsetof(InlineTraceBuffer, addresses), 0,
+                            valueReg)),
+      NoReloc::unique(lea(indexReg, indexReg, 1, 0, 1, 0)),
+      NoReloc::unique(movzx32rr16(index32, index16)),
+      NoReloc::unique(movmr(bufferReg, 1, 0, 0, 0, indexReg)));
+}
+
+// WriteBatchRecord
+// ================
+
+RelocatableInst::UniquePtrVec
+WriteBatchRecord::generate(const Patch *patch, TempManager *temp_manager,
+                           Patch *toMerge) const {
+  Reg valueReg = temp_manager->getRegForTemp(value);
+  Reg bufferReg = temp_manager->getRegForTemp(buffer);
+  Reg indexReg = temp_manager->getRegForTemp(index);
+  unsigned index32 = temp_manager->getSizedSubReg(indexReg, 4);
+
+  // The position is the lower 16 bits of the number of records
+  static_assert(QBDI_BATCH_SIZE == 0x10000);
+
+  RelocatableInst::UniquePtrVec p = conv_unique<RelocatableInst>(
+      NoReloc::unique(movri(bufferReg, batchBuffer)),
+      NoReloc::unique(mov32rm16(index32, bufferReg, 1, 0, 0, 0)),
+      NoReloc::unique(movmr(bufferReg, sizeof(rword), indexReg,
+                            offsetof(BatchBuffer, values), 0, valueReg)));
+
+  if (getReadSize(patch->metadata.inst) > 0) {
+    append(p, GetReadAddress(value).generate(patch, temp_manager, toMerge));
+  } else {
+    p.push_back(NoReloc::unique(movri(valueReg, 0)));
+  }
+
+  append(p, conv_unique<RelocatableInst>(
+                NoReloc::unique(movmr(bufferReg, sizeof(rword), indexReg,
+                                      offsetof(BatchBuffer, accesses), 0,
+                                      valueReg)),
+                NoReloc::unique(movri(valueReg, patch->metadata.address)),
+                NoReloc::unique(movmr(bufferReg, sizeof(rword), indexReg,
+                                      offsetof(BatchBuffer, addresses), 0,
+                                      valueReg)),
+                NoReloc::unique(movrm(valueReg, bufferReg, 1, 0, 0, 0)),
+                NoReloc::unique(lea(valueReg, valueReg, 1, 0, 1, 0)),
+                NoReloc::unique(movmr(bufferReg, 1, 0, 0, 0, valueReg))));
+  return p;
+}
+
+// UpdateEdgeCoverage
+// ==================
+
+RelocatableInst::UniquePtrVec
+UpdateEdgeCoverage::generate(const Patch *patch, TempManager *temp_manager,
+                             Patch *toMerge) const {
+  static_assert(QBDI_EDGE_MAP_SIZE == 0x10000);
+  const rword location = hashAddress(patch->metadata.address) & 0xffff;
+
+  Reg addrReg = temp_manager->getRegForTemp(addr);
+  Reg indexReg = temp_manager->getRegForTemp(index);
+  unsigned index32 = temp_manager->getSizedSubReg(indexReg, 4);
+  unsigned index16 = temp_manager->getSizedSubReg(indexReg, 2);
+
+  // The index is the sum of the location and the previous location, wrapped
+  // on 16 bits without modifying the flags.
+  RelocatableInst::UniquePtrVec p = conv_unique<RelocatableInst>(
+      NoReloc::unique(movri(addrReg, prevLocation)),
+      NoReloc::unique(mov32rm16(index32, addrReg, 1, 0, 0, 0)),
+      NoReloc::unique(movmi(addrReg, 1, 0, 0, 0, location >> 1)),
+      NoReloc::unique(movri(addrReg, bitmap)),
+      NoReloc::unique(lea(indexReg, indexReg, 1, 0, location, 0)),
+      NoReloc::unique(movzx32rr16(index32, index16)));
+
+  if constexpr (is_x86) {
+    // ESI and EDI don't have an 8 bits sub-register
+    p.push_back(NoReloc::unique(mov8mi(addrReg, 1, indexReg, 0, 0, 1)));
+  } else {
+    Reg countReg = temp_manager->getRegForTemp(count);
+    unsigned count32 = temp_manager->getSizedSubReg(countReg, 4);
+    unsigned count8 = temp_manager->getSizedSubReg(countReg, 1);
+    p.push_back(NoReloc::unique(mov32rm8(count32, addrReg, 1, indexReg, 0, 0)));
+    p.push_back(NoReloc::unique(lea(countReg, countReg, 1, 0, 1, 0)));
+    p.push_back(NoReloc::unique(mov8mr(addrReg, 1, indexReg, 0, 0, count8)));
+  }
+  return p;
+}
+
 } // namespace QBDI
@@ -239,6 +239,188 @@ public:
            Patch *toMerge) const override;
 };
 
+class IncrementCounter : public AutoClone<PatchGenerator, IncrementCounter> {
+
+  Temp addr;
+  Temp value;
+  Constant counter;
+
+public:
+  /*! Increment a counter in memory without modifying the flags.
+   *
+   * @param[in] addr      A temporary used to store the counter address.
+   * @param[in] value     A temporary used to store the counter value.
+   * @param[in] counter   The address of the counter (a rword).
+   */
+  IncrementCounter(Temp addr, Temp value, Constant counter)
+      : addr(addr), value(value), counter(counter) {}
+
+  /*! Output:
+   *
+   * MOV REG64 addr, IMM64 counter
+   * MOV REG64 value, MEM64 [addr]
+   * LEA REG64 value, MEM64 [value + 1]
+   * MOV MEM64 [addr], REG64 value
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class SetCoverageByte : public AutoClone<PatchGenerator, SetCoverageByte> {
+
+  Temp temp;
+  Constant bitmap;
+  Constant size;
+
+public:
+  /*! Set to 1 the byte of a coverage map associated with the address of the
+   * instruction. The index of the byte is a hash of the address modulo the
+   * size of the map, computed when the instruction is instrumented.
+   *
+   * @param[in] temp     A temporary used to store the address of the byte.
+   * @param[in] bitmap   The address of the coverage map.
+   * @param[in] size     The size of the coverage map in bytes.
+   */
+  SetCoverageByte(Temp temp, Constant bitmap, Constant size)
+      : temp(temp), bitmap(bitmap), size(size) {}
+
+  /*! Output:
+   *
+   * MOV REG64 temp, IMM64 (bitmap + hash(address) % size)
+   * MOV MEM8 [temp], IMM8 1
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class WriteTraceEntry : public AutoClone<PatchGenerator, WriteTraceEntry> {
+
+  Temp value;
+  Temp buffer;
+  Temp index;
+  Constant traceBuffer;
+
+public:
+  /*! Write the address of the instruction and a value at the current position
+   * of an InlineTraceBuffer and move to the next position, without modifying
+   * the flags.
+   *
+   * @param[in] value         A temporary which contains the value to record.
+   *                          Overwritten by this generator.
+   * @param[in] buffer        A temporary used to store the buffer address.
+   * @param[in] index         A temporary used to store the position.
+   * @param[in] traceBuffer   The address of the InlineTraceBuffer.
+   */
+  WriteTraceEntry(Temp value, Temp buffer, Temp index, Constant traceBuffer)
+      : value(value), buffer(buffer), index(index), traceBuffer(traceBuffer) {}
+
+  /*! Output:
+   *
+   * MOV REG64 buffer, IMM64 traceBuffer
+   * MOVZX REG32 index, MEM16 [buffer]
+   * MOV MEM64 [buffer + 8 * index + offset(values)], REG64 value
+   * MOV REG64 value, IMM64 address
+   * MOV MEM64 [buffer + 8 * index + offset(addresses)], REG64 value
+   * LEA REG64 index, MEM64 [index + 1]
+   * MOVZX REG32 index, REG16 index
+   * MOV MEM64 [buffer], REG64 index
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class WriteBatchRecord : public AutoClone<PatchGenerator, WriteBatchRecord> {
+
+  Temp value;
+  Temp buffer;
+  Temp index;
+  Constant batchBuffer;
+
+public:
+  /*! Write a record at the current position of a BatchBuffer and move to the
+   * next position, without modifying the flags. The record contains the
+   * address of the instruction, a value and the address read by the
+   * instruction (0 if the instruction doesn't read the memory).
+   *
+   * @param[in] value         A temporary which contains the value to record.
+   *                          Overwritten by this generator.
+   * @param[in] buffer        A temporary used to store the buffer address.
+   * @param[in] index         A temporary used to store the position.
+   * @param[in] batchBuffer   The address of the BatchBuffer.
+   */
+  WriteBatchRecord(Temp value, Temp buffer, Temp index, Constant batchBuffer)
+      : value(value), buffer(buffer), index(index), batchBuffer(batchBuffer) {}
+
+  /*! Output:
+   *
+   * MOV REG64 buffer, IMM64 batchBuffer
+   * MOVZX REG32 index, MEM16 [buffer]
+   * MOV MEM64 [buffer + 8 * index + offset(values)], REG64 value
+   * if the instruction reads the memory:
+   *   LEA REG64 value, MEM64 readAddress
+   * else:
+   *   MOV REG64 value, IMM64 0
+   * MOV MEM64 [buffer + 8 * index + offset(accesses)], REG64 value
+   * MOV REG64 value, IMM64 address
+   * MOV MEM64 [buffer + 8 * index + offset(addresses)], REG64 value
+   * MOV REG64 value, MEM64 [buffer]
+   * LEA REG64 value, MEM64 [value + 1]
+   * MOV MEM64 [buffer], REG64 value
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
+class UpdateEdgeCoverage
+    : public AutoClone<PatchGenerator, UpdateEdgeCoverage> {
+
+  Temp addr;
+  Temp index;
+  Temp count;
+  Constant bitmap;
+  Constant prevLocation;
+
+public:
+  /*! Update the counter of the edge between the previous basic block and the
+   * current one in a coverage map of QBDI_EDGE_MAP_SIZE bytes (AFL style),
+   * without modifying the flags. The location of the basic block is a hash of
+   * its address computed when the instruction is instrumented. The index of
+   * the edge is (location + previous location) % QBDI_EDGE_MAP_SIZE, and the
+   * previous location becomes location >> 1.
+   *
+   * @param[in] addr           A temporary used to store the addresses.
+   * @param[in] index          A temporary used to store the index of the edge.
+   * @param[in] count          A temporary used to store the counter (unused
+   *                           on X86, where the counter is set to 1).
+   * @param[in] bitmap         The address of the coverage map.
+   * @param[in] prevLocation   The address of the previous location (a rword).
+   */
+  UpdateEdgeCoverage(Temp addr, Temp index, Temp count, Constant bitmap,
+                     Constant prevLocation)
+      : addr(addr), index(index), count(count), bitmap(bitmap),
+        prevLocation(prevLocation) {}
+
+  /*! Output:
+   *
+   * MOV REG64 addr, IMM64 prevLocation
+   * MOVZX REG32 index, MEM16 [addr]
+   * MOV MEM64 [addr], IMM32 (location >> 1)
+   * MOV REG64 addr, IMM64 bitmap
+   * LEA REG64 index, MEM64 [index + location]
+   * MOVZX REG32 index, REG16 index
+   * MOVZX REG32 count, MEM8 [addr + index]
+   * LEA REG64 count, MEM64 [count + 1]
+   * MOV MEM8 [addr + index], REG8 count
+   */
+  std::vector<std::unique_ptr<RelocatableInst>>
+  generate(const Patch *patch, TempManager *temp_manager,
+           Patch *toMerge) const override;
+};
+
 } // namespace QBDI
 
 #endif
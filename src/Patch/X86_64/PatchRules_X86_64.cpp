@@ -37,11 +37,18 @@
 #include "Patch/X86_64/Layer2_X86_64.h"
 #include "Patch/X86_64/PatchGenerator_X86_64.h"
 #include "Patch/X86_64/PatchRules_X86_64.h"
+#include "Patch/X86_64/RelocatableInst_X86_64.h"
 #include "Utility/LogSys.h"
 #include "Utility/System.h"
 
 namespace QBDI {
 
+bool useXSaveContextSwitch(Options opts) {
+  static const bool hasXSaveOpt = isHostCPUFeaturePresent("xsaveopt");
+
+  return hasXSaveOpt and (opts & Options::OPT_DISABLE_FPR) == 0;
+}
+
 RelocatableInst::UniquePtrVec getExecBlockPrologue(Options opts) {
   RelocatableInst::UniquePtrVec prologue;
 
@@ -49,7 +56,25 @@ RelocatableInst::UniquePtrVec getExecBlockPrologue(Options opts) {
   append(prologue,
          SaveReg(Reg(REG_SP), Offset(offsetof(Context, hostState.sp))));
   // Restore FPR
-  if ((opts & Options::OPT_DISABLE_FPR) == 0) {
+  if (useXSaveContextSwitch(opts)) {
+    QBDI_DEBUG("XSAVEOPT support enabled in guest context switches");
+    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
+      append(
+          prologue,
+          LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
+      prologue.push_back(Test(Reg(0), ExecBlockFlags::needFPU));
+    }
+    // Requested feature bitmap in EDX:EAX, selected by the host for the
+    // sequence. A mov doesn't modify the flags of the test.
+    append(prologue,
+           LoadReg(Reg(0), Offset(offsetof(Context, hostState.xsaveMask))));
+    prologue.push_back(NoReloc::unique(mov32ri(llvm::X86::EDX, 0)));
+    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
+      prologue.push_back(Je(7));
+    }
+    prologue.push_back(Xrstor(Offset(offsetof(Context, xsave))));
+    // target je needFPU
+  } else if ((opts & Options::OPT_DISABLE_FPR) == 0) {
     if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
       append(
           prologue,
@@ -189,7 +214,24 @@ RelocatableInst::UniquePtrVec getExecBlockEpilogue(Options opts) {
   }
 #endif // QBDI_ARCH_X86_64
   // Save FPR
-  if ((opts & Options::OPT_DISABLE_FPR) == 0) {
+  if (useXSaveContextSwitch(opts)) {
+    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
+      append(
+          epilogue,
+          LoadReg(Reg(0), Offset(offsetof(Context, hostState.executeFlags))));
+      epilogue.push_back(Test(Reg(0), ExecBlockFlags::needFPU));
+    }
+    append(epilogue,
+           LoadReg(Reg(0), Offset(offsetof(Context, hostState.xsaveMask))));
+    epilogue.push_back(NoReloc::unique(mov32ri(llvm::X86::EDX, 0)));
+    if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
+      epilogue.push_back(Je(7));
+    }
+    // Only the components modified since the XRSTOR of the prologue are
+    // written back
+    epilogue.push_back(Xsaveopt(Offset(offsetof(Context, xsave))));
+    // target je needFPU
+  } else if ((opts & Options::OPT_DISABLE_FPR) == 0) {
     if ((opts & Options::OPT_DISABLE_OPTIONAL_FPR) == 0) {
       append(
           epilogue,
@@ -508,4 +550,173 @@ RelocatableInst::UniquePtrVec getTerminator(rword address) {
   return terminator;
 }
 
+RelocatableInst::UniquePtrVec getExitOrigin(uint16_t instID) {
+  // MOV with an immediate doesn't modify the flags
+  return conv_unique<RelocatableInst>(
+      Mov(Offset(offsetof(Context, hostState.origin)), Constant(instID)));
+}
+
+RelocatableInst::UniquePtrVec getIndirectCacheExit(rword cacheOffset) {
+  RelocatableInst::UniquePtrVec exit;
+
+  // The guest registers are live and the flags must be preserved. The target
+  // is compared with the cached addresses using LEA and JRCXZ.
+  // size of a load or a store in the data block
+  constexpr int32_t memSize = is_x86_64 ? 7 : 6;
+  // size of the check of an entry (load, not, lea, jrcxz)
+  constexpr int32_t checkSize = memSize + (is_x86_64 ? 3 : 2) +
+                                (is_x86_64 ? 5 : 4) + 2;
+  // size of the miss path (2 loads and jmp)
+  constexpr int32_t missSize = 2 * memSize + 5;
+  // size of a hit path (load and jmp), except the last one
+  constexpr int32_t hitSize = memSize + 5;
+  const rword scratchOffset =
+      cacheOffset + 2 * INDIRECT_CACHE_ENTRIES * sizeof(rword);
+
+  append(exit, SaveReg(Reg(0), Offset(Reg(0))));
+  append(exit, SaveReg(Reg(2), Offset(Reg(2))));
+  append(exit, LoadReg(Reg(0), Offset(Reg(REG_PC))));
+  for (int32_t i = 0; i < INDIRECT_CACHE_ENTRIES; i++) {
+    // RCX = target - cached target
+    append(exit, LoadReg(Reg(2), Offset(cacheOffset + 2 * i * sizeof(rword))));
+    exit.push_back(Not(Reg(2)));
+    exit.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 1, 0)));
+    // target jrcxz hit i
+    exit.push_back(Jrcxz((INDIRECT_CACHE_ENTRIES - 1 - i) * checkSize +
+                         missSize + i * hitSize + 1));
+  }
+  // miss: return to the VM
+  append(exit, LoadReg(Reg(0), Offset(Reg(0))));
+  append(exit, LoadReg(Reg(2), Offset(Reg(2))));
+  append(exit, JmpEpilogue());
+  // hit: jump to the cached sequence
+  for (int32_t i = 0; i < INDIRECT_CACHE_ENTRIES; i++) {
+    append(exit, LoadReg(Reg(0), Offset(cacheOffset +
+                                        (2 * i + 1) * sizeof(rword))));
+    if (i != INDIRECT_CACHE_ENTRIES - 1) {
+      // target jmp hit
+      exit.push_back(NoReloc::unique(
+          jmp((INDIRECT_CACHE_ENTRIES - 2 - i) * hitSize + memSize + 4)));
+    }
+  }
+  append(exit, SaveReg(Reg(0), Offset(scratchOffset)));
+  append(exit, LoadReg(Reg(0), Offset(Reg(0))));
+  append(exit, LoadReg(Reg(2), Offset(Reg(2))));
+  exit.push_back(JmpM(Offset(scratchOffset)));
+
+  return exit;
+}
+
+RelocatableInst::UniquePtrVec
+getReturnStackPush(rword stackOffset, rword returnAddress, rword slotOffset) {
+  RelocatableInst::UniquePtrVec push;
+  const rword indexOffset = stackOffset + RETURN_STACK_RING_SIZE;
+  constexpr rword leaSize = is_x86_64 ? 7 : 6;
+
+  // The guest registers are live and the flags must be preserved. The offset
+  // of the top entry is incremented with LEA and wrapped with MOVZX.
+  append(push, SaveReg(Reg(0), Offset(Reg(0))));
+  append(push, SaveReg(Reg(2), Offset(Reg(2))));
+  append(push, LoadReg(Reg(0), Offset(indexOffset)));
+  push.push_back(NoReloc::unique(
+      lea(Reg(0), Reg(0), 1, 0, 2 * sizeof(rword), 0)));
+  push.push_back(NoReloc::unique(movzxrr8(Reg(0), llvm::X86::AL)));
+  append(push, SaveReg(Reg(0), Offset(indexOffset)));
+  // RCX = address of the new top entry
+  push.push_back(
+      DataBlockRelx86(lea(Reg(2), 0, 1, 0, 0, 0), 1, stackOffset, leaSize));
+  push.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 0, 0)));
+  push.push_back(NoReloc::unique(movri(Reg(0), returnAddress)));
+  push.push_back(NoReloc::unique(movmr(Reg(2), 1, 0, 0, 0, Reg(0))));
+  push.push_back(
+      DataBlockRelx86(lea(Reg(0), 0, 1, 0, 0, 0), 1, slotOffset, leaSize));
+  push.push_back(
+      NoReloc::unique(movmr(Reg(2), 1, 0, sizeof(rword), 0, Reg(0))));
+  append(push, LoadReg(Reg(0), Offset(Reg(0))));
+  append(push, LoadReg(Reg(2), Offset(Reg(2))));
+
+  return push;
+}
+
+RelocatableInst::UniquePtrVec getReturnStackExit(rword stackOffset) {
+  RelocatableInst::UniquePtrVec exit;
+  const rword indexOffset = stackOffset + RETURN_STACK_RING_SIZE;
+  const rword scratchOffset = indexOffset + sizeof(rword);
+  // size of a load or a store in the data block
+  constexpr int32_t memSize = is_x86_64 ? 7 : 6;
+  constexpr rword leaSize = is_x86_64 ? 7 : 6;
+  // size of the miss path (2 loads and jmp)
+  constexpr int32_t missSize = 2 * memSize + 5;
+  // size of the hit path (load, dereference, store, 2 loads and jmp)
+  constexpr int32_t hitSize = 4 * memSize + (is_x86_64 ? 3 : 2) + 6;
+
+  // The top entry is always popped. When the target is the return address of
+  // the entry, jump to the address stored in its return slot. Otherwise, fall
+  // through the next exit.
+  append(exit, SaveReg(Reg(0), Offset(Reg(0))));
+  append(exit, SaveReg(Reg(2), Offset(Reg(2))));
+  append(exit, LoadReg(Reg(0), Offset(indexOffset)));
+  // RCX = address of the top entry
+  exit.push_back(
+      DataBlockRelx86(lea(Reg(2), 0, 1, 0, 0, 0), 1, stackOffset, leaSize));
+  exit.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 0, 0)));
+  exit.push_back(NoReloc::unique(lea(
+      Reg(0), Reg(0), 1, 0, RETURN_STACK_RING_SIZE - 2 * sizeof(rword), 0)));
+  exit.push_back(NoReloc::unique(movzxrr8(Reg(0), llvm::X86::AL)));
+  append(exit, SaveReg(Reg(0), Offset(indexOffset)));
+  // scratch = address of the return slot
+  exit.push_back(
+      NoReloc::unique(movrm(Reg(0), Reg(2), 1, 0, sizeof(rword), 0)));
+  append(exit, SaveReg(Reg(0), Offset(scratchOffset)));
+  // RCX = target - return address
+  exit.push_back(NoReloc::unique(movrm(Reg(2), Reg(2), 1, 0, 0, 0)));
+  exit.push_back(Not(Reg(2)));
+  append(exit, LoadReg(Reg(0), Offset(Reg(REG_PC))));
+  exit.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 1, 0)));
+  // target jrcxz hit
+  exit.push_back(Jrcxz(missSize + 1));
+  // miss: continue with the next exit
+  append(exit, LoadReg(Reg(0), Offset(Reg(0))));
+  append(exit, LoadReg(Reg(2), Offset(Reg(2))));
+  exit.push_back(NoReloc::unique(jmp(hitSize + 4)));
+  // hit: jump to the return slot
+  append(exit, LoadReg(Reg(0), Offset(scratchOffset)));
+  exit.push_back(NoReloc::unique(movrm(Reg(0), Reg(0), 1, 0, 0, 0)));
+  append(exit, SaveReg(Reg(0), Offset(scratchOffset)));
+  append(exit, LoadReg(Reg(0), Offset(Reg(0))));
+  append(exit, LoadReg(Reg(2), Offset(Reg(2))));
+  exit.push_back(JmpM(Offset(scratchOffset)));
+
+  return exit;
+}
+
+RelocatableInst::UniquePtrVec getTraceGuard(rword target, uint16_t instID) {
+  RelocatableInst::UniquePtrVec guard;
+  // size of a load or a store in the data block
+  constexpr int32_t memSize = is_x86_64 ? 7 : 6;
+  // size of the side exit (2 loads, exit origin and jmp)
+  constexpr int32_t exitSize = 2 * memSize + (is_x86_64 ? 11 : 10) + 5;
+
+  // The guest registers are live and the flags must be preserved. The next PC
+  // is compared with the next instruction of the trace using LEA and JRCXZ.
+  append(guard, SaveReg(Reg(0), Offset(Reg(0))));
+  append(guard, SaveReg(Reg(2), Offset(Reg(2))));
+  append(guard, LoadReg(Reg(0), Offset(Reg(REG_PC))));
+  // RCX = next PC - target
+  guard.push_back(NoReloc::unique(movri(Reg(2), ~target)));
+  guard.push_back(NoReloc::unique(lea(Reg(2), Reg(2), 1, Reg(0), 1, 0)));
+  // target jrcxz continue
+  guard.push_back(Jrcxz(exitSize + 1));
+  // side exit: return to the VM
+  append(guard, LoadReg(Reg(0), Offset(Reg(0))));
+  append(guard, LoadReg(Reg(2), Offset(Reg(2))));
+  append(guard, getExitOrigin(instID));
+  append(guard, JmpEpilogue());
+  // continue: the trace follows the recorded path
+  append(guard, LoadReg(Reg(0), Offset(Reg(0))));
+  append(guard, LoadReg(Reg(2), Offset(Reg(2))));
+
+  return guard;
+}
+
 } // namespace QBDI
@@ -26,6 +26,22 @@ namespace QBDI {
 
 static const uint32_t MINIMAL_BLOCK_SIZE = 64;
 
+// Additional space reserved at the end of a sequence for the inline cache of
+// an indirect exit (OPT_ENABLE_BLOCK_CHAINING)
+static const uint32_t INDIRECT_EXIT_SIZE = 128;
+
+// Additional space reserved at the end of a sequence for the shadow return
+// stack of a call or a return (OPT_ENABLE_SHADOW_STACK)
+static const uint32_t RETURN_STACK_EXIT_SIZE = 144;
+
+// Additional space reserved after an instruction of a trace for the guard of
+// its path (OPT_ENABLE_TRACES)
+static const uint32_t TRACE_GUARD_SIZE = 96;
+
+// Whether the FPR of the guest are switched with XRSTOR / XSAVEOPT in the
+// XSave area of the Context instead of FXRSTOR / FXSAVE in the FPRState
+bool useXSaveContextSwitch(Options opts);
+
 }
 
 #endif
@@ -44,9 +44,9 @@ llvm::MCInst LoadShadow::reloc(ExecBlock *exec_block) const {
 
   if constexpr (is_x86_64) {
     return movrm(reg, Reg(REG_PC), 1, 0,
-                 exec_block->getDataBlockOffset() + shadowOffset - 7, 0);
+                 exec_block->getDataBlockOffset(shadowOffset) - 7, 0);
   } else {
-    return movrm(reg, 0, 0, 0, exec_block->getDataBlockBase() + shadowOffset,
+    return movrm(reg, 0, 0, 0, exec_block->getDataBlockAddress(shadowOffset),
                  0);
   }
 }
@@ -65,13 +65,27 @@ llvm::MCInst StoreShadow::reloc(ExecBlock *exec_block) const {
 
   if constexpr (is_x86_64) {
     return movmr(Reg(REG_PC), 1, 0,
-                 exec_block->getDataBlockOffset() + shadowOffset - 7, 0, reg);
+                 exec_block->getDataBlockOffset(shadowOffset) - 7, 0, reg);
   } else {
-    return movmr(0, 0, 0, exec_block->getDataBlockBase() + shadowOffset, 0,
+    return movmr(0, 0, 0, exec_block->getDataBlockAddress(shadowOffset), 0,
                  reg);
   }
 }
 
+// CallbackSlot
+// ============
+
+llvm::MCInst CallbackSlot::reloc(ExecBlock *exec_block) const {
+  uint16_t id = exec_block->newCallbackSlot(cbk, data, enabled, ruleIndex);
+  unsigned int shadowOffset = exec_block->getShadowOffset(id);
+
+  if constexpr (is_x86_64) {
+    return jmpm(Reg(REG_PC), exec_block->getDataBlockOffset(shadowOffset) - 6);
+  } else {
+    return jmpm(0, exec_block->getDataBlockAddress(shadowOffset));
+  }
+}
+
 // LoadDataBlock
 // =============
 
@@ -79,9 +93,9 @@ llvm::MCInst LoadDataBlock::reloc(ExecBlock *exec_block) const {
 
   if constexpr (is_x86_64) {
     return movrm(reg, Reg(REG_PC), 1, 0,
-                 exec_block->getDataBlockOffset() + offset - 7, 0);
+                 exec_block->getDataBlockOffset(offset) - 7, 0);
   } else {
-    return movrm(reg, 0, 0, 0, exec_block->getDataBlockBase() + offset, 0);
+    return movrm(reg, 0, 0, 0, exec_block->getDataBlockAddress(offset), 0);
   }
 }
 
@@ -92,9 +106,9 @@ llvm::MCInst StoreDataBlock::reloc(ExecBlock *exec_block) const {
 
   if constexpr (is_x86_64) {
     return movmr(Reg(REG_PC), 1, 0,
-                 exec_block->getDataBlockOffset() + offset - 7, 0, reg);
+                 exec_block->getDataBlockOffset(offset) - 7, 0, reg);
   } else {
-    return movmr(0, 0, 0, exec_block->getDataBlockBase() + offset, 0, reg);
+    return movmr(0, 0, 0, exec_block->getDataBlockAddress(offset), 0, reg);
   }
 }
 
@@ -144,7 +158,8 @@ llvm::MCInst HostPCRel::reloc(ExecBlock *exec_block) const {
 
 llvm::MCInst DataBlockRel::reloc(ExecBlock *exec_block) const {
   llvm::MCInst res = inst;
-  res.getOperand(opn).setImm(offset + exec_block->getDataBlockOffset());
+  res.getOperand(opn).setImm(exec_block->getDataBlockOffset(offset) -
+                              instSize);
   return res;
 }
 
@@ -153,7 +168,7 @@ llvm::MCInst DataBlockRel::reloc(ExecBlock *exec_block) const {
 
 llvm::MCInst DataBlockAbsRel::reloc(ExecBlock *exec_block) const {
   llvm::MCInst res = inst;
-  res.getOperand(opn).setImm(exec_block->getDataBlockBase() + offset);
+  res.getOperand(opn).setImm(exec_block->getDataBlockAddress(offset));
   return res;
 }
 
@@ -64,11 +64,14 @@ class DataBlockRel : public AutoClone<RelocatableInst, DataBlockRel> {
   llvm::MCInst inst;
   unsigned int opn;
   rword offset;
+  rword instSize;
 
 public:
-  DataBlockRel(llvm::MCInst &&inst, unsigned int opn, rword offset)
+  DataBlockRel(llvm::MCInst &&inst, unsigned int opn, rword offset,
+               rword instSize)
       : AutoClone<RelocatableInst, DataBlockRel>(),
-        inst(std::forward<llvm::MCInst>(inst)), opn(opn), offset(offset) {}
+        inst(std::forward<llvm::MCInst>(inst)), opn(opn), offset(offset),
+        instSize(instSize) {}
 
   llvm::MCInst reloc(ExecBlock *exec_block) const override;
 };
@@ -93,7 +96,7 @@ inline std::unique_ptr<RelocatableInst> DataBlockRelx86(llvm::MCInst &&inst,
   if constexpr (is_x86_64) {
     inst.getOperand(opn /* AddrBaseReg */).setReg(Reg(REG_PC));
     return DataBlockRel::unique(std::forward<llvm::MCInst>(inst),
-                                opn + 3 /* AddrDisp */, offset - inst_size);
+                                opn + 3 /* AddrDisp */, offset, inst_size);
   } else {
     inst.getOperand(opn /* AddrBaseReg */).setReg(0);
     return DataBlockAbsRel::unique(std::forward<llvm::MCInst>(inst),
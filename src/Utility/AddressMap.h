@@ -0,0 +1,218 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_ADDRESSMAP_H
+#define QBDI_ADDRESSMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! Flat hash table indexed by an address. The entries are stored in a
+ * contiguous table using open addressing with linear probing. The entries
+ * cannot be removed individually.
+ *
+ * The pointers returned by find and operator[] are invalidated by the next
+ * insertion in the table.
+ */
+template <typename T>
+class AddressMap {
+private:
+  struct Entry {
+    rword key;
+    T value;
+  };
+
+  // An empty slot of the table has a null key. The null address is stored
+  // outside of the table.
+  std::vector<Entry> table;
+  size_t mask;
+  unsigned shift;
+  size_t nbEntries;
+  bool hasNullKey;
+  T nullKeyValue;
+
+  static const size_t MINIMAL_CAPACITY = 64;
+
+  inline size_t index(rword key) const {
+    // Fibonacci hashing keeps the high bits of the product
+    return static_cast<size_t>(
+               (static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> shift) &
+           mask;
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<Entry> oldTable = std::move(table);
+    table = std::vector<Entry>(capacity);
+    mask = capacity - 1;
+    shift = 64;
+    while (capacity > 1) {
+      capacity >>= 1;
+      shift--;
+    }
+    for (Entry &e : oldTable) {
+      if (e.key == 0) {
+        continue;
+      }
+      size_t i = index(e.key);
+      while (table[i].key != 0) {
+        i = (i + 1) & mask;
+      }
+      table[i].key = e.key;
+      table[i].value = std::move(e.value);
+    }
+  }
+
+public:
+  AddressMap()
+      : table(), mask(0), shift(64), nbEntries(0), hasNullKey(false),
+        nullKeyValue() {}
+
+  AddressMap(AddressMap &&) = default;
+  AddressMap &operator=(AddressMap &&) = default;
+
+  /*! Return the number of entries in the table.
+   */
+  size_t size() const { return nbEntries; }
+
+  /*! Return true if the table has no entry.
+   */
+  bool empty() const { return nbEntries == 0; }
+
+  /*! Allocate enough space to store a number of entries without rehashing the
+   * table.
+   *
+   * @param[in] n  The number of entries.
+   */
+  void reserve(size_t n) {
+    size_t capacity = MINIMAL_CAPACITY;
+    // load factor under 3/4
+    while (capacity * 3 < n * 4) {
+      capacity <<= 1;
+    }
+    if (capacity > table.size()) {
+      rehash(capacity);
+    }
+  }
+
+  /*! Search the value associated to an address.
+   *
+   * @param[in] key  The address.
+   *
+   * @return A pointer to the value, or a null pointer if the address isn't in
+   * the table.
+   */
+  const T *find(rword key) const {
+    if (key == 0) {
+      return hasNullKey ? &nullKeyValue : nullptr;
+    }
+    if (table.empty()) {
+      return nullptr;
+    }
+    size_t i = index(key);
+    while (true) {
+      const Entry &e = table[i];
+      if (e.key == key) {
+        return &e.value;
+      } else if (e.key == 0) {
+        return nullptr;
+      }
+      i = (i + 1) & mask;
+    }
+  }
+
+  T *find(rword key) {
+    return const_cast<T *>(static_cast<const AddressMap *>(this)->find(key));
+  }
+
+  /*! Return 1 if the address is in the table, else 0.
+   *
+   * @param[in] key  The address.
+   */
+  size_t count(rword key) const { return find(key) != nullptr ? 1 : 0; }
+
+  /*! Get the value associated to an address. A default value is inserted if
+   * the address isn't in the table.
+   *
+   * @param[in] key  The address.
+   *
+   * @return A reference to the value.
+   */
+  T &operator[](rword key) {
+    if (key == 0) {
+      if (not hasNullKey) {
+        hasNullKey = true;
+        nbEntries++;
+      }
+      return nullKeyValue;
+    }
+    T *value = find(key);
+    if (value != nullptr) {
+      return *value;
+    }
+    // The table only grows when a new address is inserted
+    if ((nbEntries + 1) * 4 > table.size() * 3) {
+      rehash(table.empty() ? MINIMAL_CAPACITY : table.size() * 2);
+    }
+    size_t i = index(key);
+    while (table[i].key != 0) {
+      i = (i + 1) & mask;
+    }
+    table[i].key = key;
+    table[i].value = T();
+    nbEntries++;
+    return table[i].value;
+  }
+
+  /*! Remove all the entries and release the table.
+   */
+  void clear() {
+    table.clear();
+    table.shrink_to_fit();
+    mask = 0;
+    shift = 64;
+    nbEntries = 0;
+    hasNullKey = false;
+    nullKeyValue = T();
+  }
+
+  /*! Call a function for each entry of the table. The order of the entries is
+   * unspecified. The table mustn't be modified by the function.
+   *
+   * @param[in] f  The function, called with the address and the value.
+   */
+  template <typename F>
+  void forEach(F &&f) const {
+    if (hasNullKey) {
+      f(static_cast<rword>(0), nullKeyValue);
+    }
+    for (const Entry &e : table) {
+      if (e.key != 0) {
+        f(e.key, e.value);
+      }
+    }
+  }
+};
+
+} // namespace QBDI
+
+#endif // QBDI_ADDRESSMAP_H
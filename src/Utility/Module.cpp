@@ -0,0 +1,265 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <fstream>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "QBDI/Config.h"
+#include "Utility/Module.h"
+#include "Utility/Serialize.h"
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+#include <elf.h>
+#endif
+
+namespace QBDI {
+
+bool getModuleId(const std::vector<MemoryMap> &maps, const Range<rword> &range,
+                 ModuleId &id) {
+  const MemoryMap *map = nullptr;
+  for (const MemoryMap &m : maps) {
+    if (m.range.contains(range.start())) {
+      map = &m;
+      break;
+    }
+  }
+  if (map == nullptr or map->name.empty() or map->name[0] == '[') {
+    return false;
+  }
+  Range<rword> module = map->range;
+  for (const MemoryMap &m : maps) {
+    if (m.name == map->name) {
+      module.setStart(std::min(module.start(), m.range.start()));
+      module.setEnd(std::max(module.end(), m.range.end()));
+    }
+  }
+  if (not module.contains(range)) {
+    return false;
+  }
+  id.name = map->name;
+  id.base = module.start();
+  id.buildId = getModuleBuildId(map->name);
+  return true;
+}
+
+// Range of the maps of a module
+static Range<rword> getModuleRange(const std::vector<MemoryMap> &maps,
+                                   const std::string &name) {
+  Range<rword> module(0, 0);
+  for (const MemoryMap &m : maps) {
+    if (m.name != name) {
+      continue;
+    }
+    if (module.size() == 0) {
+      module = m.range;
+    } else {
+      module.setStart(std::min(module.start(), m.range.start()));
+      module.setEnd(std::max(module.end(), m.range.end()));
+    }
+  }
+  return module;
+}
+
+AddressTable::AddressTable()
+    : maps(getCurrentProcessMaps(true)), positionDependent(false) {}
+
+uint32_t AddressTable::addOwned(rword address) {
+  owned.push_back(address);
+  return static_cast<uint32_t>(owned.size() - 1);
+}
+
+bool AddressTable::getLocation(rword address, AddressLocation &loc) {
+  for (size_t i = 0; i < owned.size(); i++) {
+    if (owned[i] == address) {
+      loc = {true, static_cast<uint32_t>(i), 0};
+      return true;
+    }
+  }
+  for (size_t i = 0; i < moduleRanges.size(); i++) {
+    if (moduleRanges[i].contains(address)) {
+      loc = {false, static_cast<uint32_t>(i),
+             address - moduleRanges[i].start()};
+      return true;
+    }
+  }
+  ModuleId id;
+  if (not getModuleId(maps, Range<rword>(address, address + 1), id)) {
+    return false;
+  }
+  Range<rword> range = getModuleRange(maps, id.name);
+  modules.push_back(std::move(id));
+  moduleRanges.push_back(range);
+  loc = {false, static_cast<uint32_t>(modules.size() - 1),
+         address - range.start()};
+  return true;
+}
+
+bool AddressTable::getAddress(const AddressLocation &loc,
+                              rword &address) const {
+  if (loc.owned) {
+    if (loc.index >= owned.size() or loc.offset != 0) {
+      return false;
+    }
+    address = owned[loc.index];
+    return true;
+  }
+  if (loc.index >= modules.size()) {
+    return false;
+  }
+  const Range<rword> &range = moduleRanges[loc.index];
+  if (loc.offset >= range.size() or
+      (positionDependent and range.start() != modules[loc.index].base)) {
+    return false;
+  }
+  address = range.start() + loc.offset;
+  return true;
+}
+
+void AddressTable::save(std::ostream &os) const {
+  writeValue(os, static_cast<uint32_t>(modules.size()));
+  for (const ModuleId &module : modules) {
+    writeString(os, module.name);
+    writeValue(os, module.base);
+    writeVector(os, module.buildId);
+  }
+}
+
+bool AddressTable::load(std::istream &is) {
+  uint32_t nbModules;
+  if (not readValue(is, nbModules) or nbModules > (1 << 16)) {
+    return false;
+  }
+  modules.clear();
+  moduleRanges.clear();
+  for (uint32_t i = 0; i < nbModules; i++) {
+    ModuleId module;
+    if (not readString(is, module.name) or not readValue(is, module.base) or
+        not readVector(is, module.buildId, 1 << 10)) {
+      return false;
+    }
+    Range<rword> range = getModuleRange(maps, module.name);
+    if (range.size() != 0 and getModuleBuildId(module.name) != module.buildId) {
+      range = Range<rword>(0, 0);
+    }
+    modules.push_back(std::move(module));
+    moduleRanges.push_back(range);
+  }
+  return true;
+}
+
+#if defined(QBDI_PLATFORM_LINUX) || defined(QBDI_PLATFORM_ANDROID)
+
+template <typename Ehdr, typename Phdr, typename Nhdr>
+static std::vector<uint8_t> readElfBuildId(std::ifstream &file) {
+  Ehdr ehdr;
+  file.seekg(0);
+  if (not file.read(reinterpret_cast<char *>(&ehdr), sizeof(ehdr)) or
+      ehdr.e_phentsize != sizeof(Phdr)) {
+    return {};
+  }
+  for (unsigned i = 0; i < ehdr.e_phnum; i++) {
+    Phdr phdr;
+    file.seekg(ehdr.e_phoff + i * sizeof(Phdr));
+    if (not file.read(reinterpret_cast<char *>(&phdr), sizeof(phdr))) {
+      return {};
+    }
+    if (phdr.p_type != PT_NOTE or phdr.p_filesz > (1 << 16)) {
+      continue;
+    }
+    std::vector<char> notes(phdr.p_filesz);
+    file.seekg(phdr.p_offset);
+    if (not file.read(notes.data(), notes.size())) {
+      return {};
+    }
+    // The name and the descriptor of a note are aligned on 4 bytes
+    size_t offset = 0;
+    while (offset + sizeof(Nhdr) <= notes.size()) {
+      Nhdr nhdr;
+      memcpy(&nhdr, &notes[offset], sizeof(nhdr));
+      size_t nameOffset = offset + sizeof(Nhdr);
+      size_t descOffset = nameOffset + ((nhdr.n_namesz + 3) & ~3);
+      size_t nextOffset = descOffset + ((nhdr.n_descsz + 3) & ~3);
+      if (nextOffset > notes.size()) {
+        break;
+      }
+      if (nhdr.n_type == NT_GNU_BUILD_ID and nhdr.n_namesz == 4 and
+          memcmp(&notes[nameOffset], "GNU", 4) == 0) {
+        return {notes.begin() + descOffset,
+                notes.begin() + descOffset + nhdr.n_descsz};
+      }
+      offset = nextOffset;
+    }
+  }
+  return {};
+}
+
+std::vector<uint8_t> getModuleBuildId(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  unsigned char ident[EI_NIDENT];
+  if (not file.read(reinterpret_cast<char *>(ident), sizeof(ident)) or
+      memcmp(ident, ELFMAG, SELFMAG) != 0) {
+    return {};
+  }
+  if (ident[EI_CLASS] == ELFCLASS64) {
+    return readElfBuildId<Elf64_Ehdr, Elf64_Phdr, Elf64_Nhdr>(file);
+  } else if (ident[EI_CLASS] == ELFCLASS32) {
+    return readElfBuildId<Elf32_Ehdr, Elf32_Phdr, Elf32_Nhdr>(file);
+  }
+  return {};
+}
+
+#else
+
+std::vector<uint8_t> getModuleBuildId(const std::string &path) { return {}; }
+
+#endif
+
+void Fingerprint::addAddress(rword address) {
+  AddressLocation loc;
+  if (table == nullptr or not table->getLocation(address, loc)) {
+    add(address);
+  } else if (loc.owned) {
+    add("owned");
+    add(loc.index);
+  } else {
+    const ModuleId &module = table->getModule(loc.index);
+    add(module.name);
+    add(module.buildId.data(), module.buildId.size());
+    add(loc.offset);
+  }
+}
+
+void Fingerprint::addOwned(rword address) {
+  if (table == nullptr) {
+    add(address);
+  } else {
+    add("owned");
+    add(table->addOwned(address));
+  }
+}
+
+void Fingerprint::addPositionDependent() {
+  if (table != nullptr) {
+    table->setPositionDependent();
+  }
+}
+
+} // namespace QBDI
@@ -0,0 +1,143 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_MODULE_H
+#define QBDI_MODULE_H
+
+#include <istream>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "QBDI/Memory.hpp"
+#include "QBDI/Range.h"
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+/*! Identity of a module loaded in the process.
+ */
+struct ModuleId {
+  std::string name;             /*!< Path of the module */
+  rword base;                   /*!< Address of the first map of the module */
+  std::vector<uint8_t> buildId; /*!< Build ID (empty if unknown) */
+
+  bool operator==(const ModuleId &other) const {
+    return name == other.name && base == other.base &&
+           buildId == other.buildId;
+  }
+};
+
+/*! Identify the module which contains a range of addresses.
+ *
+ * @param[in]  maps   The memory maps of the process (with the full path).
+ * @param[in]  range  The range of addresses.
+ * @param[out] id     The identity of the module.
+ *
+ * @return False if the range isn't inside the maps of one module.
+ */
+bool getModuleId(const std::vector<MemoryMap> &maps, const Range<rword> &range,
+                 ModuleId &id);
+
+/*! Read the build ID of a module (GNU build ID note of an ELF file).
+ *
+ * @param[in] path  The path of the module.
+ *
+ * @return The build ID, or an empty vector if the module hasn't a build ID or
+ * the format isn't supported.
+ */
+std::vector<uint8_t> getModuleBuildId(const std::string &path);
+
+/*! Location of an address which doesn't depend on the load address of the
+ * modules: an offset in a module or in an object owned by the VM.
+ */
+struct AddressLocation {
+  bool owned;     /*!< The index is the one of an object owned by the VM */
+  uint32_t index; /*!< Index of the module or of the object in the table */
+  rword offset;   /*!< Offset of the address in the module or the object */
+};
+
+/*! Table of the modules and of the objects owned by the VM referenced by a
+ * translation cache. The absolute addresses of the instrumented code are saved
+ * as locations of the table, and relocated when the cache is loaded by
+ * another process.
+ */
+class AddressTable {
+private:
+  std::vector<MemoryMap> maps;
+  std::vector<ModuleId> modules;
+  // Range of the modules in this process (empty if the module isn't loaded)
+  std::vector<Range<rword>> moduleRanges;
+  std::vector<rword> owned;
+  bool positionDependent;
+
+public:
+  AddressTable();
+
+  /*! Register an object owned by the VM. The objects are registered in the
+   * same order by the process which saves the cache and the one which loads
+   * it.
+   *
+   * @param[in] address  The address of the object.
+   *
+   * @return The index of the object.
+   */
+  uint32_t addOwned(rword address);
+
+  /*! The instrumentation depends on the absolute address of the instructions.
+   * The modules must be loaded at the same address.
+   */
+  void setPositionDependent() { positionDependent = true; }
+
+  /*! Locate an address. A module is added to the table when one of its
+   * addresses is located for the first time.
+   *
+   * @param[in]  address  The address.
+   * @param[out] loc      The location of the address.
+   *
+   * @return False if the address isn't in a module nor an owned object.
+   */
+  bool getLocation(rword address, AddressLocation &loc);
+
+  /*! Get the address of a location in this process.
+   *
+   * @param[in]  loc      The location.
+   * @param[out] address  The address.
+   *
+   * @return False if the module of the location isn't loaded.
+   */
+  bool getAddress(const AddressLocation &loc, rword &address) const;
+
+  const ModuleId &getModule(uint32_t index) const { return modules[index]; }
+
+  /*! Write the modules of the table. */
+  void save(std::ostream &os) const;
+
+  /*! Read the modules written with save and find them in this process. A
+   * module is only found if its build ID hasn't changed.
+   *
+   * @param[in] is  The stream.
+   *
+   * @return False if the stream is invalid.
+   */
+  bool load(std::istream &is);
+};
+
+} // namespace QBDI
+
+#endif // QBDI_MODULE_H
@@ -0,0 +1,162 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef QBDI_SERIALIZE_H
+#define QBDI_SERIALIZE_H
+
+#include <istream>
+#include <ostream>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "QBDI/State.h"
+
+namespace QBDI {
+
+class AddressTable;
+
+/*! Write the raw representation of a value in a binary stream.
+ *
+ * @param[in] os  The stream.
+ * @param[in] v   The value. Its type must be trivially copyable.
+ */
+template <typename T>
+inline void writeValue(std::ostream &os, const T &v) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "The type must be trivially copyable");
+  os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+/*! Read a value written with writeValue.
+ *
+ * @param[in]  is  The stream.
+ * @param[out] v   The value.
+ *
+ * @return True if the value was read.
+ */
+template <typename T>
+inline bool readValue(std::istream &is, T &v) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "The type must be trivially copyable");
+  is.read(reinterpret_cast<char *>(&v), sizeof(T));
+  return is.good();
+}
+
+/*! Write a vector of trivially copyable values in a binary stream, preceded by
+ * its size.
+ *
+ * @param[in] os  The stream.
+ * @param[in] v   The vector.
+ */
+template <typename T>
+inline void writeVector(std::ostream &os, const std::vector<T> &v) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "The type must be trivially copyable");
+  writeValue(os, static_cast<uint64_t>(v.size()));
+  os.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+/*! Read a vector written with writeVector.
+ *
+ * @param[in]  is       The stream.
+ * @param[out] v        The vector.
+ * @param[in]  maxSize  The maximal number of elements accepted.
+ *
+ * @return True if the vector was read.
+ */
+template <typename T>
+inline bool readVector(std::istream &is, std::vector<T> &v,
+                       size_t maxSize = 1 << 20) {
+  uint64_t size;
+  if (not readValue(is, size) or size > maxSize) {
+    return false;
+  }
+  v.resize(static_cast<size_t>(size));
+  is.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+  return is.good();
+}
+
+inline void writeString(std::ostream &os, const std::string &s) {
+  writeValue(os, static_cast<uint64_t>(s.size()));
+  os.write(s.data(), s.size());
+}
+
+inline bool readString(std::istream &is, std::string &s,
+                       size_t maxSize = 1 << 16) {
+  uint64_t size;
+  if (not readValue(is, size) or size > maxSize) {
+    return false;
+  }
+  s.resize(static_cast<size_t>(size));
+  is.read(&s[0], s.size());
+  return is.good();
+}
+
+/*! Hash of a sequence of values (FNV-1a, 64 bits). Used to identify a
+ * configuration of the VM. With an AddressTable, the addresses are added as
+ * their location in the table, which doesn't depend on the load address of
+ * the modules.
+ */
+class Fingerprint {
+private:
+  uint64_t value;
+  AddressTable *table;
+
+public:
+  explicit Fingerprint(AddressTable *table = nullptr)
+      : value(0xcbf29ce484222325ULL), table(table) {}
+
+  void add(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+      value ^= bytes[i];
+      value *= 0x100000001b3ULL;
+    }
+  }
+
+  template <typename T>
+  void add(const T &v) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "The type must be trivially copyable");
+    add(&v, sizeof(T));
+  }
+
+  void add(const std::string &s) {
+    add(static_cast<uint64_t>(s.size()));
+    add(s.data(), s.size());
+  }
+
+  // Add an address of the process (a callback, its data or an instruction)
+  void addAddress(rword address);
+
+  // Add the address of an object owned by the VM and written in the
+  // instrumented code
+  void addOwned(rword address);
+
+  // The instrumented code depends on the absolute address of the
+  // instructions
+  void addPositionDependent();
+
+  uint64_t get() const { return value; }
+};
+
+} // namespace QBDI
+
+#endif // QBDI_SERIALIZE_H
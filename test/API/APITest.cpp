@@ -80,3 +80,13 @@ bool APITest::runOnASM(QBDI::rword *retval, const char *source,
 
   return vm.call(retval, addr, args);
 }
+
+uint32_t APITest::countNewBasicBlocks(QBDI::VM &vm, uint32_t &counter) {
+  return vm.addVMEventCB(
+      QBDI::BASIC_BLOCK_NEW,
+      [&counter](QBDI::VMInstanceRef vm, const QBDI::VMState *vmState,
+                 QBDI::GPRState *gprState, QBDI::FPRState *fprState) {
+        counter++;
+        return QBDI::VMAction::CONTINUE;
+      });
+}
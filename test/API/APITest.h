@@ -47,6 +47,14 @@ public:
   bool runOnASM(QBDI::rword *retval, const char *source,
                 const std::vector<QBDI::rword> &args = {},
                 const std::vector<std::string> mattrs = {});
+
+  // Count the BASIC_BLOCK_NEW events of a VM in counter
+  uint32_t countNewBasicBlocks(QBDI::VM &vm, uint32_t &counter);
+
+  // Call dummyFunBB and dummyFunRec in a VM from a GPRState and check their
+  // return value (defined in VMTest.cpp)
+  void callDummyFunBB(QBDI::VM &vm, const QBDI::GPRState &state);
+  void callDummyFunRec(QBDI::VM &vm, const QBDI::GPRState &state, int arg);
 };
 
 #endif /* QBDITEST_APITEST_H */
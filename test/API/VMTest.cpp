@@ -17,6 +17,12 @@
  */
 #include <algorithm>
 #include <catch2/catch.hpp>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include "APITest.h"
 
 #include "inttypes.h"
@@ -92,6 +98,43 @@ QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunBB(int arg0, int arg1, int arg2,
   return r;
 }
 
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunRec(int arg0) {
+  if (arg0 <= 1) {
+    return arg0;
+  }
+  return dummyFunRec(arg0 - 1) + dummyFunRec(arg0 - 2) + 1;
+}
+
+QBDI_DISABLE_ASAN QBDI_NOINLINE int dummyFunLoop(int arg0) {
+  volatile int r = 0;
+  for (int i = 0; i < arg0; i++) {
+    r += i;
+  }
+  return r;
+}
+
+void APITest::callDummyFunBB(QBDI::VM &vm, const QBDI::GPRState &state) {
+  vm.setGPRState(&state);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 8, 13, reinterpret_cast<QBDI::rword>(dummyFunCall),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFunCall)});
+  REQUIRE(ran);
+  REQUIRE((int)retval ==
+          dummyFunBB(5, 8, 13, dummyFunCall, dummyFun1, dummyFunCall));
+}
+
+void APITest::callDummyFunRec(QBDI::VM &vm, const QBDI::GPRState &state,
+                              int arg) {
+  vm.setGPRState(&state);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunRec),
+                     {static_cast<QBDI::rword>(arg)});
+  REQUIRE(ran);
+  REQUIRE((int)retval == dummyFunRec(arg));
+}
+
 TEST_CASE_METHOD(APITest, "VMTest-Call0") {
   QBDI::simulateCall(state, FAKE_RET_ADDR);
 
@@ -350,6 +393,31 @@ TEST_CASE_METHOD(APITest, "VMTest-VMEvent_ExecTransfer") {
   vm.deleteAllInstrumentations();
 }
 
+TEST_CASE_METHOD(APITest, "VMTest-RemoveCachedRange") {
+  QBDI::GPRState backup = *(vm.getGPRState());
+  const QBDI::rword fun1 = reinterpret_cast<QBDI::rword>(dummyFun1);
+
+  uint32_t count = 0;
+  uint32_t id = vm.addCodeAddrCB(fun1, QBDI::InstPosition::PREINST,
+                                 countInstruction, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  callDummyFunBB(vm, backup);
+  REQUIRE(count != 0);
+
+  // Without VMEvent callback, the next run uses the fast dispatch loop. The
+  // cached code of dummyFun1 must not be executed once its range is removed.
+  vm.removeInstrumentedRange(fun1, fun1 + 1);
+  count = 0;
+  callDummyFunBB(vm, backup);
+  REQUIRE(count == 0);
+
+  // The code is instrumented again when the range is added back
+  vm.addInstrumentedRange(fun1, fun1 + 1);
+  callDummyFunBB(vm, backup);
+  REQUIRE(count != 0);
+  vm.deleteAllInstrumentations();
+}
+
 struct CheckBasicBlockData {
   bool waitingEnd;
   QBDI::rword BBStart;
@@ -411,6 +479,668 @@ TEST_CASE_METHOD(APITest, "VMTest-VMEvent_BasicBlock") {
   }
 }
 
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_InlineBasicBlock") {
+  CheckBasicBlockData data{false, 0, 0, 0};
+  vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY | QBDI::BASIC_BLOCK_EXIT,
+                  checkBasicBlock, &data);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  int expected = dummyFunBB(5, 8, 13, dummyFun1, dummyFun1, dummyFun1);
+  size_t countVM = 0;
+  for (QBDI::Options opts :
+       {QBDI::Options::NO_OPT, QBDI::Options::OPT_INLINE_VM_EVENTS,
+        QBDI::Options::OPT_INLINE_VM_EVENTS |
+            QBDI::Options::OPT_ENABLE_BLOCK_CHAINING}) {
+    vm.setOptions(opts);
+    // the second run executes the sequences in the cache
+    for (int i = 0; i < 2; i++) {
+      vm.setGPRState(&backup);
+      data.waitingEnd = false;
+      data.count = 0;
+      QBDI::rword retval;
+      bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                         {5, 8, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                          reinterpret_cast<QBDI::rword>(dummyFun1),
+                          reinterpret_cast<QBDI::rword>(dummyFun1)});
+      REQUIRE(ran);
+      REQUIRE((int)retval == expected);
+      CHECK_FALSE(data.waitingEnd);
+      if (opts == QBDI::Options::NO_OPT) {
+        countVM = data.count;
+      } else {
+        // the callback sites signal the same basic blocks as the VM
+        CHECK(data.count == countVM);
+      }
+    }
+  }
+  REQUIRE(countVM != 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-VMEvent_DeleteInline") {
+  vm.setOptions(QBDI::Options::OPT_INLINE_VM_EVENTS);
+  CheckBasicBlockData data{false, 0, 0, 0};
+  uint32_t id = vm.addVMEventCB(QBDI::BASIC_BLOCK_ENTRY |
+                                    QBDI::BASIC_BLOCK_EXIT,
+                                checkBasicBlock, &data);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  uint32_t newBB = 0;
+  countNewBasicBlocks(vm, newBB);
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  callDummyFunBB(vm, backup);
+  CHECK(data.count != 0);
+  CHECK(newBB != 0);
+
+  // the cached sequences with the callback sites are translated again
+  REQUIRE(vm.deleteInstrumentation(id));
+  data.count = 0;
+  newBB = 0;
+  callDummyFunBB(vm, backup);
+  CHECK(data.count == 0);
+  CHECK(newBB != 0);
+
+  newBB = 0;
+  callDummyFunBB(vm, backup);
+  CHECK(newBB == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BlockChaining") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  int expected = dummyFunBB(5, 8, 13, dummyFun1, dummyFun1, dummyFun1);
+  for (int i = 0; i < 2; i++) {
+    vm.setGPRState(&backup);
+    QBDI::rword retval;
+    bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                       {5, 8, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                        reinterpret_cast<QBDI::rword>(dummyFun1),
+                        reinterpret_cast<QBDI::rword>(dummyFun1)});
+    REQUIRE(ran);
+    REQUIRE((int)retval == expected);
+  }
+
+  // linked sequences must still reach every instruction callback
+  uint32_t countChained = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &countChained);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  for (int i = 0; i < 2; i++) {
+    vm.setGPRState(&backup);
+    countChained = 0;
+    QBDI::rword retval;
+    bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                       {5, 8, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                        reinterpret_cast<QBDI::rword>(dummyFun1),
+                        reinterpret_cast<QBDI::rword>(dummyFun1)});
+    REQUIRE(ran);
+    REQUIRE((int)retval == expected);
+  }
+  REQUIRE(countChained != 0);
+  vm.deleteInstrumentation(id);
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+
+  uint32_t count = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  vm.setGPRState(&backup);
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                     {5, 8, 13, reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1),
+                      reinterpret_cast<QBDI::rword>(dummyFun1)});
+  REQUIRE(ran);
+  REQUIRE((int)retval == expected);
+  REQUIRE(count == countChained);
+  vm.deleteAllInstrumentations();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BlockChainingIndirect") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  // the indirect calls and returns of dummyFunBB change of target between
+  // two runs
+  int (*funs[])(int) = {dummyFun1, dummyFunCall};
+  for (int i = 0; i < 16; i++) {
+    int (*f0)(int) = funs[i % 2];
+    int (*f1)(int) = funs[(i / 2) % 2];
+    int (*f2)(int) = funs[(i / 4) % 2];
+    int expected = dummyFunBB(i, 5, 13, f0, f1, f2);
+
+    vm.setGPRState(&backup);
+    QBDI::rword retval;
+    bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                       {static_cast<QBDI::rword>(i), 5, 13,
+                        reinterpret_cast<QBDI::rword>(f0),
+                        reinterpret_cast<QBDI::rword>(f1),
+                        reinterpret_cast<QBDI::rword>(f2)});
+    REQUIRE(ran);
+    REQUIRE((int)retval == expected);
+  }
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-ShadowStack") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING |
+                QBDI::Options::OPT_ENABLE_SHADOW_STACK);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  // the recursion is deeper than the shadow return stack
+  for (int i = 0; i < 2; i++) {
+    callDummyFunRec(vm, backup, 12);
+  }
+
+  // the returns through the shadow stack must still reach every instruction
+  // callback
+  uint32_t countShadow = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &countShadow);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  callDummyFunRec(vm, backup, 8);
+  REQUIRE(countShadow != 0);
+  vm.deleteInstrumentation(id);
+
+  // the external calls return through the execBroker
+  callDummyFunBB(vm, backup);
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+
+  uint32_t count = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  callDummyFunRec(vm, backup, 8);
+  REQUIRE(count == countShadow);
+  vm.deleteAllInstrumentations();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BlockChainingStop") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING |
+                QBDI::Options::OPT_ENABLE_SHADOW_STACK);
+  const QBDI::rword funBB = reinterpret_cast<QBDI::rword>(dummyFunBB);
+  const QBDI::rword funRec = reinterpret_cast<QBDI::rword>(dummyFunRec);
+  const QBDI::rword fun1 = reinterpret_cast<QBDI::rword>(dummyFun1);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  // the first runs link the direct and the indirect calls
+  QBDI::rword retval;
+  for (int i = 0; i < 2; i++) {
+    vm.setGPRState(&backup);
+    REQUIRE(vm.call(&retval, funRec, {6}));
+    vm.setGPRState(&backup);
+    REQUIRE(vm.call(&retval, funBB, {5, 8, 13, fun1, fun1, fun1}));
+  }
+
+  // the next runs stop on the linked sequences
+  for (int i = 0; i < 2; i++) {
+    vm.setGPRState(&backup);
+    QBDI::simulateCall(vm.getGPRState(), FAKE_RET_ADDR, {6});
+    vm.run(funRec, funRec);
+    REQUIRE(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) == funRec);
+
+    vm.setGPRState(&backup);
+    QBDI::simulateCall(vm.getGPRState(), FAKE_RET_ADDR,
+                       {5, 8, 13, fun1, fun1, fun1});
+    vm.run(funBB, fun1);
+    REQUIRE(QBDI_GPR_GET(vm.getGPRState(), QBDI::REG_PC) == fun1);
+  }
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-Traces") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_TRACES);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  // the sequences of the recursion become hot and are written as traces
+  for (int i = 0; i < 4; i++) {
+    callDummyFunRec(vm, backup, 12);
+  }
+
+  // the path of dummyFunBB changes between two runs, the traces exit through
+  // their guards
+  int (*funs[])(int) = {dummyFun1, dummyFunCall};
+  for (int i = 0; i < 128; i++) {
+    int (*f0)(int) = funs[i % 2];
+    int (*f1)(int) = funs[(i / 2) % 2];
+    int (*f2)(int) = funs[(i / 4) % 2];
+    int expected = dummyFunBB(i, 5, 13, f0, f1, f2);
+
+    vm.setGPRState(&backup);
+    QBDI::rword retval;
+    bool ran = vm.call(&retval, reinterpret_cast<QBDI::rword>(dummyFunBB),
+                       {static_cast<QBDI::rword>(i), 5, 13,
+                        reinterpret_cast<QBDI::rword>(f0),
+                        reinterpret_cast<QBDI::rword>(f1),
+                        reinterpret_cast<QBDI::rword>(f2)});
+    REQUIRE(ran);
+    REQUIRE((int)retval == expected);
+  }
+
+  // the traces must reach every instruction callback
+  uint32_t countTraces = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &countTraces);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  for (int i = 0; i < 4; i++) {
+    countTraces = 0;
+    callDummyFunRec(vm, backup, 10);
+  }
+  REQUIRE(countTraces != 0);
+  vm.deleteAllInstrumentations();
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+
+  uint32_t count = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  callDummyFunRec(vm, backup, 10);
+  REQUIRE(count == countTraces);
+  vm.deleteAllInstrumentations();
+}
+
+#if defined(QBDI_ARCH_X86_64)
+TEST_CASE_METHOD(APITest, "VMTest-TranslationCache") {
+  const std::string path = "QBDITest_TranslationCache.bin";
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  uint32_t count = 0;
+  uint32_t countCPUID = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  vm.addMnemonicCB("CPUID", QBDI::InstPosition::PREINST, countInstruction,
+                   &countCPUID);
+  callDummyFunBB(vm, backup);
+  REQUIRE(count != 0);
+  REQUIRE(vm.saveTranslationCache(path));
+
+  // A VM with the same instrumentation reuses the instrumented code
+  QBDI::VM vm2;
+  vm2.addInstrumentedModuleFromAddr(reinterpret_cast<QBDI::rword>(dummyFunBB));
+  vm2.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  uint32_t idCPUID = vm2.addMnemonicCB("CPUID", QBDI::InstPosition::PREINST,
+                                       countInstruction, &countCPUID);
+  REQUIRE(vm2.loadTranslationCache(path));
+  REQUIRE_FALSE(
+      vm2.precacheBasicBlock(reinterpret_cast<QBDI::rword>(dummyFunBB)));
+
+  uint32_t expectedCount = count;
+  count = 0;
+  callDummyFunBB(vm2, backup);
+  REQUIRE(count == expectedCount);
+
+  // The loaded code isn't instrumented by the deleted rule and is kept
+  REQUIRE(countCPUID == 0);
+  REQUIRE(vm2.deleteInstrumentation(idCPUID));
+  REQUIRE_FALSE(
+      vm2.precacheBasicBlock(reinterpret_cast<QBDI::rword>(dummyFunBB)));
+
+  // The cache isn't used with another instrumentation
+  QBDI::VM vm3;
+  vm3.addInstrumentedModuleFromAddr(reinterpret_cast<QBDI::rword>(dummyFunBB));
+  REQUIRE_FALSE(vm3.loadTranslationCache(path));
+
+  std::remove(path.c_str());
+}
+#endif
+
+#if defined(QBDI_ARCH_X86_64)
+TEST_CASE_METHOD(APITest, "VMTest-SharedCache") {
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  uint32_t count = 0;
+  uint32_t newBlocks = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  countNewBasicBlocks(vm, newBlocks);
+
+  // A VM with the same instrumentation in another thread
+  QBDI::VM vm2;
+  vm2.addInstrumentedModuleFromAddr(reinterpret_cast<QBDI::rword>(dummyFunBB));
+  vm2.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  uint32_t newBlocks2 = 0;
+  countNewBasicBlocks(vm2, newBlocks2);
+  REQUIRE(vm2.shareCache(vm));
+
+  callDummyFunBB(vm, backup);
+  REQUIRE(newBlocks != 0);
+  uint32_t expectedCount = count;
+
+  // The second VM loads the regions published by the first one
+  // The assertions of the helper are rethrown in the test thread
+  std::exception_ptr error;
+  auto run2 = [&]() {
+    try {
+      callDummyFunBB(vm2, backup);
+    } catch (...) {
+      error = std::current_exception();
+    }
+  };
+  count = 0;
+  std::thread thread(run2);
+  thread.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  REQUIRE(count == expectedCount);
+  REQUIRE(newBlocks2 < newBlocks);
+
+  // The invalidated code is translated again by the second VM
+  vm.clearCache(reinterpret_cast<QBDI::rword>(dummyFunBB),
+                reinterpret_cast<QBDI::rword>(dummyFunBB) + 1);
+  newBlocks2 = 0;
+  count = 0;
+  std::thread thread2(run2);
+  thread2.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  REQUIRE(count == expectedCount);
+  REQUIRE(newBlocks2 != 0);
+}
+#endif
+
+TEST_CASE_METHOD(APITest, "VMTest-PrecacheAsync") {
+  QBDI::GPRState backup = *(vm.getGPRState());
+  const std::vector<QBDI::rword> functions = {
+      reinterpret_cast<QBDI::rword>(dummyFunBB),
+      reinterpret_cast<QBDI::rword>(dummyFunCall),
+      reinterpret_cast<QBDI::rword>(dummyFun1)};
+
+  uint32_t count = 0;
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  callDummyFunBB(vm, backup);
+  uint32_t expectedCount = count;
+  vm.deleteAllInstrumentations();
+
+  // The queued basic blocks are written in the cache by waitPrecache
+  vm.clearAllCache();
+  vm.precacheAsync(functions);
+  REQUIRE(vm.waitPrecache() == functions.size());
+  for (QBDI::rword addr : functions) {
+    REQUIRE_FALSE(vm.precacheBasicBlock(addr));
+  }
+  REQUIRE(vm.waitPrecache() == 0);
+
+  // A rule added after the queuing applies to the precached basic blocks
+  vm.clearAllCache();
+  vm.precacheAsync(functions);
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  REQUIRE(vm.waitPrecache() == functions.size());
+
+  // The configuration changes once the worker is idle
+  vm.clearAllCache();
+  REQUIRE(vm.waitPrecache() == 0);
+  vm.precacheAsync(functions);
+  vm.deleteAllInstrumentations();
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  REQUIRE(vm.waitPrecache() == functions.size());
+
+  count = 0;
+  callDummyFunBB(vm, backup);
+  REQUIRE(count == expectedCount);
+
+  // The execution doesn't wait for the queued basic blocks
+  vm.clearAllCache();
+  vm.precacheAsync(functions);
+  count = 0;
+  callDummyFunBB(vm, backup);
+  REQUIRE(count == expectedCount);
+  vm.waitPrecache();
+  vm.deleteAllInstrumentations();
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-PrecacheFunction") {
+  const QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFunRec);
+  uint32_t newBlocks = 0;
+  countNewBasicBlocks(vm, newBlocks);
+
+  // The recursive calls and the branches of the function are followed
+  size_t codeSize = 0;
+  REQUIRE(vm.precacheFunction(addr, &codeSize) > 1);
+  REQUIRE(codeSize != 0);
+  REQUIRE(vm.precacheFunction(addr, &codeSize) == 0);
+  REQUIRE(codeSize == 0);
+
+  QBDI::rword retval;
+  bool ran = vm.call(&retval, addr, {8});
+  REQUIRE(ran);
+  REQUIRE((int)retval == dummyFunRec(8));
+  REQUIRE(newBlocks == 0);
+
+  // Only the first basic block is inside the range
+  vm.clearAllCache();
+  REQUIRE(vm.precacheRange(addr, addr + 1, &codeSize) == 1);
+  REQUIRE(codeSize != 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-DeleteInstrumentation") {
+  uint32_t newBlocks = 0;
+  countNewBasicBlocks(vm, newBlocks);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  // A rule which doesn't instrument the cached instructions is deleted
+  // without clearing the cache
+  uint32_t count = 0;
+  uint32_t id = vm.addMnemonicCB("CPUID", QBDI::InstPosition::PREINST,
+                                 countInstruction, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks != 0);
+  REQUIRE(count == 0);
+
+  REQUIRE(vm.deleteInstrumentation(id));
+  newBlocks = 0;
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks == 0);
+
+  // The instructions instrumented by a rule are translated again when the
+  // rule is deleted
+  id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(count != 0);
+
+  REQUIRE(vm.deleteInstrumentation(id));
+  count = 0;
+  newBlocks = 0;
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks != 0);
+  REQUIRE(count == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-CallbackSlots") {
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_CALLBACK_SLOTS);
+  uint32_t newBlocks = 0;
+  countNewBasicBlocks(vm, newBlocks);
+
+  // backup GPRState to have the same state before each run
+  QBDI::GPRState backup = *(vm.getGPRState());
+
+  uint32_t count1 = 0;
+  uint32_t count2 = 0;
+  uint32_t id = vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction,
+                             &count1);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks != 0);
+  uint32_t expected = count1;
+  REQUIRE(expected != 0);
+
+  // A disabled callback is skipped without translating the code again
+  REQUIRE(vm.setCallbackEnabled(id, false));
+  count1 = 0;
+  newBlocks = 0;
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks == 0);
+  REQUIRE(count1 == 0);
+
+  // The callback receives its new data once enabled again
+  REQUIRE(vm.setInstrumentationData(id, &count2));
+  REQUIRE(vm.setCallbackEnabled(id, true));
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks == 0);
+  REQUIRE(count1 == 0);
+  REQUIRE(count2 == expected);
+
+  REQUIRE_FALSE(vm.setCallbackEnabled(id + 1000, false));
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-InlineInstrumentation") {
+  const QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFunRec);
+  const QBDI::rword start = 0;
+  const QBDI::rword end = static_cast<QBDI::rword>(-1);
+  QBDI::rword retval;
+
+  uint32_t count = 0;
+  QBDI::rword counter = 0;
+  std::vector<uint8_t> bitmap(4096, 0);
+  std::unique_ptr<QBDI::InlineTraceBuffer> trace =
+      std::make_unique<QBDI::InlineTraceBuffer>();
+  trace->index = 0;
+
+  vm.addCodeCB(QBDI::InstPosition::PREINST, countInstruction, &count);
+  REQUIRE(vm.addInlineCounter(start, end, &counter) != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addInlineCoverage(start, end, bitmap.data(), bitmap.size()) !=
+          QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addInlineTrace(start, end, trace.get()) != QBDI::INVALID_EVENTID);
+
+  REQUIRE(vm.addInlineCounter(end, start, &counter) == QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addInlineCoverage(start, end, bitmap.data(), 0) ==
+          QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addInlineTrace(start, end, trace.get(),
+                            QBDI::INLINE_TRACE_REGISTER,
+                            QBDI::REG_PC) == QBDI::INVALID_EVENTID);
+
+  bool ran = vm.call(&retval, addr, {6});
+  REQUIRE(ran);
+  REQUIRE((int)retval == dummyFunRec(6));
+
+  REQUIRE(count != 0);
+  REQUIRE(counter == count);
+  REQUIRE(std::any_of(bitmap.begin(), bitmap.end(),
+                      [](uint8_t v) { return v == 1; }));
+  REQUIRE(trace->index == count % QBDI_INLINE_TRACE_SIZE);
+  REQUIRE(trace->addresses[0] == addr);
+  REQUIRE(trace->values[0] == 0);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-EdgeCoverage") {
+  uint32_t newBlocks = 0;
+  countNewBasicBlocks(vm, newBlocks);
+
+  QBDI::GPRState backup = *(vm.getGPRState());
+  std::vector<uint8_t> bitmap(QBDI_EDGE_MAP_SIZE, 0);
+
+  uint32_t id = vm.addEdgeCoverage(0, static_cast<QBDI::rword>(-1),
+                                   bitmap.data());
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addEdgeCoverage(0, 0, bitmap.data()) == QBDI::INVALID_EVENTID);
+
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(std::any_of(bitmap.begin(), bitmap.end(),
+                      [](uint8_t v) { return v != 0; }));
+  std::vector<uint8_t> firstRun = bitmap;
+
+  // A new input runs with the same cache and records the same edges
+  REQUIRE(vm.resetEdgeCoverage(id));
+  std::fill(bitmap.begin(), bitmap.end(), 0);
+  newBlocks = 0;
+  callDummyFunRec(vm, backup, 6);
+  REQUIRE(newBlocks == 0);
+  REQUIRE(bitmap == firstRun);
+
+  REQUIRE_FALSE(vm.resetEdgeCoverage(id + 1000));
+}
+
+struct BatchData {
+  std::vector<QBDI::BatchRecord> records;
+  uint32_t nbCalls;
+};
+
+static void collectBatch(QBDI::VMInstanceRef vm,
+                         const QBDI::BatchRecord *records, size_t nbRecords,
+                         void *data) {
+  BatchData *batch = static_cast<BatchData *>(data);
+  batch->records.insert(batch->records.end(), records, records + nbRecords);
+  batch->nbCalls++;
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BatchCB") {
+  const QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFunRec);
+  QBDI::GPRState backup = *(vm.getGPRState());
+  QBDI::rword retval;
+  BatchData batch{{}, 0};
+  uint32_t count = 0;
+
+  uint32_t id = vm.addBatchCB(0, static_cast<QBDI::rword>(-1), QBDI::REG_SP,
+                              collectBatch, &batch);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addBatchCB(0, 0, 0, collectBatch, &batch) ==
+          QBDI::INVALID_EVENTID);
+  REQUIRE(vm.addBatchCB(0, 1, QBDI::REG_PC, collectBatch, &batch) ==
+          QBDI::INVALID_EVENTID);
+  vm.addCodeCB(QBDI::PREINST, countInstruction, &count);
+
+  bool ran = vm.call(&retval, addr, {6});
+  REQUIRE(ran);
+  REQUIRE((int)retval == dummyFunRec(6));
+
+  // The records are delivered in a single batch at the end of the run
+  REQUIRE(batch.nbCalls == 1);
+  REQUIRE(batch.records.size() > 0);
+  REQUIRE(batch.records.size() <= count);
+  REQUIRE(batch.records[0].address == addr);
+  REQUIRE(std::any_of(batch.records.begin(), batch.records.end(),
+                      [](const QBDI::BatchRecord &r) {
+                        return r.accessAddress != 0;
+                      }));
+
+  // No record is written once the instrumentation is deleted
+  REQUIRE(vm.deleteInstrumentation(id));
+  batch.records.clear();
+  vm.setGPRState(&backup);
+  ran = vm.call(&retval, addr, {6});
+  REQUIRE(ran);
+  REQUIRE(batch.records.empty());
+  REQUIRE(batch.nbCalls == 1);
+}
+
+TEST_CASE_METHOD(APITest, "VMTest-BatchCBChaining") {
+  const QBDI::rword addr = reinterpret_cast<QBDI::rword>(dummyFunLoop);
+  QBDI::GPRState backup = *(vm.getGPRState());
+  QBDI::rword retval;
+  BatchData batch{{}, 0};
+
+  uint32_t id = vm.addBatchCB(0, static_cast<QBDI::rword>(-1), QBDI::REG_SP,
+                              collectBatch, &batch);
+  REQUIRE(id != QBDI::INVALID_EVENTID);
+
+  bool ran = vm.call(&retval, addr, {30000});
+  REQUIRE(ran);
+  REQUIRE((int)retval == dummyFunLoop(30000));
+  size_t expected = batch.records.size();
+  REQUIRE(expected > QBDI_BATCH_SIZE);
+
+  // The loop writes more records than the buffer holds, none of them is lost
+  vm.setOptions(vm.getOptions() | QBDI::Options::OPT_ENABLE_BLOCK_CHAINING);
+  for (int i = 0; i < 2; i++) {
+    batch.records.clear();
+    vm.setGPRState(&backup);
+    ran = vm.call(&retval, addr, {30000});
+    REQUIRE(ran);
+    REQUIRE((int)retval == dummyFunLoop(30000));
+    REQUIRE(batch.records.size() == expected);
+  }
+}
+
 TEST_CASE_METHOD(APITest, "VMTest-CacheInvalidation") {
   uint32_t count1 = 0;
   uint32_t count2 = 0;
@@ -20,12 +20,15 @@
 
 #include <algorithm>
 #include <sstream>
+#include <string.h>
 #include <string>
 #include "inttypes.h"
 
 #include "QBDI/Memory.hpp"
 #include "QBDI/Platform.h"
 
+#include "Utility/System.h"
+
 TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-ATTSyntax") {
 
   InMemoryObject leaObj("leaq (%rax), %rbx\nret\n");
@@ -103,3 +106,98 @@ TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-setOption") {
 
   QBDI::alignedFree(fakestack);
 }
+
+static QBDI::VMAction writeXMM1(QBDI::VMInstanceRef vm,
+                                QBDI::GPRState *gprState,
+                                QBDI::FPRState *fprState, void *data) {
+  QBDI::rword *xmm0 = static_cast<QBDI::rword *>(data);
+  memcpy(xmm0, fprState->xmm0, sizeof(QBDI::rword));
+  memset(fprState->xmm1, 0x42, sizeof(fprState->xmm1));
+  return QBDI::VMAction::CONTINUE;
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-ResumeFPR") {
+  // The callbacks after the last SSE instruction of the sequence don't switch
+  // the FPR, but the state of the callbacks must stay consistent
+
+  InMemoryObject sseObj("movq %rax, %xmm0\nleaq 0x20(%rax), %rax\n"
+                        "leaq 0x20(%rax), %rax\nret\n");
+  QBDI::rword addr = (QBDI::rword)sseObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+  state->rax = 0x1234;
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+  vm.addInstrumentedRange(addr, addr + (QBDI::rword)sseObj.getCode().size());
+
+  QBDI::rword xmm0 = 0;
+  vm.addCodeCB(QBDI::POSTINST, writeXMM1, &xmm0);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, addr, {}));
+  REQUIRE(state->rax == 0x1274);
+  REQUIRE(xmm0 == 0x1234);
+
+  const QBDI::FPRState *fprState = vm.getFPRState();
+  QBDI::rword finalXMM0;
+  memcpy(&finalXMM0, fprState->xmm0, sizeof(finalXMM0));
+  REQUIRE(finalXMM0 == 0x1234);
+  char expected[sizeof(fprState->xmm1)];
+  memset(expected, 0x42, sizeof(expected));
+  REQUIRE(memcmp(fprState->xmm1, expected, sizeof(expected)) == 0);
+
+  QBDI::alignedFree(fakestack);
+}
+
+TEST_CASE_METHOD(OptionsTest, "OptionsTest_X86_64-AVX512") {
+  if (!QBDI::isHostCPUFeaturePresent("avx512f")) {
+    WARN("Host doesn't support avx512f feature: SKIP");
+    return;
+  }
+  // The AVX-512 registers are only switched in the sequences that use them,
+  // but a VEX instruction still clears the upper bits of its ZMM
+
+  InMemoryObject avxObj("kmovw %k1, %eax\nvmovdqu64 %zmm20, %zmm21\nret\n",
+                        "", {"+avx512f"});
+  InMemoryObject vexObj("vpxor %xmm2, %xmm2, %xmm2\nret\n", "", {"+avx"});
+  QBDI::rword avxAddr = (QBDI::rword)avxObj.getCode().data();
+  QBDI::rword vexAddr = (QBDI::rword)vexObj.getCode().data();
+
+  uint8_t *fakestack;
+  QBDI::GPRState *state = vm.getGPRState();
+  bool ret = QBDI::allocateVirtualStack(state, 4096, &fakestack);
+  REQUIRE(ret == true);
+
+  vm.setOptions(QBDI::Options::NO_OPT);
+  vm.addInstrumentedRange(avxAddr,
+                          avxAddr + (QBDI::rword)avxObj.getCode().size());
+  vm.addInstrumentedRange(vexAddr,
+                          vexAddr + (QBDI::rword)vexObj.getCode().size());
+
+  QBDI::FPRState fprState = *vm.getFPRState();
+  memset(fprState.k1, 0x5a, sizeof(fprState.k1));
+  memset(fprState.zmm20, 0x33, sizeof(fprState.zmm20));
+  memset(fprState.zmm21, 0, sizeof(fprState.zmm21));
+  memset(fprState.zmm2, 0x44, sizeof(fprState.zmm2));
+  vm.setFPRState(&fprState);
+
+  QBDI::rword retval;
+  REQUIRE(vm.call(&retval, avxAddr, {}));
+  REQUIRE(retval == 0x5a5a);
+  REQUIRE(memcmp(vm.getFPRState()->zmm21, fprState.zmm20,
+                 sizeof(fprState.zmm20)) == 0);
+  REQUIRE(memcmp(vm.getFPRState()->zmm2, fprState.zmm2,
+                 sizeof(fprState.zmm2)) == 0);
+
+  REQUIRE(vm.call(&retval, vexAddr, {}));
+  char expected[sizeof(fprState.zmm2)];
+  memset(expected, 0, sizeof(expected));
+  REQUIRE(memcmp(vm.getFPRState()->zmm2, expected, sizeof(expected)) == 0);
+  REQUIRE(memcmp(vm.getFPRState()->zmm20, fprState.zmm20,
+                 sizeof(fprState.zmm20)) == 0);
+
+  QBDI::alignedFree(fakestack);
+}
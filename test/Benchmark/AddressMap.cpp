@@ -0,0 +1,112 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <QBDI.h>
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include "Utility/AddressMap.h"
+
+struct BenchLoc {
+  uint16_t blockIdx;
+  uint16_t instID;
+};
+
+// Addresses of cached instructions, spread over several modules
+static std::vector<QBDI::rword> getAddresses(size_t nb) {
+  std::vector<QBDI::rword> addresses;
+  QBDI::rword address = 0x400000;
+  for (size_t i = 0; i < nb; i++) {
+    address += 1 + (rand() % 15);
+    if ((i % 65536) == 65535) {
+      address += 0x1000000;
+    }
+    addresses.push_back(address);
+  }
+  return addresses;
+}
+
+// Lookup order of a dispatch: mostly the same addresses in a random order
+static std::vector<QBDI::rword>
+getLookups(const std::vector<QBDI::rword> &addresses, size_t nb) {
+  std::vector<QBDI::rword> lookups;
+  for (size_t i = 0; i < nb; i++) {
+    lookups.push_back(addresses[rand() % addresses.size()]);
+  }
+  return lookups;
+}
+
+TEST_CASE("Benchmark_AddressMap") {
+
+  for (size_t nb : {1000, 300000}) {
+    std::vector<QBDI::rword> addresses = getAddresses(nb);
+    std::vector<QBDI::rword> lookups = getLookups(addresses, 100000);
+
+    std::map<QBDI::rword, BenchLoc> treeCache;
+    QBDI::AddressMap<BenchLoc> flatCache;
+    for (size_t i = 0; i < addresses.size(); i++) {
+      treeCache[addresses[i]] = BenchLoc{0, static_cast<uint16_t>(i)};
+      flatCache[addresses[i]] = BenchLoc{0, static_cast<uint16_t>(i)};
+    }
+
+    BENCHMARK("std::map lookup " + std::to_string(nb) + " entries") {
+      uint32_t v = 0;
+      for (QBDI::rword address : lookups) {
+        auto it = treeCache.find(address);
+        if (it != treeCache.end()) {
+          v += it->second.instID;
+        }
+      }
+      return v;
+    };
+
+    BENCHMARK("AddressMap lookup " + std::to_string(nb) + " entries") {
+      uint32_t v = 0;
+      for (QBDI::rword address : lookups) {
+        const BenchLoc *loc = flatCache.find(address);
+        if (loc != nullptr) {
+          v += loc->instID;
+        }
+      }
+      return v;
+    };
+
+    BENCHMARK("std::map insertion " + std::to_string(nb) + " entries") {
+      std::map<QBDI::rword, BenchLoc> cache;
+      for (size_t i = 0; i < addresses.size(); i++) {
+        cache[addresses[i]] = BenchLoc{0, static_cast<uint16_t>(i)};
+      }
+      return cache.size();
+    };
+
+    BENCHMARK("AddressMap insertion " + std::to_string(nb) + " entries") {
+      QBDI::AddressMap<BenchLoc> cache;
+      for (size_t i = 0; i < addresses.size(); i++) {
+        cache[addresses[i]] = BenchLoc{0, static_cast<uint16_t>(i)};
+      }
+      return cache.size();
+    };
+  }
+}
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <atomic>
 #include <catch2/catch.hpp>
 #include <memory>
 
@@ -22,6 +23,7 @@
 #include "PatchEmpty.h"
 
 #include "QBDI/State.h"
+#include "Engine/PrecacheWorker.h"
 #include "ExecBlock/Context.h"
 #include "ExecBlock/ExecBlock.h"
 #include "ExecBlock/ExecBlockManager.h"
@@ -55,6 +57,60 @@ TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ClearCache") {
   REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424242));
 }
 
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-DispatchCache") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  execBlockManager.writeBasicBlock(getEmptyBB(0x42424242, *this), 1);
+  QBDI::SeqLoc seqLoc1;
+  QBDI::ExecBlock *block1 =
+      execBlockManager.getProgrammedExecBlock(0x42424242, &seqLoc1);
+  REQUIRE(nullptr != block1);
+  REQUIRE(execBlockManager.getDispatchCacheStats().hit == 0);
+  REQUIRE(execBlockManager.getDispatchCacheStats().miss == 1);
+
+  // the second lookup is resolved by the dispatch cache
+  QBDI::SeqLoc seqLoc2;
+  QBDI::ExecBlock *block2 =
+      execBlockManager.getProgrammedExecBlock(0x42424242, &seqLoc2);
+  REQUIRE(block1 == block2);
+  REQUIRE(seqLoc1.seqID == seqLoc2.seqID);
+  REQUIRE(seqLoc1.seqStart == seqLoc2.seqStart);
+  REQUIRE(seqLoc1.seqEnd == seqLoc2.seqEnd);
+  REQUIRE(execBlockManager.getDispatchCacheStats().hit == 1);
+  REQUIRE(execBlockManager.getDispatchCacheStats().miss == 1);
+
+  // the dispatch cache is invalidated with the cache
+  execBlockManager.clearCache();
+  REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x42424242));
+  REQUIRE(execBlockManager.getDispatchCacheStats().hit == 1);
+}
+
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-CacheBudget") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+
+  execBlockManager.writeBasicBlock(getEmptyBB(0x10000000, *this), 1);
+  execBlockManager.writeBasicBlock(getEmptyBB(0x20000000, *this), 1);
+  execBlockManager.writeBasicBlock(getEmptyBB(0x30000000, *this), 1);
+  QBDI::rword cacheSize = 0;
+  for (QBDI::rword address : {0x30000000, 0x20000000, 0x10000000}) {
+    QBDI::ExecBlock *block = execBlockManager.getProgrammedExecBlock(address);
+    REQUIRE(nullptr != block);
+    cacheSize += block->getMappedSize();
+  }
+  execBlockManager.setCacheBudget(cacheSize);
+  REQUIRE(execBlockManager.getEvictionStats().regions == 0);
+
+  // the region of 0x10000000 is the last executed, the new region evicts the
+  // colder ones
+  execBlockManager.writeBasicBlock(getEmptyBB(0x40000000, *this), 1);
+  REQUIRE(execBlockManager.isFlushPending());
+  REQUIRE(execBlockManager.getEvictionStats().regions >= 1);
+  execBlockManager.flushCommit();
+  REQUIRE(nullptr != execBlockManager.getProgrammedExecBlock(0x10000000));
+  REQUIRE(nullptr != execBlockManager.getProgrammedExecBlock(0x40000000));
+  REQUIRE(nullptr == execBlockManager.getProgrammedExecBlock(0x30000000));
+}
+
 TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ExecBlockReuse") {
   QBDI::ExecBlockManager execBlockManager(*this);
 
@@ -86,6 +142,47 @@ TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ExecBlockAlloc") {
           execBlockManager.getProgrammedExecBlock(0xfff));
 }
 
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-ExecBlockGrowth") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+  QBDI::rword address = 0;
+
+  for (address = 0; address < 0x1000; address++) {
+    execBlockManager.writeBasicBlock(getEmptyBB(address, *this), 1);
+  }
+
+  // the ExecBlocks of an overflowing region are bigger than the first one
+  QBDI::ExecBlock *first = execBlockManager.getProgrammedExecBlock(0);
+  QBDI::ExecBlock *last = execBlockManager.getProgrammedExecBlock(0xfff);
+  REQUIRE(first != last);
+  REQUIRE(first->getCodeSize() < last->getCodeSize());
+  REQUIRE(last->getCodeSize() <= QBDI::EXEC_BLOCK_MAX_CODE_SIZE);
+}
+
+TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-SharedContext") {
+  QBDI::ExecBlockManager execBlockManager(*this);
+  QBDI::rword address = 0;
+
+  for (address = 0; address < 0x1000; address++) {
+    execBlockManager.writeBasicBlock(getEmptyBB(address, *this), 1);
+  }
+  QBDI::Patch::Vec terminator = getEmptyBB(0x1000, *this);
+  terminator[0].append(QBDI::getTerminator(0x1000));
+  terminator[0].metadata.modifyPC = true;
+  execBlockManager.writeBasicBlock(std::move(terminator), 1);
+
+  // the ExecBlocks of a region use the context of the first one
+  QBDI::ExecBlock *first = execBlockManager.getProgrammedExecBlock(0);
+  QBDI::ExecBlock *last = execBlockManager.getProgrammedExecBlock(0x1000);
+  REQUIRE(first != last);
+  REQUIRE_FALSE(first->hasSharedContext());
+  REQUIRE(last->hasSharedContext());
+  REQUIRE(first->getContext() == last->getContext());
+
+  last->execute();
+  REQUIRE((QBDI::rword)0x1000 ==
+          QBDI_GPR_GET(&first->getContext()->gprState, QBDI::REG_PC));
+}
+
 TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-CacheRewrite") {
   QBDI::ExecBlockManager execBlockManager(*this);
   unsigned int i = 0;
@@ -151,3 +248,26 @@ TEST_CASE_METHOD(ExecBlockManagerTest, "ExecBlockManagerTest-Stresstest") {
             QBDI_GPR_GET(&block->getContext()->gprState, QBDI::REG_PC));
   }
 }
+
+TEST_CASE_METHOD(ExecBlockManagerTest,
+                 "ExecBlockManagerTest-PrecacheWorkerPause") {
+  std::atomic<size_t> translated(0);
+  QBDI::PrecacheWorker worker(
+      [this, &translated](QBDI::rword address, QBDI::CPUMode mode) {
+        translated++;
+        return getEmptyBB(address, *this);
+      });
+
+  worker.push({0x42424242, 0x13371337}, QBDI::CPUMode::DEFAULT);
+  worker.wait();
+  REQUIRE(translated == 2);
+
+  // The worker is idle when the results are queued again: the pause must
+  // wake it up
+  {
+    QBDI::PrecacheWorker::Pause pause(&worker);
+  }
+  worker.wait();
+  REQUIRE(translated == 4);
+  REQUIRE(worker.takeResults().size() == 2);
+}
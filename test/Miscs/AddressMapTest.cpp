@@ -0,0 +1,114 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <map>
+#include <stdint.h>
+
+#include <catch2/catch.hpp>
+
+#include "Utility/AddressMap.h"
+
+TEST_CASE("AddressMapTest-InsertFind") {
+  QBDI::AddressMap<uint32_t> map;
+  CHECK(map.empty());
+  CHECK(map.find(0x1000) == nullptr);
+  CHECK(map.count(0) == 0);
+
+  map[0x1000] = 1;
+  map[0x1004] = 2;
+  map[0] = 3;
+  CHECK(map.size() == 3);
+  REQUIRE(map.find(0x1000) != nullptr);
+  CHECK(*map.find(0x1000) == 1);
+  CHECK(*map.find(0x1004) == 2);
+  CHECK(*map.find(0) == 3);
+  CHECK(map.count(0x1008) == 0);
+
+  // operator[] doesn't insert an existing address twice
+  map[0x1000] = 4;
+  CHECK(map.size() == 3);
+  CHECK(*map.find(0x1000) == 4);
+
+  map.clear();
+  CHECK(map.empty());
+  CHECK(map.find(0x1000) == nullptr);
+  CHECK(map.find(0) == nullptr);
+}
+
+TEST_CASE("AddressMapTest-Rehash") {
+  QBDI::AddressMap<QBDI::rword> map;
+  std::map<QBDI::rword, QBDI::rword> ref;
+
+  // addresses of instructions are close to each other
+  for (QBDI::rword i = 1; i < 20000; i++) {
+    QBDI::rword address = 0x400000 + i * 3;
+    map[address] = i;
+    ref[address] = i;
+  }
+  CHECK(map.size() == ref.size());
+  for (const auto &it : ref) {
+    const QBDI::rword *v = map.find(it.first);
+    REQUIRE(v != nullptr);
+    CHECK(*v == it.second);
+  }
+  CHECK(map.find(0x400001) == nullptr);
+
+  size_t n = 0;
+  map.forEach([&](QBDI::rword address, const QBDI::rword &value) {
+    CHECK(ref.at(address) == value);
+    n++;
+  });
+  CHECK(n == ref.size());
+}
+
+TEST_CASE("AddressMapTest-Reserve") {
+  QBDI::AddressMap<QBDI::rword> map;
+  map[0x1000] = 1;
+  map.reserve(4096);
+  CHECK(map.size() == 1);
+  CHECK(*map.find(0x1000) == 1);
+
+  // no rehash after the reservation
+  const QBDI::rword *first = map.find(0x1000);
+  for (QBDI::rword i = 1; i < 4096; i++) {
+    map[0x1000 + i] = i;
+  }
+  CHECK(map.find(0x1000) == first);
+  CHECK(map.size() == 4096);
+}
+
+TEST_CASE("AddressMapTest-LookupFullTable") {
+  QBDI::AddressMap<QBDI::rword> map;
+
+  // the minimal table is full (load factor of 3/4) with 48 entries
+  for (QBDI::rword i = 1; i <= 48; i++) {
+    map[0x1000 + i] = i;
+  }
+  const QBDI::rword *first = map.find(0x1001);
+
+  // the lookup of an existing address doesn't rehash the table
+  CHECK(&map[0x1001] == first);
+  CHECK(map[0x1030] == 48);
+  CHECK(map.find(0x1001) == first);
+  CHECK(map.size() == 48);
+
+  // the insertion of a new address does
+  map[0x2000] = 49;
+  CHECK(map.size() == 49);
+  CHECK(*map.find(0x1001) == 1);
+  CHECK(*map.find(0x2000) == 49);
+}
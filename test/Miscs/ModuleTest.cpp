@@ -0,0 +1,113 @@
+/*
+ * This file is part of QBDI.
+ *
+ * Copyright 2017 - 2021 Quarkslab
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sstream>
+#include <stdint.h>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "Utility/Module.h"
+#include "Utility/Serialize.h"
+
+static int moduleTestFunction(int a) { return a + 1; }
+
+// Write the table of a process where the module was loaded at another address
+static void writeModule(std::ostream &os, const QBDI::ModuleId &module,
+                        QBDI::rword base,
+                        const std::vector<uint8_t> &buildId) {
+  QBDI::writeValue(os, static_cast<uint32_t>(1));
+  QBDI::writeString(os, module.name);
+  QBDI::writeValue(os, base);
+  QBDI::writeVector(os, buildId);
+}
+
+TEST_CASE("ModuleTest-AddressTableLocation") {
+  const QBDI::rword fun = reinterpret_cast<QBDI::rword>(moduleTestFunction);
+  QBDI::AddressTable table;
+  QBDI::AddressLocation loc;
+  QBDI::rword address = 0;
+
+  REQUIRE(table.getLocation(fun, loc));
+  CHECK_FALSE(loc.owned);
+  REQUIRE(table.getAddress(loc, address));
+  CHECK(address == fun);
+
+  // An object owned by the VM is located by its index
+  std::vector<QBDI::rword> object(4);
+  const QBDI::rword objectAddr = reinterpret_cast<QBDI::rword>(object.data());
+  uint32_t index = table.addOwned(objectAddr);
+  REQUIRE(table.getLocation(objectAddr, loc));
+  CHECK(loc.owned);
+  CHECK(loc.index == index);
+  REQUIRE(table.getAddress(loc, address));
+  CHECK(address == objectAddr);
+
+  // The other addresses of the heap aren't located
+  std::vector<QBDI::rword> heap(4);
+  const QBDI::rword heapAddr = reinterpret_cast<QBDI::rword>(heap.data());
+  CHECK_FALSE(table.getLocation(heapAddr, loc));
+}
+
+TEST_CASE("ModuleTest-AddressTableRelocation") {
+  const QBDI::rword fun = reinterpret_cast<QBDI::rword>(moduleTestFunction);
+  QBDI::AddressTable table;
+  QBDI::AddressLocation loc;
+  REQUIRE(table.getLocation(fun, loc));
+  const QBDI::ModuleId &module = table.getModule(loc.index);
+  const QBDI::rword otherBase = module.base ^ 0x40000000;
+  QBDI::rword address = 0;
+
+  // The address is relocated at the current base of the module
+  {
+    std::stringstream ss;
+    writeModule(ss, module, otherBase, module.buildId);
+    QBDI::AddressTable loaded;
+    REQUIRE(loaded.load(ss));
+    REQUIRE(loaded.getAddress({false, 0, loc.offset}, address));
+    CHECK(address == fun);
+  }
+  // unless the instrumentation depends on the absolute addresses
+  {
+    std::stringstream ss;
+    writeModule(ss, module, otherBase, module.buildId);
+    QBDI::AddressTable loaded;
+    loaded.setPositionDependent();
+    REQUIRE(loaded.load(ss));
+    CHECK_FALSE(loaded.getAddress({false, 0, loc.offset}, address));
+  }
+  // A module rebuilt since the cache was saved isn't used
+  {
+    std::stringstream ss;
+    std::vector<uint8_t> buildId = module.buildId;
+    buildId.push_back(0x42);
+    writeModule(ss, module, module.base, buildId);
+    QBDI::AddressTable loaded;
+    REQUIRE(loaded.load(ss));
+    CHECK_FALSE(loaded.getAddress({false, 0, loc.offset}, address));
+  }
+  // nor a module which isn't loaded
+  {
+    std::stringstream ss;
+    QBDI::ModuleId missing = module;
+    missing.name += ".missing";
+    writeModule(ss, missing, module.base, module.buildId);
+    QBDI::AddressTable loaded;
+    REQUIRE(loaded.load(ss));
+    CHECK_FALSE(loaded.getAddress({false, 0, loc.offset}, address));
+  }
+}
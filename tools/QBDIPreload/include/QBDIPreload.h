@@ -72,6 +72,21 @@ void qbdipreload_floatCtxToFPRState(const void *fprCtx, FPRState *fprState);
  */
 int qbdipreload_hook_main(void *main);
 
+/** Enable QBDIPreload hook on the threads created with `pthread_create` by
+ * the instrumented code. Each new thread runs its start routine in its own VM,
+ * configured by the `qbdipreload_on_thread_start` callback. Only supported on
+ * Linux.
+ *
+ * @warning It MUST be used in `qbdipreload_on_start` or `qbdipreload_on_main`,
+ * before the threads to instrument are created. `qbdipreload_on_thread_start`
+ * must be defined.
+ *
+ * @param[in] shareCache  Share the translated regions between the VMs of the
+ *                        threads and the VM of the default main handler
+ * @return     int        QBDIPreload state
+ */
+int qbdipreload_hook_threads(bool shareCache);
+
 /*
  * QBDIPreload callbacks
  *
@@ -127,6 +142,35 @@ extern int qbdipreload_on_run(VMInstanceRef vm, rword start, rword stop);
  */
 extern int qbdipreload_on_exit(int status);
 
+/*
+ * Optional QBDIPreload callbacks
+ *
+ * The following functions are only called once the threads are hooked
+ * with `qbdipreload_hook_threads`. They may be left undefined otherwise.
+ */
+
+/*! Function called in a new thread before its start routine. The VM
+ * instruments the same modules as the VM of the default main handler and has
+ * its own virtual stack. The start routine is called in the VM if the callback
+ * returns QBDIPRELOAD_NO_ERROR or QBDIPRELOAD_NOT_HANDLED, and natively
+ * otherwise.
+ * @param[in]  vm          VM instance of the thread.
+ * @param[in]  start       Address of the start routine of the thread.
+ * @return     int         QBDIPreload state
+ */
+extern int qbdipreload_on_thread_start(VMInstanceRef vm, rword start)
+    __attribute__((weak));
+
+/*! Function called when a thread started in a VM exits (by returning from its
+ * start routine or using `pthread_exit`). The VM must not be run in this
+ * callback.
+ * @param[in]  vm          VM instance of the thread.
+ * @param[in]  retval      Return value of the thread.
+ * @return     int         QBDIPreload state
+ */
+extern int qbdipreload_on_thread_exit(VMInstanceRef vm, rword retval)
+    __attribute__((weak));
+
 /*
  * Private API
  */
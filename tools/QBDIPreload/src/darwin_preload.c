@@ -405,6 +405,11 @@ int qbdipreload_hook_main(void *main) {
   return QBDIPRELOAD_NO_ERROR;
 }
 
+int qbdipreload_hook_threads(bool shareCache) {
+  // not supported on macOS
+  return QBDIPRELOAD_ERR_STARTUP_FAILED;
+}
+
 QBDI_FORCE_EXPORT void intercept_exit(int status) {
   if (!HAS_EXITED && HAS_PRELOAD) {
     HAS_EXITED = true;
@@ -18,6 +18,8 @@
 #include "QBDIPreload.h"
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +46,9 @@ static const size_t STACK_SIZE = 8388608;
 static bool HAS_EXITED = false;
 static bool HAS_PRELOAD = false;
 static bool DEFAULT_HANDLER = false;
+static bool HOOK_THREADS = false;
+static VMInstanceRef THREAD_CACHE_VM = NULL;
+static __thread VMInstanceRef THREAD_VM = NULL;
 GPRState ENTRY_GPR;
 FPRState ENTRY_FPR;
 
@@ -73,6 +78,25 @@ void unsetEntryBreakpoint() {
   mprotect((void *)base, pageSize, PROT_READ | PROT_EXEC);
 }
 
+void catchEntrypoint(int argc, char **argv);
+
+static void instrumentProcess(VMInstanceRef vm) {
+  qbdi_instrumentAllExecutableMaps(vm);
+
+  size_t size = 0;
+  qbdi_MemoryMap *modules = qbdi_getCurrentProcessMaps(false, &size);
+
+  // Filter some modules to avoid conflicts
+  qbdi_removeInstrumentedModuleFromAddr(vm, (rword)&catchEntrypoint);
+  removeConflictModule(vm, modules, size);
+
+  qbdi_freeMemoryMapArray(modules, size);
+
+  if (THREAD_CACHE_VM != NULL) {
+    qbdi_shareCache(vm, THREAD_CACHE_VM);
+  }
+}
+
 void catchEntrypoint(int argc, char **argv) {
   int status = QBDIPRELOAD_NOT_HANDLED;
 
@@ -83,16 +107,7 @@ void catchEntrypoint(int argc, char **argv) {
   if (DEFAULT_HANDLER && (status == QBDIPRELOAD_NOT_HANDLED)) {
     VMInstanceRef vm;
     qbdi_initVM(&vm, NULL, NULL, 0);
-    qbdi_instrumentAllExecutableMaps(vm);
-
-    size_t size = 0;
-    qbdi_MemoryMap *modules = qbdi_getCurrentProcessMaps(false, &size);
-
-    // Filter some modules to avoid conflicts
-    qbdi_removeInstrumentedModuleFromAddr(vm, (rword)&catchEntrypoint);
-    removeConflictModule(vm, modules, size);
-
-    qbdi_freeMemoryMapArray(modules, size);
+    instrumentProcess(vm);
 
     // Set original states
     qbdi_setGPRState(vm, &ENTRY_GPR);
@@ -150,6 +165,108 @@ int qbdipreload_hook_main(void *main) {
   return QBDIPRELOAD_NO_ERROR;
 }
 
+int qbdipreload_hook_threads(bool shareCache) {
+  if (qbdipreload_on_thread_start == NULL) {
+    fprintf(stderr, "qbdipreload_on_thread_start isn't defined\n");
+    return QBDIPRELOAD_ERR_STARTUP_FAILED;
+  }
+  if (shareCache && THREAD_CACHE_VM == NULL) {
+    // The VM owns the shared cache and is never run. Sharing its own cache
+    // creates it before any thread can share it concurrently.
+    qbdi_initVM(&THREAD_CACHE_VM, NULL, NULL, 0);
+    if (!qbdi_shareCache(THREAD_CACHE_VM, THREAD_CACHE_VM)) {
+      qbdi_terminateVM(THREAD_CACHE_VM);
+      THREAD_CACHE_VM = NULL;
+    }
+  }
+  HOOK_THREADS = true;
+  return QBDIPRELOAD_NO_ERROR;
+}
+
+struct ThreadStart {
+  void *(*routine)(void *);
+  void *arg;
+};
+
+static void exitThread(VMInstanceRef vm, rword retval) {
+  if (qbdipreload_on_thread_exit != NULL) {
+    qbdipreload_on_thread_exit(vm, retval);
+  }
+}
+
+static void *threadEntrypoint(void *data) {
+  struct ThreadStart start = *((struct ThreadStart *)data);
+  free(data);
+
+  VMInstanceRef vm;
+  qbdi_initVM(&vm, NULL, NULL, 0);
+  instrumentProcess(vm);
+
+  int status = qbdipreload_on_thread_start(vm, (rword)start.routine);
+
+  uint8_t *stack = NULL;
+  if ((status != QBDIPRELOAD_NO_ERROR && status != QBDIPRELOAD_NOT_HANDLED) ||
+      !qbdi_allocateVirtualStack(qbdi_getGPRState(vm), STACK_SIZE, &stack)) {
+    qbdi_terminateVM(vm);
+    return start.routine(start.arg);
+  }
+
+  rword retval = 0;
+  THREAD_VM = vm;
+  qbdi_call(vm, &retval, (rword)start.routine, 1, (rword)start.arg);
+  THREAD_VM = NULL;
+
+  exitThread(vm, retval);
+  qbdi_alignedFree(stack);
+  qbdi_terminateVM(vm);
+  return (void *)retval;
+}
+
+typedef int (*pthread_create_fn)(pthread_t *, const pthread_attr_t *,
+                                 void *(*)(void *), void *);
+
+QBDI_FORCE_EXPORT int pthread_create(pthread_t *thread,
+                                     const pthread_attr_t *attr,
+                                     void *(*start_routine)(void *),
+                                     void *arg) {
+  pthread_create_fn o_pthread_create =
+      (pthread_create_fn)dlsym(RTLD_NEXT, "pthread_create");
+
+  // The code run in a VM reaches this function through the transfer block of
+  // the ExecBroker, which isn't part of any module. The threads created by
+  // the native code (like the precache worker of QBDI) aren't hooked.
+  Dl_info info;
+  if (!HOOK_THREADS || !HAS_PRELOAD ||
+      dladdr(__builtin_return_address(0), &info) != 0) {
+    return o_pthread_create(thread, attr, start_routine, arg);
+  }
+
+  struct ThreadStart *start = malloc(sizeof(struct ThreadStart));
+  if (start == NULL) {
+    return EAGAIN;
+  }
+  start->routine = start_routine;
+  start->arg = arg;
+
+  int ret = o_pthread_create(thread, attr, threadEntrypoint, start);
+  if (ret != 0) {
+    free(start);
+  }
+  return ret;
+}
+
+QBDI_FORCE_EXPORT void pthread_exit(void *retval) {
+  VMInstanceRef vm = THREAD_VM;
+  if (vm != NULL) {
+    // The thread leaves the VM in the middle of its run: the VM and its
+    // virtual stack cannot be released.
+    THREAD_VM = NULL;
+    exitThread(vm, (rword)retval);
+  }
+  ((void (*)(void *))dlsym(RTLD_NEXT, "pthread_exit"))(retval);
+  __builtin_unreachable();
+}
+
 QBDI_FORCE_EXPORT void exit(int status) {
   if (!HAS_EXITED && HAS_PRELOAD) {
     HAS_EXITED = true;
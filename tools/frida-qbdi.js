@@ -747,6 +747,34 @@ var Options = Object.freeze({
      * execblock doesn't used FPR.
      */
     OPT_DISABLE_OPTIONAL_FPR : 1<<1,
+    /**
+     * Link the sequences of an ExecBlock together when they exit to a
+     * constant address. Indirect exits use an inline cache of their last
+     * targets. VMEvent on sequences and basic blocks disable the links.
+     */
+    OPT_ENABLE_BLOCK_CHAINING : 1<<2,
+    /**
+     * Maintain a shadow return stack to link the returns to the instruction
+     * following their call. Needs OPT_ENABLE_BLOCK_CHAINING.
+     */
+    OPT_ENABLE_SHADOW_STACK : 1<<3,
+    /**
+     * Count the executions of the sequences and write the hot paths as
+     * traces with side exits. VMEvent on sequences and basic blocks disable
+     * the traces.
+     */
+    OPT_ENABLE_TRACES : 1<<4,
+    /**
+     * The callbacks read their function and data in the data block. They can
+     * be enabled, disabled or receive a new data without clearing the cache.
+     */
+    OPT_ENABLE_CALLBACK_SLOTS : 1<<5,
+    /**
+     * Signal the VMEvent on sequences and basic blocks from callback sites at
+     * the boundaries of the translated basic blocks. The sequences can be
+     * linked and traced.
+     */
+    OPT_INLINE_VM_EVENTS : 1<<6,
     /**
      * Used the AT&T syntax for instruction disassembly (for X86 and X86_64)
      */
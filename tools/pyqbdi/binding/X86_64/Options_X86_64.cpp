@@ -32,6 +32,27 @@ void init_binding_Options(py::module_ &m) {
       .value("OPT_DISABLE_OPTIONAL_FPR", Options::OPT_DISABLE_OPTIONAL_FPR,
              "Disable context switch optimisation when the target execblock "
              "doesn't used FPR")
+      .value("OPT_ENABLE_BLOCK_CHAINING", Options::OPT_ENABLE_BLOCK_CHAINING,
+             "Link the sequences of an ExecBlock together when they exit to a "
+             "constant address. Indirect exits use an inline cache of their "
+             "last targets. VMEvent on sequences and basic blocks disable the "
+             "links.")
+      .value("OPT_ENABLE_SHADOW_STACK", Options::OPT_ENABLE_SHADOW_STACK,
+             "Maintain a shadow return stack to link the returns to the "
+             "instruction following their call. Needs "
+             "OPT_ENABLE_BLOCK_CHAINING.")
+      .value("OPT_ENABLE_TRACES", Options::OPT_ENABLE_TRACES,
+             "Count the executions of the sequences and write the hot paths "
+             "as traces with side exits. VMEvent on sequences and basic "
+             "blocks disable the traces.")
+      .value("OPT_ENABLE_CALLBACK_SLOTS", Options::OPT_ENABLE_CALLBACK_SLOTS,
+             "The callbacks read their function and data in the data block. "
+             "They can be enabled, disabled or receive a new data without "
+             "clearing the cache.")
+      .value("OPT_INLINE_VM_EVENTS", Options::OPT_INLINE_VM_EVENTS,
+             "Signal the VMEvent on sequences and basic blocks from callback "
+             "sites at the boundaries of the translated basic blocks. The "
+             "sequences can be linked and traced.")
       .value("OPT_ATT_SYNTAX", Options::OPT_ATT_SYNTAX,
              "Used the AT&T syntax for instruction disassembly")
       .value("OPT_ENABLE_FS_GS", Options::OPT_ENABLE_FS_GS,